@@ -0,0 +1,137 @@
+/* LibreSolar charge controller firmware
+ * Copyright (c) 2016-2019 Martin Jäger (www.libre.solar)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "adc_capture.h"
+
+#include "pcb.h"
+#include <stdio.h>
+#include <time.h>
+
+AdcCapture adc_capture;
+
+extern time_t timestamp;
+
+#if ADC_CAPTURE_DEPTH > 0
+
+static_assert(ADC_CAPTURE_PRE_TRIGGER < ADC_CAPTURE_DEPTH,
+    "ADC_CAPTURE_PRE_TRIGGER must be lower than ADC_CAPTURE_DEPTH");
+
+static uint16_t capture_buf[ADC_CAPTURE_DEPTH][NUM_ADC_CH];
+
+static volatile int write_pos = 0;          // next position to be written
+static volatile int num_samples = 0;        // valid samples in buffer
+static volatile int num_pre_trigger = 0;    // samples before trigger (valid if triggered)
+static volatile int post_remaining = 0;     // samples to be recorded after trigger
+
+void adc_capture_sample(const volatile uint16_t *readings)
+{
+    if (adc_capture.state == ADC_CAPTURE_FROZEN) {
+        return;
+    }
+
+    for (int i = 0; i < NUM_ADC_CH; i++) {
+        capture_buf[write_pos][i] = readings[i];
+    }
+    if (++write_pos >= ADC_CAPTURE_DEPTH) {
+        write_pos = 0;
+    }
+    if (num_samples < ADC_CAPTURE_DEPTH) {
+        num_samples++;
+    }
+
+    if (adc_capture.state == ADC_CAPTURE_TRIGGERED && --post_remaining <= 0) {
+        adc_capture.state = ADC_CAPTURE_FROZEN;
+    }
+}
+
+void adc_capture_trigger(uint32_t cause)
+{
+    if (adc_capture.state != ADC_CAPTURE_ARMED) {
+        return;
+    }
+
+    adc_capture.cause = cause;
+    adc_capture.timestamp = timestamp;
+
+    num_pre_trigger = (num_samples < ADC_CAPTURE_PRE_TRIGGER) ?
+        num_samples : ADC_CAPTURE_PRE_TRIGGER;
+    post_remaining = ADC_CAPTURE_DEPTH - ADC_CAPTURE_PRE_TRIGGER;
+    adc_capture.state = ADC_CAPTURE_TRIGGERED;
+}
+
+void adc_capture_arm()
+{
+    adc_capture.state = ADC_CAPTURE_FROZEN;     // stop recording while resetting
+    num_samples = 0;
+    num_pre_trigger = 0;
+    write_pos = 0;
+    adc_capture.cause = 0;
+    adc_capture.timestamp = 0;
+    adc_capture.state = ADC_CAPTURE_ARMED;
+}
+
+int adc_capture_num_pre_trigger()
+{
+    return (adc_capture.state == ADC_CAPTURE_ARMED) ? num_samples : num_pre_trigger;
+}
+
+int adc_capture_num_samples()
+{
+    return num_samples;
+}
+
+uint16_t adc_capture_read(int sample, int channel)
+{
+    int index = sample + adc_capture_num_pre_trigger();     // index from oldest sample
+    if (index < 0 || index >= num_samples || channel < 0 || channel >= NUM_ADC_CH) {
+        return 0;
+    }
+
+    int pos = write_pos - num_samples + index;
+    if (pos < 0) {
+        pos += ADC_CAPTURE_DEPTH;
+    }
+    return capture_buf[pos][channel] >> 4;
+}
+
+#else
+
+void adc_capture_sample(const volatile uint16_t *readings) {;}
+void adc_capture_trigger(uint32_t cause) {;}
+void adc_capture_arm() {;}
+int adc_capture_num_pre_trigger() { return 0; }
+int adc_capture_num_samples() { return 0; }
+uint16_t adc_capture_read(int sample, int channel) { return 0; }
+
+#endif /* ADC_CAPTURE_DEPTH */
+
+void adc_capture_dump()
+{
+    int num_pre = adc_capture_num_pre_trigger();
+    int num = adc_capture_num_samples();
+
+    printf("# ADC capture state: %d, cause: 0x%.8X, timestamp: %u, sample rate: %d Hz\n",
+        adc_capture.state, (unsigned int)adc_capture.cause, (unsigned int)adc_capture.timestamp,
+        ADC_SAMPLE_FREQUENCY);
+
+    for (int s = -num_pre; s < num - num_pre; s++) {
+        printf("%d", s);
+        for (int ch = 0; ch < NUM_ADC_CH; ch++) {
+            printf(",%u", adc_capture_read(s, ch));
+        }
+        printf("\n");
+    }
+}
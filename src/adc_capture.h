@@ -0,0 +1,90 @@
+/* LibreSolar charge controller firmware
+ * Copyright (c) 2016-2019 Martin Jäger (www.libre.solar)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ADC_CAPTURE_H
+#define ADC_CAPTURE_H
+
+/** @file
+ *
+ * @brief Oscilloscope-style capture of raw ADC readings before and after an error event
+ *
+ * The DMA ISR stores each conversion sequence in a ring buffer of ADC_CAPTURE_DEPTH sequences.
+ * If an error flag is set (e.g. by the battery voltage alerts) or the load short circuit
+ * comparator fires, the capture is triggered: Another ADC_CAPTURE_DEPTH - ADC_CAPTURE_PRE_TRIGGER
+ * sequences are recorded and the buffer is frozen afterwards until re-armed.
+ *
+ * As the DMA blocks are processed with a delay, the trigger position is accurate to one block
+ * of ADC_DMA_SEQUENCES only.
+ */
+
+#include <stdint.h>
+
+/** ADC capture states
+ */
+enum AdcCaptureState {
+    ADC_CAPTURE_ARMED = 0,      ///< Continuously recording, waiting for trigger
+    ADC_CAPTURE_TRIGGERED,      ///< Trigger occured, recording post-trigger samples
+    ADC_CAPTURE_FROZEN          ///< Capture complete, buffer not modified until re-armed
+};
+
+/** Status of the ADC capture (for access via ThingSet)
+ */
+typedef struct {
+    uint16_t state;             ///< AdcCaptureState
+    uint32_t cause;             ///< Error flags (ERR_...) which triggered the capture
+    uint32_t timestamp;         ///< Timestamp of trigger event
+} AdcCapture;
+
+extern AdcCapture adc_capture;
+
+/** Stores one ADC conversion sequence (called from DMA ISR)
+ *
+ * @param readings Raw readings of all NUM_ADC_CH channels (left-aligned)
+ */
+void adc_capture_sample(const volatile uint16_t *readings);
+
+/** Triggers the capture if armed (safe to be called from ISR)
+ *
+ * @param cause Error flags which caused the trigger
+ */
+void adc_capture_trigger(uint32_t cause);
+
+/** Discards the current capture and starts recording again
+ */
+void adc_capture_arm();
+
+/** Number of sequences stored before the trigger event
+ */
+int adc_capture_num_pre_trigger();
+
+/** Number of valid sequences in the capture buffer
+ */
+int adc_capture_num_samples();
+
+/** Reads a raw value from the capture buffer
+ *
+ * @param sample Sample position relative to trigger event (negative values: before trigger)
+ * @param channel ADC channel pos ADC_POS_...
+ *
+ * @returns 12-bit ADC reading or 0 if sample position is not available
+ */
+uint16_t adc_capture_read(int sample, int channel);
+
+/** Prints the capture buffer via serial interface as CSV (one line per sequence)
+ */
+void adc_capture_dump();
+
+#endif /* ADC_CAPTURE_H */
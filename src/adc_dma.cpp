@@ -16,6 +16,7 @@
 
 #ifndef UNIT_TEST
 #include "mbed.h"
+#include "hal/us_ticker_api.h"
 #endif
 
 #include "main.h"
@@ -23,8 +24,10 @@
 #include <assert.h>
 
 #include "adc_dma.h"
+#include "adc_capture.h"
+#include "hardware.h"
+#include "ntc.h"
 #include "pcb.h"        // contains defines for pins
-#include <math.h>       // log for thermistor calculation
 
 // factory calibration values for internal voltage reference and temperature sensor
 // (see MCU datasheet, not RM)
@@ -51,128 +54,519 @@
     #define TSENSE_CAL2_VALUE 130.0  // temperature of second calibration point
 #endif
 
+// external trigger selection for ADC conversion sequence start
+#if defined(STM32F0)
+    #define ADC_EXTSEL_TIMER_TRGO ADC_CFGR1_EXTSEL_2    // TRG4: TIM15_TRGO
+#elif defined(STM32L0)
+    #define ADC_EXTSEL_TIMER_TRGO 0                     // TRG0: TIM6_TRGO
+#endif
+
 #ifdef PIN_REF_I_DCDC
 AnalogOut ref_i_dcdc(PIN_REF_I_DCDC);
 #endif
 
 
-static float solar_current_offset;
-static float load_current_offset;
+/** Fixed-point format of the channel scale factors
+ *
+ * The scale factors convert millivolts at the ADC pin into milli-units (mV or mA) of the measured
+ * quantity. Q14 leaves enough headroom for gains up to 32 (see static_assert below) without
+ * overflowing int32_t for reference voltages up to 4096 mV.
+ */
+#define ADC_SCALE_SHIFT 14
+
+/** Converts a float gain (e.g. ADC_GAIN_V_BAT) into a fixed-point scale factor
+ */
+static constexpr int32_t adc_scale_factor(double gain)
+{
+    return (int32_t)(gain * (1 << ADC_SCALE_SHIFT) + (gain >= 0 ? 0.5 : -0.5));
+}
+
+// scale factors are calculated at compile time from the gains specified in the PCB header
+static constexpr int32_t scale_v_bat = adc_scale_factor(ADC_GAIN_V_BAT);
+static constexpr int32_t scale_v_solar = adc_scale_factor(ADC_GAIN_V_SOLAR);
+static constexpr int32_t scale_i_load = adc_scale_factor(ADC_GAIN_I_LOAD);
+#if FEATURE_DCDC_CONVERTER
+static constexpr int32_t scale_i_dcdc = adc_scale_factor(ADC_GAIN_I_DCDC);
+#endif
+#if FEATURE_PWM_SWITCH
+static constexpr int32_t scale_i_solar = adc_scale_factor(ADC_GAIN_I_SOLAR);
+static constexpr int32_t scale_offset_v_solar = adc_scale_factor(ADC_OFFSET_V_SOLAR);
+#endif
+
+/** Checks if a scale factor can be multiplied with voltages up to 4096 mV without overflow
+ */
+static constexpr bool adc_scale_valid(int32_t scale)
+{
+    return scale <= INT32_MAX / 4096 && scale >= -INT32_MAX / 4096;
+}
+
+static_assert(adc_scale_valid(scale_v_bat) && adc_scale_valid(scale_v_solar) &&
+    adc_scale_valid(scale_i_load), "ADC gain too high for fixed-point scaling");
+#if FEATURE_DCDC_CONVERTER
+static_assert(adc_scale_valid(scale_i_dcdc), "ADC gain too high for fixed-point scaling");
+#endif
+#if FEATURE_PWM_SWITCH
+static_assert(adc_scale_valid(scale_i_solar) && adc_scale_valid(scale_offset_v_solar),
+    "ADC gain too high for fixed-point scaling");
+#endif
+
+static int32_t solar_current_offset;    // mA
+static int32_t load_current_offset;     // mA
+static int32_t adc_vcc = 3300;          // mV, updated by update_measurements()
+
+AdcCalibration adc_cal[ADC_CAL_NUM] = {
+    { 1.0, 0.0, 0.0, 1.0 },
+    { 1.0, 0.0, 0.0, 1.0 },
+    { 1.0, 0.0, 0.0, 1.0 },
+    { 1.0, 0.0, 0.0, 1.0 }
+};
+
+/** Fixed-point format of the calibration gains
+ *
+ * Q12 is sufficient for 0.025% resolution and leaves enough headroom for measured values up to
+ * 250 V or A at the max. gain of 2.0.
+ */
+#define ADC_CAL_SHIFT 12
+
+/** Sensor calibration converted into integers for update_measurements()
+ */
+typedef struct {
+    int32_t gain;                   ///< Gain in Q12
+    int32_t offset;                 ///< Offset in mV or mA
+    int32_t knee;                   ///< Knee in mV or mA (INT32_MAX = disabled)
+    int32_t gain_high;              ///< Gain above knee in Q12
+} AdcCalibrationFixed;
+
+static AdcCalibrationFixed adc_cal_fixed[ADC_CAL_NUM] = {
+    { 1 << ADC_CAL_SHIFT, 0, INT32_MAX, 1 << ADC_CAL_SHIFT },
+    { 1 << ADC_CAL_SHIFT, 0, INT32_MAX, 1 << ADC_CAL_SHIFT },
+    { 1 << ADC_CAL_SHIFT, 0, INT32_MAX, 1 << ADC_CAL_SHIFT },
+    { 1 << ADC_CAL_SHIFT, 0, INT32_MAX, 1 << ADC_CAL_SHIFT }
+};
+
+/** Applies sensor calibration to a measured value (only multiplications and shifts)
+ *
+ * @param value Measured value in milli-units (mV or mA)
+ * @param cal Fixed-point calibration of the channel
+ *
+ * @returns calibrated value in milli-units
+ */
+static inline int32_t adc_calibrated(int32_t value, const AdcCalibrationFixed &cal)
+{
+    int32_t result = ((value * cal.gain) >> ADC_CAL_SHIFT) + cal.offset;
+    if (value > cal.knee) {
+        result += ((value - cal.knee) * (cal.gain_high - cal.gain)) >> ADC_CAL_SHIFT;
+    }
+    return result;
+}
+
+/** Inverse of adc_calibrated() to convert limits into uncalibrated values
+ *
+ * @param value Calibrated value in milli-units (mV or mA)
+ * @param cal Fixed-point calibration of the channel
+ *
+ * @returns measured (uncalibrated) value in milli-units
+ */
+static int32_t adc_uncalibrated(int32_t value, const AdcCalibrationFixed &cal)
+{
+    int32_t result = ((value - cal.offset) << ADC_CAL_SHIFT) / cal.gain;
+    if (result > cal.knee) {
+        result = (((value - cal.offset) << ADC_CAL_SHIFT) + cal.knee * (cal.gain_high - cal.gain)) /
+            cal.gain_high;
+    }
+    return result;
+}
+
+bool adc_calibration_update()
+{
+    bool valid = true;
+    for (int i = 0; i < ADC_CAL_NUM; i++) {
+        AdcCalibration *cal = &adc_cal[i];
+        if (cal->gain < 0.5 || cal->gain > 2.0 || cal->offset < -10.0 || cal->offset > 10.0 ||
+            (cal->knee != 0 && (cal->knee < 0.0 || cal->knee > 100.0 ||
+            cal->gain_high < 0.5 || cal->gain_high > 2.0)))
+        {
+            cal->gain = 1.0;
+            cal->offset = 0.0;
+            cal->knee = 0.0;
+            cal->gain_high = 1.0;
+            valid = false;
+        }
+        adc_cal_fixed[i].gain = (int32_t)(cal->gain * (1 << ADC_CAL_SHIFT) + 0.5);
+        adc_cal_fixed[i].offset = (int32_t)(cal->offset * 1000 + (cal->offset >= 0 ? 0.5 : -0.5));
+        if (cal->knee > 0) {
+            adc_cal_fixed[i].knee = (int32_t)(cal->knee * 1000 + 0.5);
+            adc_cal_fixed[i].gain_high = (int32_t)(cal->gain_high * (1 << ADC_CAL_SHIFT) + 0.5);
+        }
+        else {
+            adc_cal_fixed[i].knee = INT32_MAX;
+            adc_cal_fixed[i].gain_high = adc_cal_fixed[i].gain;
+        }
+    }
+    return valid;
+}
+
+static_assert(ADC_SAMPLE_FREQUENCY % 1000 == 0,
+    "ADC_SAMPLE_FREQUENCY must be a multiple of 1 kHz");
+static_assert((uint64_t)NUM_ADC_CH * ADC_CONVERSION_TIME_NS * ADC_SAMPLE_FREQUENCY < 1000000000,
+    "ADC_SAMPLE_FREQUENCY too high, conversion sequence takes longer than sample period");
+static_assert(ADC_DMA_SEQUENCES >= 1, "ADC_DMA_SEQUENCES must be at least 1");
+
+#define ADC_SAMPLES_PER_MS (ADC_SAMPLE_FREQUENCY / 1000)
+
+// number of consecutive samples outside of the limits before an alert is triggered
+#define ADC_ALERT_SAMPLES ((ADC_ALERT_DELAY_US * ADC_SAMPLES_PER_MS / 1000 > 2) ? \
+    (ADC_ALERT_DELAY_US * ADC_SAMPLES_PER_MS / 1000) : 2)
+
+#if FEATURE_PWM_SWITCH
+static_assert(ADC_SAMPLE_FREQUENCY % PWM_FREQUENCY == 0,
+    "ADC_SAMPLE_FREQUENCY must be a multiple of PWM_FREQUENCY");
+
+// ADC and PWM timer are started synchronously, so each PWM period contains the same number of
+// ADC conversion sequences at fixed phase
+#define ADC_SEQ_PER_PWM_PERIOD (ADC_SAMPLE_FREQUENCY / PWM_FREQUENCY)
+
+static uint32_t adc_pwm_phase = 0;          // sequence index within PWM period
+static bool adc_pwm_solar_valid = true;     // solar channels of current sequence are used
+#endif
 
 // for ADC and DMA
-static volatile uint16_t adc_readings[NUM_ADC_CH] = {0};
-static volatile uint32_t adc_filtered[NUM_ADC_CH] = {0};
+
+// ping-pong buffer: DMA writes into one half while the other half is processed
+static volatile uint16_t adc_dma_buffer[2 * ADC_DMA_SEQUENCES * NUM_ADC_CH] = {0};
+
+// readings of the sequence currently processed
+static volatile uint16_t *adc_readings = adc_dma_buffer;
+
+static volatile uint32_t adc_filtered[NUM_ADC_CH] = {0};        // slow view
+static volatile uint32_t adc_filtered_fast[NUM_ADC_CH] = {0};   // fast view
+static volatile uint16_t adc_median_hist[NUM_ADC_CH][2] = {{0}};
+static volatile uint32_t adc_decimation_sum[NUM_ADC_CH] = {0};
+static volatile uint8_t adc_decimation_count[NUM_ADC_CH] = {0};
 static volatile AdcAlert adc_alerts_upper[NUM_ADC_CH] = {0};
 static volatile AdcAlert adc_alerts_lower[NUM_ADC_CH] = {0};
 
+/** State of the analog watchdog (AWD) alerts for ADC_POS_V_BAT
+ *
+ * Limits and callbacks are stored in adc_alerts_upper/lower, but the comparison is done by the
+ * ADC hardware. Consecutive samples are detected by the time between two AWD events.
+ */
+typedef struct {
+    uint32_t last_event_us;         ///< Timestamp of last AWD event in this direction
+    uint32_t inhibit_until_us;      ///< Events are ignored until this timestamp
+    bool inhibited;                 ///< Inhibit timestamp is valid
+    int count;                      ///< Number of consecutive samples outside of the window
+} AdcWatchdogState;
+
+static volatile AdcWatchdogState adc_awd_upper = {0};
+static volatile AdcWatchdogState adc_awd_lower = {0};
+
+#define ADC_SAMPLE_PERIOD_US (1000000 / ADC_SAMPLE_FREQUENCY)
+
+#ifdef UNIT_TEST
+// simulated time base for analog watchdog emulation, advanced with each V_BAT sample
+static uint32_t adc_awd_time_us = 0;
+#else
+static volatile uint32_t adc_awd_tr = 0;            // thresholds for ADC1->TR register
+static volatile bool adc_awd_tr_pending = false;    // adc_awd_tr not yet written to register
+#endif
+
+static inline uint32_t adc_awd_now()
+{
+#ifndef UNIT_TEST
+    return us_ticker_read();
+#else
+    return adc_awd_time_us;
+#endif
+}
+
 extern DeviceStatus dev_stat;
 
+/** Per-channel filter configuration stored in flash
+ *
+ * Currents get a fast view for protection purposes, temperatures are strongly filtered,
+ * all other channels use the common ADC_FILTER_CONST.
+ */
+struct AdcFilterTable
+{
+    AdcFilterConf conf[NUM_ADC_CH];
+
+    constexpr AdcFilterTable() : conf()
+    {
+        for (int i = 0; i < NUM_ADC_CH; i++) {
+            conf[i] = { ADC_PREFILTER_NONE, ADC_FILTER_CONST, 0, ADC_FILTER_CONST };
+        }
+        conf[ADC_POS_I_LOAD] = { ADC_PREFILTER_MEDIAN3, 2, 0, ADC_FILTER_CONST };
+#if FEATURE_DCDC_CONVERTER
+        conf[ADC_POS_I_DCDC] = { ADC_PREFILTER_MEDIAN3, 2, 0, ADC_FILTER_CONST };
+#endif
+#if FEATURE_PWM_SWITCH
+        // only one sample per PWM period (see adc_pwm_solar_sample), so less filtering needed
+        conf[ADC_POS_I_SOLAR] = { ADC_PREFILTER_MEDIAN3, 1, 0, 2 };
+        conf[ADC_POS_V_SOLAR] = { ADC_PREFILTER_NONE, 1, 0, 2 };
+#endif
+#ifdef PIN_ADC_TEMP_BAT
+        conf[ADC_POS_TEMP_BAT] = { ADC_PREFILTER_MEDIAN3, ADC_FILTER_CONST, 4, ADC_FILTER_CONST };
+#endif
+#ifdef PIN_ADC_TEMP_FETS
+        conf[ADC_POS_TEMP_FETS] = { ADC_PREFILTER_MEDIAN3, ADC_FILTER_CONST, 4, ADC_FILTER_CONST };
+#endif
+        conf[ADC_POS_TEMP_MCU] = { ADC_PREFILTER_MEDIAN3, ADC_FILTER_CONST, 4, ADC_FILTER_CONST };
+    }
+};
+
+static constexpr AdcFilterTable adc_filter;
+
 /**
- * Average value for ADC channel
+ * Average value for ADC channel (slow view)
  * @param channel valid ADC channel pos ADC_POS_..., see adc_h.c
  */
 static inline uint32_t adc_value(uint32_t channel)
 {
     assert(channel < NUM_ADC_CH);
-    return adc_filtered[channel] >> (4 + ADC_FILTER_CONST);
+    return adc_filtered[channel] >> (4 + adc_filter.conf[channel].slow_shift);
+}
+
+/**
+ * Fast filtered value for ADC channel (e.g. for protection functions)
+ * @param channel valid ADC channel pos ADC_POS_..., see adc_h.c
+ */
+static inline uint32_t adc_value_fast(uint32_t channel)
+{
+    assert(channel < NUM_ADC_CH);
+    return adc_filtered_fast[channel] >> (4 + adc_filter.conf[channel].fast_shift);
+}
+
+/**
+ * Runs the filter chain of a channel for a new sample
+ * @param channel valid ADC channel pos ADC_POS_..., see adc_h.c
+ * @param reading 12-bit ADC value left-aligned in uint16_t
+ */
+static inline void adc_filter_update(uint32_t channel, uint32_t reading)
+{
+    const AdcFilterConf *conf = &adc_filter.conf[channel];
+
+    if (conf->prefilter == ADC_PREFILTER_MEDIAN3) {
+        uint32_t a = adc_median_hist[channel][0];
+        uint32_t b = adc_median_hist[channel][1];
+        adc_median_hist[channel][0] = b;
+        adc_median_hist[channel][1] = reading;
+        // median of a, b and reading
+        uint32_t lo = (a < b) ? a : b;
+        uint32_t hi = (a < b) ? b : a;
+        reading = (reading < lo) ? lo : ((reading > hi) ? hi : reading);
+    }
+
+    // low pass filter with filter constant c = 1/(2^shift)
+    // y(n) = c * x(n) + (c - 1) * y(n-1)
+    // see also here: http://techteach.no/simview/lowpass_filter/doc/filter_algorithm.pdf
+    adc_filtered_fast[channel] += reading - (adc_filtered_fast[channel] >> conf->fast_shift);
+
+    if (conf->decimation_shift > 0) {
+        adc_decimation_sum[channel] += reading;
+        if (++adc_decimation_count[channel] < (1U << conf->decimation_shift)) {
+            return;
+        }
+        reading = adc_decimation_sum[channel] >> conf->decimation_shift;
+        adc_decimation_sum[channel] = 0;
+        adc_decimation_count[channel] = 0;
+    }
+    adc_filtered[channel] += reading - (adc_filtered[channel] >> conf->slow_shift);
 }
 
 /**
  * Measured voltage for ADC channel after average
  * @param channel valid ADC channel pos ADC_POS_..., see adc_h.c
  * @param vcc reference voltage in millivolts
- * 
- * @return voltage in millivolts 
+ *
+ * @return voltage in millivolts
  */
-static inline float adc_voltage(uint32_t channel, int32_t vcc)
+static inline int32_t adc_voltage(uint32_t channel, int32_t vcc)
 {
-    return (adc_value(channel) * vcc) / 4096;
+    return (adc_value(channel) * vcc) >> 12;
 }
+
 /**
  * Measured current/voltage for ADC channel after average and scaling
  * @param channel valid ADC channel pos ADC_POS_..., see adc_h.c
  * @param vcc reference voltage in millivolts
- * 
- * @return scaled final value 
+ * @param scale fixed-point scale factor calculated with adc_scale_factor()
+ *
+ * @return scaled final value in milli-units (mV or mA)
  */
-static inline float adc_scaled(uint32_t channel, int32_t vcc, const float gain)
+static inline int32_t adc_scaled(uint32_t channel, int32_t vcc, const int32_t scale)
 {
-    return adc_voltage(channel,vcc) * (gain/1000.0);
+    return (adc_voltage(channel, vcc) * scale) >> ADC_SCALE_SHIFT;
 }
 
-static inline float ntc_temp(uint32_t channel, int32_t vcc)
-{
-    /** \todo Improved (faster) temperature calculation:
-       https://www.embeddedrelated.com/showarticle/91.php
-    */
-
-    float v_temp = adc_voltage(channel, vcc);  // voltage read by ADC (mV)
-    float rts = NTC_SERIES_RESISTOR * v_temp / (vcc - v_temp); // resistance of NTC (Ohm)
-    
-    return 1.0/(1.0/(273.15+25) + 1.0/NTC_BETA_VALUE*log(rts/10000.0)) - 273.15; // °C
+#if defined(NTC_STEINHART_HART_A)
+static constexpr NtcTable ntc_table(NTC_SERIES_RESISTOR,
+    NTC_STEINHART_HART_A, NTC_STEINHART_HART_B, NTC_STEINHART_HART_C);
+#else
+static constexpr NtcTable ntc_table =
+    ntc_table_beta(NTC_SERIES_RESISTOR, NTC_BETA_VALUE, NTC_NOMINAL_RESISTANCE);
+#endif
 
+/**
+ * Temperature of NTC connected to ADC channel
+ * @param channel valid ADC channel pos ADC_POS_..., see adc_h.c
+ *
+ * @return temperature in °C
+ */
+static inline float ntc_temp(uint32_t channel)
+{
+    return ntc_table.lookup(adc_value(channel)) * 0.01;
 }
 
-
 void calibrate_current_sensors()
 {
     int vcc = VREFINT_VALUE * VREFINT_CAL / adc_value(ADC_POS_VREF_MCU);
 #if FEATURE_PWM_SWITCH
-    solar_current_offset = -adc_scaled(ADC_POS_I_SOLAR, vcc, ADC_GAIN_I_SOLAR);
+    solar_current_offset = -adc_scaled(ADC_POS_I_SOLAR, vcc, scale_i_solar);
 #endif
 #if FEATURE_DCDC_CONVERTER
-    solar_current_offset = -adc_scaled(ADC_POS_I_DCDC, vcc, ADC_GAIN_I_DCDC);
+    solar_current_offset = -adc_scaled(ADC_POS_I_DCDC, vcc, scale_i_dcdc);
 #endif
-    load_current_offset = -adc_scaled(ADC_POS_I_LOAD, vcc, ADC_GAIN_I_LOAD);
+    load_current_offset = -adc_scaled(ADC_POS_I_LOAD, vcc, scale_i_load);
 }
 
 void adc_update_value(unsigned int pos)
 {
-    // low pass filter with filter constant c = 1/(2^ADC_FILTER_CONST)
-    // y(n) = c * x(n) + (c - 1) * y(n-1)
-    // see also here: http://techteach.no/simview/lowpass_filter/doc/filter_algorithm.pdf
-
 #if FEATURE_PWM_SWITCH == 1
     if (pos == ADC_POS_V_SOLAR || pos == ADC_POS_I_SOLAR) {
-        // only read input voltage and current when switch is on or permanently off
-        if (pwm_switch.signal_high() || pwm_switch.active() == false) {
-            adc_filtered[pos] += (uint32_t)adc_readings[pos] - (adc_filtered[pos] >> ADC_FILTER_CONST);
+        // only read input voltage and current at fixed phase of PWM period
+        if (adc_pwm_solar_valid) {
+            adc_filter_update(pos, adc_readings[pos]);
         }
     }
     else
 #endif
     {
         // adc_readings: 12-bit ADC values left-aligned in uint16_t
-        adc_filtered[pos] += (uint32_t)adc_readings[pos] - (adc_filtered[pos] >> ADC_FILTER_CONST);
+        adc_filter_update(pos, adc_readings[pos]);
     }
 
-    // check upper alerts
-    adc_alerts_upper[pos].debounce_ms++;
-    if (adc_alerts_upper[pos].callback != NULL &&
-        adc_readings[pos] > adc_alerts_upper[pos].limit)
-    {
-        if (adc_alerts_upper[pos].debounce_ms > 1) {
-            // create function pointer and call function
-            adc_alerts_upper[pos].callback();
+    if (pos == ADC_POS_V_BAT) {
+#ifdef UNIT_TEST
+        // emulation of the analog watchdog hardware
+        adc_awd_time_us += ADC_SAMPLE_PERIOD_US;
+        if (adc_readings[pos] > adc_alerts_upper[pos].limit ||
+            adc_readings[pos] < adc_alerts_lower[pos].limit)
+        {
+            adc_watchdog_event(adc_readings[pos], adc_awd_time_us);
         }
+#endif
+        // limits checked by ADC analog watchdog
+        return;
     }
-    else if (adc_alerts_upper[pos].debounce_ms > 0) {
-        // reset debounce ms counter only if already close to triggering to allow setting negative
-        // values to specify a one-time inhibit delay
-        adc_alerts_upper[pos].debounce_ms = 0;
+
+    // check upper alerts
+    if (adc_alerts_upper[pos].callback != NULL) {
+        adc_alerts_upper[pos].debounce++;
+        if (adc_readings[pos] > adc_alerts_upper[pos].limit) {
+            if (adc_alerts_upper[pos].debounce >= ADC_ALERT_SAMPLES) {
+                // create function pointer and call function
+                adc_alerts_upper[pos].callback();
+            }
+        }
+        else if (adc_alerts_upper[pos].debounce > 0) {
+            // reset debounce counter only if already close to triggering to allow setting
+            // negative values to specify a one-time inhibit delay
+            adc_alerts_upper[pos].debounce = 0;
+        }
     }
 
     // same for lower alerts
-    adc_alerts_lower[pos].debounce_ms++;
-    if (adc_alerts_lower[pos].callback != NULL &&
-        adc_readings[pos] < adc_alerts_lower[pos].limit)
-    {
-        if (adc_alerts_lower[pos].debounce_ms > 1) {
-            adc_alerts_lower[pos].callback();
+    if (adc_alerts_lower[pos].callback != NULL) {
+        adc_alerts_lower[pos].debounce++;
+        if (adc_readings[pos] < adc_alerts_lower[pos].limit) {
+            if (adc_alerts_lower[pos].debounce >= ADC_ALERT_SAMPLES) {
+                adc_alerts_lower[pos].callback();
+            }
+        }
+        else if (adc_alerts_lower[pos].debounce > 0) {
+            adc_alerts_lower[pos].debounce = 0;
+        }
+    }
+}
+
+void adc_watchdog_event(uint16_t reading, uint32_t now_us)
+{
+    volatile AdcWatchdogState *awd;
+    volatile AdcAlert *alert;
+
+    if (reading > adc_alerts_upper[ADC_POS_V_BAT].limit) {
+        awd = &adc_awd_upper;
+        alert = &adc_alerts_upper[ADC_POS_V_BAT];
+    }
+    else if (reading < adc_alerts_lower[ADC_POS_V_BAT].limit) {
+        awd = &adc_awd_lower;
+        alert = &adc_alerts_lower[ADC_POS_V_BAT];
+    }
+    else {
+        return;
+    }
+
+    if (awd->inhibited) {
+        if ((int32_t)(now_us - awd->inhibit_until_us) <= 0) {
+            awd->count = 0;
+            return;
         }
+        awd->inhibited = false;
+    }
+
+    // samples are consecutive if not more than 1.5 sample periods apart
+    if (awd->count > 0 && now_us - awd->last_event_us <= ADC_SAMPLE_PERIOD_US * 3 / 2) {
+        awd->count++;
+    }
+    else {
+        awd->count = 1;
+    }
+    awd->last_event_us = now_us;
+
+    if (awd->count >= ADC_ALERT_SAMPLES && alert->callback != NULL) {
+        alert->callback();
+    }
+}
+
+#if FEATURE_PWM_SWITCH
+/**
+ * Determines if the solar channels of a sequence are sampled at the intended PWM phase
+ *
+ * Solar voltage and current are sampled once per PWM period in the middle of the on-interval,
+ * so that the current is not affected by switching transients and the average current can be
+ * calculated exactly using the duty cycle. If the switch is permanently on or off, the sample
+ * in the middle of the period is used.
+ *
+ * @param phase Index of the ADC sequence within the PWM period (0 = start of on-interval)
+ */
+static inline bool adc_pwm_solar_sample(uint32_t phase)
+{
+    int on_samples = pwm_switch.on_samples(ADC_SEQ_PER_PWM_PERIOD);
+    if (pwm_switch.active() == false || on_samples >= ADC_SEQ_PER_PWM_PERIOD) {
+        return phase == ADC_SEQ_PER_PWM_PERIOD / 2;
     }
-    else if (adc_alerts_lower[pos].debounce_ms > 0) {
-        adc_alerts_lower[pos].debounce_ms = 0;
+    // at least 2 samples in on-interval necessary to skip turn-on transient
+    return on_samples >= 2 && phase == (uint32_t)on_samples / 2;
+}
+#endif
+
+void adc_update_block(volatile uint16_t *block, int num_sequences)
+{
+    for (int s = 0; s < num_sequences; s++) {
+#if FEATURE_PWM_SWITCH
+        // first sequence is triggered one ADC period after start of PWM period, the counter is
+        // resynchronized with the PWM timer in the DMA interrupt
+        if (++adc_pwm_phase >= ADC_SEQ_PER_PWM_PERIOD) {
+            adc_pwm_phase = 0;
+        }
+        adc_pwm_solar_valid = adc_pwm_solar_sample(adc_pwm_phase);
+#endif
+        adc_readings = &block[s * NUM_ADC_CH];
+        for (unsigned int i = 0; i < NUM_ADC_CH; i++) {
+            adc_update_value(i);
+        }
+        adc_capture_sample(adc_readings);
     }
 }
 
@@ -184,31 +578,42 @@ void update_measurements()
 
     // internal STM reference voltage
     int vcc = VREFINT_VALUE * VREFINT_CAL / adc_value(ADC_POS_VREF_MCU);
+    adc_vcc = vcc;
 
     // rely on LDO accuracy
     //int vcc = 3300;
 
+    // all voltages and currents are calculated as integers in mV and mA to avoid software
+    // floating point divisions (no FPU on STM32F0/L0) and only converted to float at the end
+
     // calculate lower voltage first, as it is needed for PWM terminal voltage calculation
-    lv_terminal.voltage = adc_scaled(ADC_POS_V_BAT, vcc, ADC_GAIN_V_BAT);
+    int32_t v_bat = adc_calibrated(adc_scaled(ADC_POS_V_BAT, vcc, scale_v_bat),
+        adc_cal_fixed[ADC_CAL_V_BAT]);
+    lv_terminal.voltage = v_bat * 0.001;
     load_terminal.voltage = lv_terminal.voltage;
 
 #if FEATURE_DCDC_CONVERTER
-    hv_terminal.voltage = adc_scaled(ADC_POS_V_SOLAR, vcc, ADC_GAIN_V_SOLAR);
+    int32_t v_solar = adc_calibrated(adc_scaled(ADC_POS_V_SOLAR, vcc, scale_v_solar),
+        adc_cal_fixed[ADC_CAL_V_SOLAR]);
+    hv_terminal.voltage = v_solar * 0.001;
     dcdc_lv_port.voltage = lv_terminal.voltage;
 #endif
 #if FEATURE_PWM_SWITCH
-    pwm_terminal.voltage = lv_terminal.voltage - vcc * (ADC_OFFSET_V_SOLAR / 1000.0) -
-        adc_scaled(ADC_POS_V_SOLAR, vcc, ADC_GAIN_V_SOLAR);
+    // solar channel measures the difference between battery and PWM terminal voltage
+    pwm_terminal.voltage = (v_bat - ((vcc * scale_offset_v_solar) >> ADC_SCALE_SHIFT) -
+        adc_calibrated(adc_scaled(ADC_POS_V_SOLAR, vcc, scale_v_solar),
+        adc_cal_fixed[ADC_CAL_V_SOLAR])) * 0.001;
     pwm_port_int.voltage = lv_terminal.voltage;
 #endif
 
-    load_terminal.current =
-        adc_scaled(ADC_POS_I_LOAD, vcc, ADC_GAIN_I_LOAD) + load_current_offset;
+    load_terminal.current = adc_calibrated(adc_scaled(ADC_POS_I_LOAD, vcc, scale_i_load) +
+        load_current_offset, adc_cal_fixed[ADC_CAL_I_LOAD]) * 0.001;
 
 #if FEATURE_PWM_SWITCH
     // current multiplied with PWM duty cycle for PWM charger to get avg current for correct power calculation
-    pwm_port_int.current = pwm_switch.get_duty_cycle() * (
-        adc_scaled(ADC_POS_I_SOLAR, vcc, ADC_GAIN_I_SOLAR) + solar_current_offset);
+    pwm_port_int.current = pwm_switch.get_duty_cycle() *
+        adc_calibrated(adc_scaled(ADC_POS_I_SOLAR, vcc, scale_i_solar) + solar_current_offset,
+        adc_cal_fixed[ADC_CAL_I_SOLAR]) * 0.001;
     pwm_terminal.current = -pwm_port_int.current;
     lv_terminal.current = pwm_port_int.current - load_terminal.current;
 
@@ -216,10 +621,20 @@ void update_measurements()
     pwm_terminal.power = pwm_terminal.voltage * pwm_terminal.current;
 #endif
 #if FEATURE_DCDC_CONVERTER
-    dcdc_lv_port.current =
-        adc_scaled(ADC_POS_I_DCDC, vcc, ADC_GAIN_I_DCDC) + solar_current_offset;
+    int32_t i_dcdc = adc_calibrated(adc_scaled(ADC_POS_I_DCDC, vcc, scale_i_dcdc) +
+        solar_current_offset, adc_cal_fixed[ADC_CAL_I_SOLAR]);
+    dcdc_lv_port.current = i_dcdc * 0.001;
     lv_terminal.current = dcdc_lv_port.current - load_terminal.current;
-    hv_terminal.current = -dcdc_lv_port.current * lv_terminal.voltage / hv_terminal.voltage;
+    // The HV side current is calculated with the voltage ratio of the converter in the same
+    // fixed-point format as the scale factors. The HV side voltage can't be lower than the LV
+    // side voltage during operation, so the ratio is limited to 2 (no overflow for 65 A).
+    if (v_solar > v_bat / 2) {
+        int32_t ratio = ((v_bat << ADC_SCALE_SHIFT) + v_solar / 2) / v_solar;
+        hv_terminal.current = ((-i_dcdc * ratio) >> ADC_SCALE_SHIFT) * 0.001;
+    }
+    else {
+        hv_terminal.current = 0;
+    }
 
     dcdc_lv_port.power  = dcdc_lv_port.voltage * dcdc_lv_port.current;
     hv_terminal.power   = hv_terminal.voltage * hv_terminal.current;
@@ -229,7 +644,7 @@ void update_measurements()
 
 #ifdef PIN_ADC_TEMP_BAT
     // battery temperature calculation
-    float bat_temp = ntc_temp(ADC_POS_TEMP_BAT, vcc);
+    float bat_temp = ntc_temp(ADC_POS_TEMP_BAT);
     
     if (bat_temp > -50) {
         // external sensor connected: take measured value
@@ -245,7 +660,7 @@ void update_measurements()
 
 #ifdef PIN_ADC_TEMP_FETS
     // MOSFET temperature calculation
-    dcdc.temp_mosfets = ntc_temp(ADC_POS_TEMP_FETS, vcc);
+    dcdc.temp_mosfets = ntc_temp(ADC_POS_TEMP_FETS);
 #endif
 
     // internal MCU temperature
@@ -263,6 +678,16 @@ void update_measurements()
     // else: keep previous setting
 }
 
+#if FEATURE_DCDC_CONVERTER
+int32_t adc_dcdc_current_fast()
+{
+    // same calculation as in update_measurements(), but based on the fast filtered view
+    int32_t voltage = (adc_value_fast(ADC_POS_I_DCDC) * adc_vcc) >> 12;
+    return adc_calibrated(((voltage * scale_i_dcdc) >> ADC_SCALE_SHIFT) + solar_current_offset,
+        adc_cal_fixed[ADC_CAL_I_SOLAR]);
+}
+#endif
+
 void high_voltage_alert()
 {
     // disable any sort of input
@@ -295,30 +720,89 @@ void low_voltage_alert()
 
 void adc_upper_alert_inhibit(int adc_pos, int timeout_ms)
 {
+    if (adc_pos == ADC_POS_V_BAT) {
+        // analog watchdog: ignore events during timeout, afterwards the original delay of
+        // ADC_ALERT_SAMPLES consecutive samples applies again
+        adc_awd_upper.inhibit_until_us = adc_awd_now() + timeout_ms * 1000;
+        adc_awd_upper.inhibited = true;
+        adc_awd_upper.count = 0;
+        return;
+    }
+
     // set negative value so that we get a final debouncing of this timeout + the original
-    // delay in the alert function (currently only waiting for 2 samples = 2 ms)
-    adc_alerts_upper[adc_pos].debounce_ms = -timeout_ms;
+    // delay in the alert function (ADC_ALERT_SAMPLES)
+    adc_alerts_upper[adc_pos].debounce = -timeout_ms * ADC_SAMPLES_PER_MS;
+}
+
+/**
+ * ADC reading (left-aligned) for a voltage or current, inverse of adc_scaled()
+ * @param value uncalibrated value in milli-units (mV or mA)
+ * @param vcc reference voltage in millivolts
+ * @param scale fixed-point scale factor calculated with adc_scale_factor()
+ */
+static uint16_t adc_reading_limit(int32_t value, int32_t vcc, const int32_t scale)
+{
+    // only called for configuration changes, so 64-bit division for max. precision is fine
+    int32_t reading = ((int64_t)value << (ADC_SCALE_SHIFT + 12)) / ((int64_t)scale * vcc);
+    if (reading > 0xFFF) {
+        reading = 0xFFF;
+    }
+    else if (reading < 0) {
+        reading = 0;
+    }
+    return reading << 4;
 }
 
 void adc_set_lv_alerts(float upper, float lower)
 {
     int vcc = VREFINT_VALUE * VREFINT_CAL /
         adc_value(ADC_POS_VREF_MCU);
-    float scale =  ((4096* 1000) / (ADC_GAIN_V_BAT)) / vcc;    
+
+    // limits are compared with raw readings, so the calibration has to be reverted
+    const AdcCalibrationFixed &cal = adc_cal_fixed[ADC_CAL_V_BAT];
 
     // LV side (battery) overvoltage alert
     adc_alerts_upper[ADC_POS_V_BAT].limit =
-        (uint16_t)(upper * scale) << 4;
+        adc_reading_limit(adc_uncalibrated(upper * 1000, cal), vcc, scale_v_bat);
     adc_alerts_upper[ADC_POS_V_BAT].callback = high_voltage_alert;
 
     // LV side (battery) undervoltage alert
     adc_alerts_lower[ADC_POS_V_BAT].limit =
-        (uint16_t)(lower * scale) << 4;
+        adc_reading_limit(adc_uncalibrated(lower * 1000, cal), vcc, scale_v_bat);
     adc_alerts_lower[ADC_POS_V_BAT].callback = low_voltage_alert;
+
+#ifndef UNIT_TEST
+    // analog watchdog thresholds (compared with the raw 12-bit value before alignment), written
+    // to the TR register in the DMA interrupt (see adc_awd_write_thresholds)
+    uint32_t tr = ((adc_alerts_upper[ADC_POS_V_BAT].limit >> 4) << ADC_TR_HT_Pos) |
+        ((adc_alerts_lower[ADC_POS_V_BAT].limit >> 4) << ADC_TR_LT_Pos);
+    if (tr != adc_awd_tr) {
+        adc_awd_tr = tr;
+        adc_awd_tr_pending = true;
+    }
+#endif
 }
 
 #ifndef UNIT_TEST
 
+/** Hardware channel number of a position in the conversion sequence
+ *
+ * @param chsel Channel selection register value (sequence is scanned in forward direction)
+ * @param pos Position in the conversion sequence (ADC_POS_...)
+ */
+static constexpr uint32_t adc_channel_number(uint32_t chsel, int pos)
+{
+    for (uint32_t ch = 0; ch < 32; ch++) {
+        if (chsel & (1UL << ch)) {
+            if (pos == 0) {
+                return ch;
+            }
+            pos--;
+        }
+    }
+    return 0;
+}
+
 void dma_setup()
 {
     //__HAL_RCC_DMA1_CLK_ENABLE();
@@ -333,10 +817,10 @@ void dma_setup()
     DMA1_Channel1->CPAR = (uint32_t)(&(ADC1->DR));
 
     /* Configure the memory address */
-    DMA1_Channel1->CMAR = (uint32_t)(&(adc_readings[0]));
+    DMA1_Channel1->CMAR = (uint32_t)(&(adc_dma_buffer[0]));
 
     /* Configure the number of DMA tranfer to be performed on DMA channel 1 */
-    DMA1_Channel1->CNDTR = NUM_ADC_CH;
+    DMA1_Channel1->CNDTR = 2 * ADC_DMA_SEQUENCES * NUM_ADC_CH;
 
     /* Configure increment, size, interrupts and circular mode */
     DMA1_Channel1->CCR =
@@ -344,6 +828,7 @@ void dma_setup()
         DMA_CCR_MSIZE_0 |       /* memory size 16-bit */
         DMA_CCR_PSIZE_0 |       /* peripheral size 16-bit */
         DMA_CCR_TEIE |          /* transfer error interrupt enable */
+        DMA_CCR_HTIE |          /* half transfer interrupt enable */
         DMA_CCR_TCIE |          /* transfer complete interrupt enable */
         DMA_CCR_CIRC;           /* circular mode enable */
                                 /* DIR = 0: read from peripheral */
@@ -355,19 +840,102 @@ void dma_setup()
     NVIC_SetPriority(DMA1_Channel1_IRQn, 2);
     NVIC_EnableIRQ(DMA1_Channel1_IRQn);
 
-    // Trigger ADC conversions
+    // Enable ADC conversions (started by hardware trigger from ADC timer)
     ADC1->CR |= ADC_CR_ADSTART;
 }
 
-extern "C" void DMA1_Channel1_IRQHandler(void)
+/** Latest reading of a channel transferred into the DMA buffer
+ *
+ * @param pos Position in the conversion sequence (ADC_POS_...)
+ */
+static inline uint16_t adc_dma_latest_reading(uint32_t pos)
 {
-    if ((DMA1->ISR & DMA_ISR_TCIF1) != 0) // Test if transfer completed on DMA channel 1
-    {
-        for (unsigned int i = 0; i < NUM_ADC_CH; i++) {
-            adc_update_value(i);
-        }
+    const uint32_t len = 2 * ADC_DMA_SEQUENCES * NUM_ADC_CH;
+
+    // number of readings already written in the current cycle of the circular buffer
+    uint32_t written = len - DMA1_Channel1->CNDTR;
+
+    // last sequence which contains a reading for this channel (may be in previous cycle)
+    uint32_t seq = (written + len - pos - 1) / NUM_ADC_CH;
+
+    return adc_dma_buffer[(seq * NUM_ADC_CH + pos) % len];
+}
+
+/** Writes new analog watchdog thresholds to the ADC1->TR register
+ *
+ * The register must only be written while ADSTART = 0 (see reference manual), so the ADC is
+ * stopped and restarted afterwards. Called from the DMA interrupt directly after a block of
+ * sequences was finished, so at most the sequence currently in progress is lost.
+ */
+static void adc_awd_write_thresholds()
+{
+    // ADSTP aborts an ongoing conversion within a few ADC clock cycles, so the wait is short
+    // and the higher priority watchdog interrupt is not blocked
+    ADC1->CR |= ADC_CR_ADSTP;
+    while (ADC1->CR & ADC_CR_ADSTART) {}
+    ADC1->TR = adc_awd_tr;
+    adc_awd_tr_pending = false;
+
+    // The ADC starts with the first channel after the restart, so the DMA is re-aligned with
+    // the beginning of the buffer to keep the channel positions. Readings of an aborted
+    // sequence are discarded and the PWM phase is resynchronized with the next DMA interrupt.
+    // CNDTR must not be read by the watchdog interrupt while the DMA channel is disabled.
+    core_util_critical_section_enter();
+    DMA1_Channel1->CCR &= ~DMA_CCR_EN;
+    DMA1_Channel1->CNDTR = 2 * ADC_DMA_SEQUENCES * NUM_ADC_CH;
+    DMA1->IFCR = DMA_IFCR_CGIF1;
+    DMA1_Channel1->CCR |= DMA_CCR_EN;
+    core_util_critical_section_exit();
+
+    ADC1->CR |= ADC_CR_ADSTART;
+}
+
+extern "C" void ADC1_COMP_IRQHandler(void)
+{
+    if (ADC1->ISR & ADC_ISR_AWD) {
+        ADC1->ISR = ADC_ISR_AWD;    // clear flag by writing 1
+
+        // The data register may already contain the reading of a different channel if this
+        // interrupt was delayed, but the V_BAT reading was transferred by the DMA at the end
+        // of its conversion, i.e. before the interrupt was triggered.
+        adc_watchdog_event(adc_dma_latest_reading(ADC_POS_V_BAT), adc_awd_now());
     }
+
+#ifdef PIN_I_LOAD_COMP
+    // interrupt vector shared with comparator
+    short_circuit_comp_isr();
+#endif
+}
+
+extern "C" void DMA1_Channel1_IRQHandler(void)
+{
+    uint32_t isr = DMA1->ISR;
     DMA1->IFCR |= 0x0FFFFFFF;       // clear all interrupt registers
+
+#if FEATURE_PWM_SWITCH
+    // Resynchronize the phase counter with the PWM timer, so that a missed conversion sequence
+    // does not permanently shift the sampling phase. The last sequence of the received blocks
+    // was triggered in the current ADC period of the PWM timer (see adc_update_block).
+    int num_sequences = ADC_DMA_SEQUENCES *
+        (((isr & DMA_ISR_HTIF1) != 0) + ((isr & DMA_ISR_TCIF1) != 0));
+    adc_pwm_phase = (pwm_switch.phase(ADC_SEQ_PER_PWM_PERIOD) + ADC_SEQ_PER_PWM_PERIOD -
+        num_sequences % ADC_SEQ_PER_PWM_PERIOD) % ADC_SEQ_PER_PWM_PERIOD;
+#endif
+
+    if ((isr & DMA_ISR_HTIF1) != 0) {
+        // first half of buffer filled, DMA continues with second half
+        adc_update_block(&adc_dma_buffer[0], ADC_DMA_SEQUENCES);
+    }
+    if ((isr & DMA_ISR_TCIF1) != 0) {
+        // second half of buffer filled, DMA continues with first half
+        adc_update_block(&adc_dma_buffer[ADC_DMA_SEQUENCES * NUM_ADC_CH], ADC_DMA_SEQUENCES);
+    }
+
+    if (adc_awd_tr_pending) {
+        adc_awd_write_thresholds();
+    }
+
+    system_control_fast();
 }
 
 void adc_setup()
@@ -446,6 +1014,21 @@ void adc_setup()
     // Select ADC channels based on setup in config.h
     ADC1->CHSELR = ADC_CHSEL;
 
+    // Analog watchdog on single channel for battery voltage (thresholds are set later in
+    // adc_set_lv_alerts, the reset values of the TR register disable the watchdog window)
+    ADC1->CFGR1 = (ADC1->CFGR1 & ~ADC_CFGR1_AWDCH) | ADC_CFGR1_AWDEN | ADC_CFGR1_AWDSGL |
+        (adc_channel_number(ADC_CHSEL, ADC_POS_V_BAT) << ADC_CFGR1_AWDCH_Pos);
+    ADC1->IER |= ADC_IER_AWDIE;
+
+    // 1 = second-highest priority of STM32L0/F0 (same as load short circuit comparator)
+    NVIC_SetPriority(ADC1_COMP_IRQn, 1);
+    NVIC_EnableIRQ(ADC1_COMP_IRQn);
+
+    // Start conversion sequences by rising edge of ADC timer TRGO (see adc_timer_start) instead
+    // of software trigger to get deterministic sample timing without an interrupt per sequence
+    ADC1->CFGR1 = (ADC1->CFGR1 & ~(ADC_CFGR1_EXTSEL | ADC_CFGR1_EXTEN)) |
+        ADC_EXTSEL_TIMER_TRGO | ADC_CFGR1_EXTEN_0;
+
     // Enable internal voltage reference and temperature sensor
     // ToDo check sample rate
     ADC->CCR |= ADC_CCR_TSEN | ADC_CCR_VREFEN;
@@ -455,83 +1038,94 @@ void adc_setup()
 
 #if defined(STM32F0)
 
-void adc_timer_start(int freq_Hz)   // max. 10 kHz
+void adc_timer_start(int freq_Hz)   // see ADC_SAMPLE_FREQUENCY for max. value
 {
     // Enable TIM15 clock
     RCC->APB2ENR |= RCC_APB2ENR_TIM15EN;
 
-    // Set timer clock to 10 kHz
-    TIM15->PSC = SystemCoreClock / 10000 - 1;
-
-    // Interrupt on timer update
-    TIM15->DIER |= TIM_DIER_UIE;
+    // Set timer clock to 1 MHz
+    TIM15->PSC = SystemCoreClock / 1000000 - 1;
 
-    // Auto Reload Register sets interrupt frequency
-    TIM15->ARR = 10000 / freq_Hz - 1;
+    // Master mode selection: update event is used as trigger output (TRGO) for the ADC
+    TIM15->CR2 = (TIM15->CR2 & ~TIM_CR2_MMS) | TIM_CR2_MMS_1;
 
-    // 2 = second-lowest priority of STM32L0/F0
-    NVIC_SetPriority(TIM15_IRQn, 2);
-    NVIC_EnableIRQ(TIM15_IRQn);
+    // Auto Reload Register sets trigger frequency
+    TIM15->ARR = 1000000 / freq_Hz - 1;
 
     // Control Register 1
     // TIM_CR1_CEN =  1: Counter enable
     TIM15->CR1 |= TIM_CR1_CEN;
 }
 
-extern "C" void TIM15_IRQHandler(void)
-{
-    TIM15->SR &= ~(1 << 0);
-    ADC1->CR |= ADC_CR_ADSTART;
-}
-
 #elif defined(STM32L0)
 
-void adc_timer_start(int freq_Hz)   // max. 10 kHz
+void adc_timer_start(int freq_Hz)   // see ADC_SAMPLE_FREQUENCY for max. value
 {
     // Enable TIM6 clock
     RCC->APB1ENR |= RCC_APB1ENR_TIM6EN;
 
-    // Set timer clock to 10 kHz
-    TIM6->PSC = SystemCoreClock / 10000 - 1;
+    // Set timer clock to 1 MHz
+    TIM6->PSC = SystemCoreClock / 1000000 - 1;
 
-    // Interrupt on timer update
-    TIM6->DIER |= TIM_DIER_UIE;
+    // Master mode selection: update event is used as trigger output (TRGO) for the ADC
+    TIM6->CR2 = (TIM6->CR2 & ~TIM_CR2_MMS) | TIM_CR2_MMS_1;
 
-    // Auto Reload Register sets interrupt frequency
-    TIM6->ARR = 10000 / freq_Hz - 1;
+    // Auto Reload Register sets trigger frequency
+    TIM6->ARR = 1000000 / freq_Hz - 1;
 
-    // 2 = second-lowest priority of STM32L0/F0
-    NVIC_SetPriority(TIM6_IRQn, 2);
-    NVIC_EnableIRQ(TIM6_IRQn);
+#if FEATURE_PWM_SWITCH
+    // Start PWM switch timer together with ADC timer to get a fixed phase between ADC samples
+    // and PWM period (see adc_update_block)
+    TIM3->CNT = 0;
+    TIM6->CNT = 0;
+    TIM3->CR1 |= TIM_CR1_CEN;
+#endif
 
     // Control Register 1
     // TIM_CR1_CEN =  1: Counter enable
     TIM6->CR1 |= TIM_CR1_CEN;
 }
-
-extern "C" void TIM6_IRQHandler(void)
-{
-    TIM6->SR &= ~(1 << 0);
-    ADC1->CR |= ADC_CR_ADSTART;
-}
 #else
 
 #include "../test/adc_dma_stub.h"
+#include <math.h>
 
 void prepare_adc_readings(AdcValues values)
 {
+    adc_readings = adc_dma_buffer;
     adc_readings[ADC_POS_VREF_MCU] = (uint16_t)(1.224 / 3.3 * 4096) << 4;
     adc_readings[ADC_POS_V_SOLAR] = (uint16_t)((values.solar_voltage / (ADC_GAIN_V_SOLAR)) / 3.3 * 4096) << 4;
     adc_readings[ADC_POS_V_BAT] = (uint16_t)((values.battery_voltage / (ADC_GAIN_V_BAT)) / 3.3 * 4096) << 4;
     adc_readings[ADC_POS_I_DCDC] = (uint16_t)((values.dcdc_current / (ADC_GAIN_I_DCDC)) / 3.3 * 4096) << 4;
     adc_readings[ADC_POS_I_LOAD] = (uint16_t)((values.load_current / (ADC_GAIN_I_LOAD)) / 3.3 * 4096) << 4;
+
+    // inverse of the NTC Beta model
+    float rts = NTC_NOMINAL_RESISTANCE *
+        exp(NTC_BETA_VALUE * (1.0 / (273.15 + values.bat_temperature) - 1.0 / 298.15));
+    adc_readings[ADC_POS_TEMP_BAT] = (uint16_t)(4096 * rts / (NTC_SERIES_RESISTOR + rts)) << 4;
+}
+
+/**
+ * Sets all filter states of a channel to a steady-state value
+ * @param channel valid ADC channel pos ADC_POS_..., see adc_h.c
+ * @param reading 12-bit ADC value left-aligned in uint16_t
+ */
+static void adc_filter_reset(uint32_t channel, uint16_t reading)
+{
+    const AdcFilterConf *conf = &adc_filter.conf[channel];
+    adc_median_hist[channel][0] = reading;
+    adc_median_hist[channel][1] = reading;
+    adc_decimation_sum[channel] = 0;
+    adc_decimation_count[channel] = 0;
+    adc_filtered_fast[channel] = (uint32_t)reading << conf->fast_shift;
+    adc_filtered[channel] = (uint32_t)reading << conf->slow_shift;
 }
 
 void prepare_adc_filtered()
 {
     // initialize also filtered values
     for (int i = 0; i < NUM_ADC_CH; i++) {
-        adc_filtered[i] = adc_readings[i] << ADC_FILTER_CONST;
+        adc_filter_reset(i, adc_readings[i]);
     }
 }
 
@@ -539,12 +1133,63 @@ void clear_adc_filtered()
 {
         // initialize also filtered values
     for (int i = 0; i < NUM_ADC_CH; i++) {
-        adc_filtered[i] = 0;
-    }  
+        adc_filter_reset(i, 0);
+    }
 }
 uint32_t get_adc_filtered(uint32_t channel)
 {
     return adc_value(channel);
 }
 
+uint32_t get_adc_filtered_fast(uint32_t channel)
+{
+    return adc_value_fast(channel);
+}
+
+void set_adc_filtered(uint32_t channel, uint32_t raw)
+{
+    adc_filter_reset(channel, raw << 4);
+}
+
+void set_adc_reading(uint32_t channel, uint16_t raw)
+{
+    adc_readings[channel] = raw << 4;
+}
+
+uint16_t get_adc_reading(uint32_t channel)
+{
+    return adc_readings[channel];
+}
+
+float adc_scaled_float(uint32_t channel, float gain)
+{
+    // previous floating point implementation, used as reference for the fixed-point version
+    int vcc = VREFINT_VALUE * VREFINT_CAL / adc_value(ADC_POS_VREF_MCU);
+    float v_adc = (float)((adc_value(channel) * vcc) / 4096);
+    return v_adc * (gain / 1000.0);
+}
+
+float adc_scaled_fixed(uint32_t channel)
+{
+    int vcc = VREFINT_VALUE * VREFINT_CAL / adc_value(ADC_POS_VREF_MCU);
+    int32_t scale;
+    switch (channel) {
+        case ADC_POS_V_BAT:
+            scale = scale_v_bat;
+            break;
+        case ADC_POS_V_SOLAR:
+            scale = scale_v_solar;
+            break;
+        case ADC_POS_I_LOAD:
+            scale = scale_i_load;
+            break;
+        case ADC_POS_I_DCDC:
+            scale = scale_i_dcdc;
+            break;
+        default:
+            return 0;
+    }
+    return adc_scaled(channel, vcc, scale) * 0.001;
+}
+
 #endif
@@ -28,25 +28,102 @@
 
 #define ADC_FILTER_CONST 5          // filter multiplier = 1/(2^ADC_FILTER_CONST)
 
+/** Optional pre-filter applied to each raw ADC sample before the low pass filters
+ */
+enum AdcPrefilter {
+    ADC_PREFILTER_NONE,             ///< Raw sample is used directly
+    ADC_PREFILTER_MEDIAN3           ///< Median of last 3 samples to reject single spikes
+};
+
+/** Filter configuration of one ADC channel
+ *
+ * Each channel provides two views of the same signal:
+ *
+ * - fast: EMA of the (pre-filtered) samples with filter constant 1/2^fast_shift, updated with
+ *   every sample, e.g. for protection functions
+ * - slow: boxcar (CIC of order 1) average of 2^decimation_shift samples followed by an EMA
+ *   with filter constant 1/2^slow_shift, updated only once per decimated sample
+ *
+ * Cost per sample in the DMA ISR is constant (no loops, no divisions): approx. 25 instructions
+ * for both EMAs, max. 10 additional for the median filter and 6 for the decimation counter.
+ */
+typedef struct {
+    uint8_t prefilter;              ///< Pre-filter type, see AdcPrefilter
+    uint8_t fast_shift;             ///< EMA filter constant for fast view (max. 16)
+    uint8_t decimation_shift;       ///< Number of samples averaged for slow view (2^n, max. 8)
+    uint8_t slow_shift;             ///< EMA filter constant for slow view (max. 16)
+} AdcFilterConf;
+
 /** Struct to definie upper and lower limit alerts for any ADC channel
  */
 typedef struct {
     void (*callback)() = NULL;      ///< Function to be called when limits are exceeded
     uint16_t limit = 0;             ///< ADC reading for lower limit
-    int debounce_ms = 0;            ///< Milliseconds delay for triggering alert
+    int debounce = 0;               ///< Debounce counter in ADC samples for triggering alert
 } AdcAlert;
 
+/** Measurement channels with sensor calibration
+ */
+enum AdcCalibrationChannel {
+    ADC_CAL_V_BAT,                  ///< Battery (low side) voltage
+    ADC_CAL_V_SOLAR,                ///< Solar (high side) voltage
+    ADC_CAL_I_LOAD,                 ///< Load output current
+    ADC_CAL_I_SOLAR,                ///< DC/DC or PWM switch current
+    ADC_CAL_NUM
+};
+
+/** Sensor calibration of one measurement channel
+ *
+ * The correction is applied to the value x calculated from the nominal gains in the PCB header:
+ *
+ * - y = gain * x + offset                                  for x <= knee
+ * - y = gain * knee + gain_high * (x - knee) + offset      for x > knee
+ *
+ * This allows a 2-point (gain and offset) or 3-point (piecewise linear) calibration. A knee
+ * of 0 disables the second segment.
+ */
+typedef struct {
+    float gain;                     ///< Gain correction factor (0.5 to 2.0, 1.0 = no correction)
+    float offset;                   ///< Offset correction in V or A
+    float knee;                     ///< Start of second segment in V or A (0 = disabled)
+    float gain_high;                ///< Gain correction factor above knee (0.5 to 2.0)
+} AdcCalibration;
+
+extern AdcCalibration adc_cal[ADC_CAL_NUM];
+
 /** Sets offset to actual measured value, i.e. sets zero current point.
  *
  * All input/output switches and consumers should be switched off before calling this function
  */
 void calibrate_current_sensors();
 
+/** Validates sensor calibration in adc_cal and converts it into the fixed-point format used in
+ * update_measurements()
+ *
+ * Invalid channels are reset to the nominal values (no correction).
+ *
+ * @returns true if calibration of all channels was valid
+ */
+bool adc_calibration_update();
+
 /** Updates structures with data read from ADC
  */
 void update_measurements();
 
+/** DC/DC current based on the fast filtered ADC view (for fast protection functions)
+ *
+ * Only integer operations are used, so that it can be called with the DMA interrupt rate.
+ *
+ * @returns current at DC/DC low-voltage side (mA)
+ */
+int32_t adc_dcdc_current_fast();
+
 /** Initializes registers and starts ADC timer
+ *
+ * The timer update event is routed to the ADC via TRGO, so every timer period starts one
+ * conversion sequence without any interrupt.
+ *
+ * @param freq_Hz ADC sampling frequency (max. value limited by conversion time, see pcb.h)
  */
 void adc_timer_start(int freq_Hz);
 
@@ -62,6 +139,13 @@ void dma_setup(void);
  */
 void adc_update_value(unsigned int pos);
 
+/** Process a block of ADC conversion sequences stored by DMA controller
+ *
+ * @param block Pointer to the first reading of the block
+ * @param num_sequences Number of sequences with NUM_ADC_CH readings each
+ */
+void adc_update_block(volatile uint16_t *block, int num_sequences);
+
 /** Set lv side (battery) voltage limits where an alert should be triggered
  *
  * @param upper Upper voltage limit
@@ -69,6 +153,17 @@ void adc_update_value(unsigned int pos);
  */
 void adc_set_lv_alerts(float upper, float lower);
 
+/** Analog watchdog event for the battery voltage channel
+ *
+ * Called for each ADC_POS_V_BAT conversion outside of the voltage window set with
+ * adc_set_lv_alerts(). Alerts are triggered after 2 consecutive samples outside of the window,
+ * as for the software alerts of the other channels.
+ *
+ * @param reading 12-bit ADC value left-aligned in uint16_t
+ * @param now_us Current timestamp in microseconds
+ */
+void adc_watchdog_event(uint16_t reading, uint32_t now_us);
+
 /** Add an inhibit delay to the alerts to disable it temporarily
  *
  * @param adc_pos The position of the ADC measurement channel
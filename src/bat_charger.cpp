@@ -23,16 +23,23 @@ extern DeviceStatus dev_stat;
 
 #include <math.h>       // for fabs function
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
 void battery_conf_init(BatConf *bat, BatType type, int num_cells, float nominal_capacity)
 {
     bat->nominal_capacity = nominal_capacity;
+    bat->type = type;
+    bat->num_cells = num_cells;
+    memset(bat->ocv_custom, 0, sizeof(bat->ocv_custom));
 
     // 1C should be safe for all batteries
     bat->charge_current_max = bat->nominal_capacity;
     bat->discharge_current_max = bat->nominal_capacity;
 
+    // unknown by default (only the sum with the internal resistance can be measured)
+    bat->wire_resistance = 0;
+
     bat->time_limit_recharge = 60;              // sec
     bat->topping_duration = 120*60;                // sec
 
@@ -59,9 +66,9 @@ void battery_conf_init(BatConf *bat, BatType type, int num_cells, float nominal_
 
             bat->voltage_absolute_min = num_cells * 1.6;
 
-            // Voltages during idle (no charging/discharging current)
-            bat->ocv_full = num_cells * ((type == BAT_TYPE_FLOODED) ? 2.10 : 2.15);
-            bat->ocv_empty = num_cells * 1.90;
+            // lead-acid batteries need long time to relax after a current step
+            bat->polarization_resistance = bat->internal_resistance;
+            bat->polarization_time_constant = 600;
 
             // https://batteryuniversity.com/learn/article/charging_the_lead_acid_battery
             bat->topping_current_cutoff = bat->nominal_capacity * 0.04;  // 3-5 % of C/1
@@ -96,8 +103,8 @@ void battery_conf_init(BatConf *bat, BatType type, int num_cells, float nominal_
             bat->internal_resistance = bat->voltage_load_disconnect * 0.05 / LOAD_CURRENT_MAX;
             bat->voltage_absolute_min = num_cells * 2.0;
 
-            bat->ocv_full = num_cells * 3.4;       // will give really nonlinear SOC calculation
-            bat->ocv_empty = num_cells * 3.0;      // because of flat OCV of LFP cells...
+            bat->polarization_resistance = bat->internal_resistance / 2;
+            bat->polarization_time_constant = 60;
 
             // C/10 cut-off at end of CV phase by default
             bat->topping_current_cutoff = bat->nominal_capacity / 10;
@@ -122,8 +129,8 @@ void battery_conf_init(BatConf *bat, BatType type, int num_cells, float nominal_
 
             bat->voltage_absolute_min = num_cells * 2.5;
 
-            bat->ocv_full = num_cells * 4.0;
-            bat->ocv_empty = num_cells * 3.0;
+            bat->polarization_resistance = bat->internal_resistance / 2;
+            bat->polarization_time_constant = 60;
 
             // C/10 cut-off at end of CV phase by default
             bat->topping_current_cutoff = bat->nominal_capacity / 10;
@@ -139,6 +146,43 @@ void battery_conf_init(BatConf *bat, BatType type, int num_cells, float nominal_
     }
 }
 
+const OcvCurve *battery_ocv_curve(BatConf *bat)
+{
+    static OcvCurve custom_curve;
+    static OcvPoint custom_points[OCV_CUSTOM_POINTS];
+
+    const OcvCurve *curve;
+    switch (bat->type) {
+        case BAT_TYPE_FLOODED:
+            curve = &ocv_curve_flooded;
+            break;
+        case BAT_TYPE_GEL:
+        case BAT_TYPE_AGM:
+            curve = &ocv_curve_vrla;
+            break;
+        case BAT_TYPE_LFP:
+            curve = &ocv_curve_lfp;
+            break;
+        case BAT_TYPE_NMC:
+            curve = &ocv_curve_nmc;
+            break;
+        case BAT_TYPE_NMC_HV:
+            curve = &ocv_curve_nmc_hv;
+            break;
+        default:
+            curve = NULL;
+            break;
+    }
+
+    // custom curve keeps the temperature coefficient of the chemistry
+    if (ocv_curve_custom(&custom_curve, custom_points, bat->ocv_custom,
+        (curve != NULL) ? curve->temp_coeff : 0))
+    {
+        return &custom_curve;
+    }
+    return curve;
+}
+
 // checks settings in bat_conf for plausibility
 bool battery_conf_check(BatConf *bat_conf)
 {
@@ -161,6 +205,12 @@ bool battery_conf_check(BatConf *bat_conf)
     );
     */
 
+    // custom OCV curve must be either unused (last point zero) or strictly increasing
+    OcvCurve ocv_curve;
+    OcvPoint ocv_points[OCV_CUSTOM_POINTS];
+    bool ocv_custom_valid = bat_conf->ocv_custom[OCV_CUSTOM_POINTS - 1] == 0 ||
+        ocv_curve_custom(&ocv_curve, ocv_points, bat_conf->ocv_custom, 0);
+
     return
        (bat_conf->voltage_load_reconnect > (bat_conf->voltage_load_disconnect + 0.4) &&
         bat_conf->voltage_recharge < (bat_conf->topping_voltage - 0.4) &&
@@ -175,7 +225,8 @@ bool battery_conf_check(BatConf *bat_conf)
         bat_conf->topping_current_cutoff > 0.01 &&
         (bat_conf->trickle_enabled == false ||
             (bat_conf->trickle_voltage < bat_conf->topping_voltage &&
-             bat_conf->trickle_voltage > bat_conf->voltage_load_disconnect))
+             bat_conf->trickle_voltage > bat_conf->voltage_load_disconnect)) &&
+        ocv_custom_valid
        );
 }
 
@@ -200,8 +251,25 @@ void battery_conf_overwrite(BatConf *source, BatConf *destination, Charger *char
     destination->discharge_temp_max             = source->discharge_temp_max;
     destination->discharge_temp_min             = source->discharge_temp_min;
     destination->temperature_compensation       = source->temperature_compensation;
-    destination->internal_resistance            = source->internal_resistance;
-    destination->wire_resistance                = source->wire_resistance;
+    // resistance estimation restarts from the new configuration
+    if (destination->internal_resistance != source->internal_resistance ||
+        destination->wire_resistance != source->wire_resistance) {
+        destination->internal_resistance        = source->internal_resistance;
+        destination->wire_resistance            = source->wire_resistance;
+        if (charger != NULL) {
+            charger->res_est.configured = false;
+        }
+    }
+    destination->polarization_resistance        = source->polarization_resistance;
+    destination->polarization_time_constant     = source->polarization_time_constant;
+
+    // SOC estimation has to be re-initialized with a new OCV curve
+    if (memcmp(destination->ocv_custom, source->ocv_custom, sizeof(source->ocv_custom)) != 0) {
+        memcpy(destination->ocv_custom, source->ocv_custom, sizeof(source->ocv_custom));
+        if (charger != NULL) {
+            charger->soc_ekf.configured = false;
+        }
+    }
 
     // reset Ah counter and SOH if battery nominal capacity was changed
     if (destination->nominal_capacity != source->nominal_capacity) {
@@ -210,6 +278,7 @@ void battery_conf_overwrite(BatConf *source, BatConf *destination, Charger *char
             charger->discharged_Ah = 0;
             charger->usable_capacity = 0;
             charger->soh = 0;
+            charger->soc_ekf.configured = false;    // re-initialized with new capacity
         }
     }
 
@@ -218,6 +287,17 @@ void battery_conf_overwrite(BatConf *source, BatConf *destination, Charger *char
     // - restart DC/DC
 }
 
+/** Sets the droop resistances of a battery port to compensate the voltage drop at the
+ * internal and wire resistances
+ */
+static void battery_set_droop_res(PowerPort *port, float internal_resistance,
+    float wire_resistance, unsigned int n)
+{
+    // negative sign for compensation of actual resistance
+    port->neg_droop_res = -(internal_resistance + -wire_resistance) * n;
+    port->pos_droop_res = -wire_resistance * n;
+}
+
 void Charger::detect_num_batteries(BatConf *bat)
 {
     if (port->voltage > bat->voltage_absolute_min * 2 &&
@@ -232,31 +312,47 @@ void Charger::detect_num_batteries(BatConf *bat)
 
 void Charger::update_soc(BatConf *bat_conf)
 {
-    static int soc_filtered = 0;       // SOC / 100 for better filtering
+    if (!soc_ekf.configured) {
+        soc_ekf_init(&soc_ekf, battery_ocv_curve(bat_conf), bat_conf->num_cells, num_batteries,
+            bat_conf->nominal_capacity, bat_conf->internal_resistance,
+            bat_conf->polarization_resistance, bat_conf->polarization_time_constant);
+    }
 
-    if (fabs(port->current) < 0.2) {
-        int soc_new = (int)((port->voltage - bat_conf->ocv_empty) /
-                   (bat_conf->ocv_full - bat_conf->ocv_empty) * 10000.0);
+    soc_ekf_update(&soc_ekf, port->voltage * 1000, port->current * 1000, bat_temperature);
+    soc = (soc_ekf.soc + SOC_EKF_FULL / 200) / (SOC_EKF_FULL / 100);
+    soc_uncertainty = soc_ekf_uncertainty(&soc_ekf) * 100.0 / SOC_EKF_FULL;
 
-        if (soc_new > 500 && soc_filtered == 0) {
-            // bypass filter during initialization
-            soc_filtered = soc_new;
-        }
-        else {
-            // filtering to adjust SOC very slowly
-            soc_filtered += (soc_new - soc_filtered) / 100;
-        }
+    discharged_Ah += -port->current / 3600.0;   // charged current is positive: change sign
+}
 
-        if (soc_filtered > 10000) {
-            soc_filtered = 10000;
-        }
-        else if (soc_filtered < 0) {
-            soc_filtered = 0;
-        }
-        soc = soc_filtered / 100;
+void Charger::update_resistance(BatConf *bat_conf)
+{
+    unsigned int n = (num_batteries == 2 ? 2 : 1);
+
+    if (!res_est.configured) {
+        internal_resistance = bat_conf->internal_resistance;
+        wire_resistance = bat_conf->wire_resistance;
+        resistance_est_init(&res_est, (internal_resistance + wire_resistance) * n);
     }
 
-    discharged_Ah += -port->current / 3600.0;   // charged current is positive: change sign
+    // current changes in CV mode are caused by the battery, not by the series resistance
+    if (state == CHG_STATE_TOPPING || state == CHG_STATE_TRICKLE ||
+        state == CHG_STATE_EQUALIZATION) {
+        resistance_est_pause(&res_est);
+        return;
+    }
+
+    if (resistance_est_update(&res_est, port->voltage, port->current) &&
+        resistance_est_valid(&res_est))
+    {
+        // The terminal voltage only shows the sum of both resistances. The wire resistance does
+        // not change over time, so the configured value is kept (limited to the total, as it
+        // raises the charging voltage) and changes are assigned to the internal resistance.
+        float total = res_est.resistance / n;
+        wire_resistance = (bat_conf->wire_resistance < total) ? bat_conf->wire_resistance : total;
+        internal_resistance = total - wire_resistance;
+        battery_set_droop_res(port, internal_resistance, wire_resistance, n);
+    }
 }
 
 void Charger::enter_state(int next_state)
@@ -394,6 +490,7 @@ void Charger::charge_control(BatConf *bat_conf)
                 full = true;
                 num_full_charges++;
                 discharged_Ah = 0;         // reset coulomb counter
+                soc_ekf_set_full(&soc_ekf);
                 first_full_charge_reached = true;
 
                 if (bat_conf->equalization_enabled && (
@@ -476,13 +573,9 @@ void battery_init_dc_bus(PowerPort *port, BatConf *bat, unsigned int num_batteri
     port->src_voltage_stop = bat->voltage_load_disconnect * n;
     port->neg_current_limit = -bat->discharge_current_max;
 
-    // negative sign for compensation of actual resistance
-    port->neg_droop_res = -(bat->internal_resistance + -bat->wire_resistance) * n;
-
     port->sink_voltage_max = bat->topping_voltage * n;
     port->sink_voltage_min = bat->voltage_absolute_min * n;
     port->pos_current_limit = bat->charge_current_max;
 
-    // negative sign for compensation of actual resistance
-    port->pos_droop_res = -bat->wire_resistance * n;
+    battery_set_droop_res(port, bat->internal_resistance, bat->wire_resistance, n);
 }
@@ -27,6 +27,8 @@
 #include <stddef.h>
 
 #include "power_port.h"
+#include "soc_ekf.h"
+#include "resistance_est.h"
 
 /** Battery cell types
  */
@@ -202,9 +204,30 @@ typedef struct
      */
     float wire_resistance;
 
-    // used to calculate state of charge information
-    float ocv_full;
-    float ocv_empty;
+    /** Cell chemistry (selects the OCV curve for SOC estimation)
+     */
+    BatType type;
+
+    /** Number of cells in series
+     */
+    int num_cells;
+
+    /** Custom OCV curve of one cell at SOC 0 %, 10 %, ..., 100 % (mV)
+     *
+     * Replaces the curve of the cell chemistry if the voltages are strictly increasing (all
+     * zero by default).
+     */
+    uint16_t ocv_custom[OCV_CUSTOM_POINTS];
+
+    /** Resistance of the RC element of the battery model for SOC estimation (Ohm)
+     *
+     * Models the polarization voltage which builds up slowly after a current step.
+     */
+    float polarization_resistance;
+
+    /** Time constant of the polarization voltage (s)
+     */
+    float polarization_time_constant;
 
     /** Maximum allowed charging temperature of the battery (°C)
      */
@@ -257,6 +280,11 @@ public:
     uint16_t num_deep_discharges;   ///< Number of deep-discharge cycles
 
     uint16_t soc = 100;             ///< State of Charge (%)
+    float soc_uncertainty = 100;    ///< Standard deviation of the SOC estimate (%)
+    SocEkf soc_ekf;                 ///< Kalman filter for SOC estimation
+    ResistanceEst res_est;          ///< Online estimation of the series resistance
+    float internal_resistance = 0;  ///< Estimated internal resistance of one battery (Ohm)
+    float wire_resistance = 0;      ///< Estimated wire resistance of one battery (Ohm)
     uint16_t soh = 100;             ///< State of Health (%)
 
     int time_state_changed;         ///< Timestamp of last state change
@@ -282,12 +310,19 @@ public:
      */
     void charge_control(BatConf *bat_conf);
 
-    /** SOC estimation
+    /** SOC estimation (Kalman filter based on coulomb counting and OCV)
      *
      * Must be called exactly once per second, otherwise SOC calculation gets wrong.
      */
     void update_soc(BatConf *bat_conf);
 
+    /** Online estimation of internal and wire resistance from current steps
+     *
+     * Should be called in every control cycle. The estimates replace the configured resistances
+     * for the droop compensation of the port.
+     */
+    void update_resistance(BatConf *bat_conf);
+
 private:
     void enter_state(int next_state);
 };
@@ -350,6 +385,16 @@ enum ChargerState {
  */
 void battery_conf_init(BatConf *bat, BatType type, int num_cells, float nominal_capacity);
 
+/** OCV curve of one cell used for SOC estimation
+ *
+ * A valid custom curve is stored in a static buffer, so only one configuration can use a
+ * custom curve at the same time.
+ *
+ * @returns the custom curve if valid, otherwise the curve of the cell chemistry or NULL if
+ *          the chemistry is unknown
+ */
+const OcvCurve *battery_ocv_curve(BatConf *bat);
+
 /** Checks battery user settings for plausibility
  */
 bool battery_conf_check(BatConf *bat);
@@ -0,0 +1,74 @@
+/* LibreSolar charge controller firmware
+ * Copyright (c) 2016-2019 Martin Jäger (www.libre.solar)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "control_timing.h"
+
+#include "pcb.h"
+
+#ifndef UNIT_TEST
+#include "mbed.h"
+#include "hal/us_ticker_api.h"
+#else
+#include <chrono>
+#endif
+
+ControlTierTiming control_timing[CONTROL_TIER_NUM] = {
+    { 0, 0, 0, 1000000 * ADC_DMA_SEQUENCES / ADC_SAMPLE_FREQUENCY },
+    { 0, 0, 0, 1000000 / CONTROL_FREQUENCY },
+    { 0, 0, 0, 1000000 }
+};
+
+uint16_t control_load_max = 0;
+
+uint32_t control_timing_now_us()
+{
+#ifndef UNIT_TEST
+    return us_ticker_read();
+#else
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void control_timing_update(ControlTier tier, uint32_t start_us)
+{
+    ControlTierTiming *t = &control_timing[tier];
+
+    t->time_us = control_timing_now_us() - start_us;    // also valid for timer overflow
+    if (t->time_us > t->wcet_us) {
+        t->wcet_us = t->time_us;
+    }
+    t->num_calls++;
+
+    if (tier == CONTROL_TIER_SLOW) {
+        // sum of WCET / period of all tiers in 0.1 %, i.e. upper bound of the actual load
+        uint32_t load = 0;
+        for (int i = 0; i < CONTROL_TIER_NUM; i++) {
+            load += control_timing[i].wcet_us * 1000 / control_timing[i].period_us;
+        }
+        control_load_max = (load + 5) / 10;
+    }
+}
+
+void control_timing_reset()
+{
+    for (int i = 0; i < CONTROL_TIER_NUM; i++) {
+        control_timing[i].num_calls = 0;
+        control_timing[i].time_us = 0;
+        control_timing[i].wcet_us = 0;
+    }
+    control_load_max = 0;
+}
@@ -0,0 +1,78 @@
+/* LibreSolar charge controller firmware
+ * Copyright (c) 2016-2019 Martin Jäger (www.libre.solar)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CONTROL_TIMING_H
+#define CONTROL_TIMING_H
+
+/** @file
+ *
+ * @brief Execution time measurement of the multi-rate control tiers
+ *
+ * The control functions are split into three tiers with different rates:
+ *
+ * - Fast: Current limiting and protection, called from the ADC DMA ISR after each block of
+ *   ADC_DMA_SEQUENCES conversion sequences (1 kHz by default)
+ * - Medium: Measurement update, DC/DC (incl. MPPT) and load control, called by the control
+ *   timer with CONTROL_FREQUENCY, incl. energy balance and SOC calculation once per second
+ * - Slow: Configuration updates and charger state machine, called from the main loop once
+ *   per second after it was triggered by the medium tier
+ *
+ * The worst-case execution time (WCET) of each tier is recorded, so that the CPU load can be
+ * checked before increasing the control frequencies.
+ */
+
+#include <stdint.h>
+
+/** Control tiers
+ */
+enum ControlTier {
+    CONTROL_TIER_FAST = 0,      ///< Protection (ADC DMA ISR)
+    CONTROL_TIER_MEDIUM,        ///< DC/DC control and MPPT (control timer ISR)
+    CONTROL_TIER_SLOW,          ///< Charger state machine (main loop, 1 Hz)
+    CONTROL_TIER_NUM
+};
+
+/** Execution time statistics of one control tier
+ */
+typedef struct {
+    uint32_t num_calls;         ///< Number of calls since last reset
+    uint32_t time_us;           ///< Execution time of last call (us)
+    uint32_t wcet_us;           ///< Worst-case (max.) execution time since last reset (us)
+    uint32_t period_us;         ///< Period between two calls (us)
+} ControlTierTiming;
+
+extern ControlTierTiming control_timing[CONTROL_TIER_NUM];
+
+/** Worst-case CPU load of all control tiers (%), updated by the slow tier
+ */
+extern uint16_t control_load_max;
+
+/** Current time for execution time measurement (us)
+ */
+uint32_t control_timing_now_us();
+
+/** Records the execution time of a control tier
+ *
+ * @param tier Control tier
+ * @param start_us Time at the beginning of the call (from control_timing_now_us)
+ */
+void control_timing_update(ControlTier tier, uint32_t start_us);
+
+/** Resets the worst-case execution times and call counters (e.g. via ThingSet)
+ */
+void control_timing_reset();
+
+#endif /* CONTROL_TIMING_H */
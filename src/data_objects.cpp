@@ -26,6 +26,11 @@
 #include "thingset.h"
 #include "hardware.h"
 #include "eeprom.h"
+#include "adc_capture.h"
+#include "adc_dma.h"
+#include "control_timing.h"
+#include "efficiency_map.h"
+#include "data_objects.h"
 #include <stdio.h>
 
 const char* const manufacturer = "Libre Solar";
@@ -89,6 +94,19 @@ const data_object_t data_objects[] = {
     {0x5C, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,   TS_T_INT32,   0, (void*) &(bat_conf_user.equalization_trigger_days),  "EqInterval_d"},
     {0x5D, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,   TS_T_INT32,   0, (void*) &(bat_conf_user.equalization_trigger_deep_cycles),  "EqDeepDisTrigger"},
 
+    // custom OCV curve of one cell at SOC 0 %, 10 %, ..., 100 % (all zero: chemistry default)
+    {0x120, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,  TS_T_UINT16,  0, (void*) &(bat_conf_user.ocv_custom[0]),             "BatOcv0_mV"},
+    {0x121, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,  TS_T_UINT16,  0, (void*) &(bat_conf_user.ocv_custom[1]),             "BatOcv10_mV"},
+    {0x122, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,  TS_T_UINT16,  0, (void*) &(bat_conf_user.ocv_custom[2]),             "BatOcv20_mV"},
+    {0x123, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,  TS_T_UINT16,  0, (void*) &(bat_conf_user.ocv_custom[3]),             "BatOcv30_mV"},
+    {0x124, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,  TS_T_UINT16,  0, (void*) &(bat_conf_user.ocv_custom[4]),             "BatOcv40_mV"},
+    {0x125, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,  TS_T_UINT16,  0, (void*) &(bat_conf_user.ocv_custom[5]),             "BatOcv50_mV"},
+    {0x126, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,  TS_T_UINT16,  0, (void*) &(bat_conf_user.ocv_custom[6]),             "BatOcv60_mV"},
+    {0x127, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,  TS_T_UINT16,  0, (void*) &(bat_conf_user.ocv_custom[7]),             "BatOcv70_mV"},
+    {0x128, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,  TS_T_UINT16,  0, (void*) &(bat_conf_user.ocv_custom[8]),             "BatOcv80_mV"},
+    {0x129, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,  TS_T_UINT16,  0, (void*) &(bat_conf_user.ocv_custom[9]),             "BatOcv90_mV"},
+    {0x12A, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,  TS_T_UINT16,  0, (void*) &(bat_conf_user.ocv_custom[10]),            "BatOcv100_mV"},
+
     // load settings
     {0x40, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,   TS_T_BOOL,    0, (void*) &(load.enable),                              "LoadEnDefault"},
     {0x41, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,   TS_T_BOOL,    0, (void*) &(load.usb_enable),                          "UsbEnDefault"},
@@ -99,6 +117,38 @@ const data_object_t data_objects[] = {
     {0x46, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,   TS_T_INT32,   0, (void*) &(load.overcurrent_recovery_delay),          "LoadOCRecovery_s"},
     {0x47, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,   TS_T_INT32,   0, (void*) &(load.lvd_recovery_delay),                  "LoadUVRecovery_s"},
 
+#if FEATURE_DCDC_CONVERTER
+    // DC/DC settings
+    {0x48, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,   TS_T_UINT16,  0, (void*) &(dcdc.mppt_algorithm),                      "MpptAlgorithm"},
+    {0x49, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,   TS_T_INT32,   0, (void*) &(dcdc.mppt_step_min),                       "MpptStepMin"},
+    {0x4A, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,   TS_T_INT32,   0, (void*) &(dcdc.mppt_step_max),                       "MpptStepMax"},
+    {0x4B, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,   TS_T_FLOAT32, 2, (void*) &(dcdc.mppt_step_gain),                      "MpptStepGain"},
+    {0x4C, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,   TS_T_INT32,   0, (void*) &(dcdc.mppt_scan_interval),                  "MpptScanInterval_s"},
+    {0x4D, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,   TS_T_FLOAT32, 2, (void*) &(dcdc.mppt_scan_power_drop),                "MpptScanPowerDrop"},
+    {0x4E, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,   TS_T_INT32,   0, (void*) &(dcdc.mppt_scan_step),                      "MpptScanStep"},
+
+    // DC/DC output regulation (IDs 0x110 and above as 0x30-0x5F are used up)
+    {0x110, TS_CONF, TS_READ_ALL | TS_WRITE_MAKER, TS_T_FLOAT32, 2, (void*) &(dcdc.cv_kp),                               "DcdcVoltKp"},
+    {0x111, TS_CONF, TS_READ_ALL | TS_WRITE_MAKER, TS_T_FLOAT32, 2, (void*) &(dcdc.cv_ki),                               "DcdcVoltKi"},
+    {0x112, TS_CONF, TS_READ_ALL | TS_WRITE_MAKER, TS_T_FLOAT32, 2, (void*) &(dcdc.cc_kp),                               "DcdcCurrKp"},
+    {0x113, TS_CONF, TS_READ_ALL | TS_WRITE_MAKER, TS_T_FLOAT32, 2, (void*) &(dcdc.cc_ki),                               "DcdcCurrKi"},
+
+    // DC/DC light-load mode
+    {0x114, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,  TS_T_FLOAT32, 1, (void*) &(dcdc.light_load_power),                    "DcdcLightLoad_W"},
+    {0x115, TS_CONF, TS_READ_ALL | TS_WRITE_MAKER, TS_T_INT32,  0, (void*) &(dcdc.light_load_divider_max),              "DcdcFreqDivMax"},
+    {0x116, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,  TS_T_FLOAT32, 2, (void*) &(dcdc.sync_current_min),                    "DcdcSyncCurrentMin_A"},
+
+    // DC/DC dead time tuning (0: off, 1: background, 2: commissioning)
+    {0x117, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,  TS_T_UINT16,  0, (void*) &(dcdc.deadtime_tuning),                     "DcdcDeadtimeTuning"},
+    {0x118, TS_CONF, TS_READ_ALL | TS_WRITE_MAKER, TS_T_UINT16, 0, (void*) &(dcdc.deadtime_table[0]),                   "DcdcDeadtime0_ns"},
+    {0x119, TS_CONF, TS_READ_ALL | TS_WRITE_MAKER, TS_T_UINT16, 0, (void*) &(dcdc.deadtime_table[1]),                   "DcdcDeadtime1_ns"},
+    {0x11A, TS_CONF, TS_READ_ALL | TS_WRITE_MAKER, TS_T_UINT16, 0, (void*) &(dcdc.deadtime_table[2]),                   "DcdcDeadtime2_ns"},
+    {0x11B, TS_CONF, TS_READ_ALL | TS_WRITE_MAKER, TS_T_UINT16, 0, (void*) &(dcdc.deadtime_table[3]),                   "DcdcDeadtime3_ns"},
+
+    // DC/DC start-up
+    {0x11C, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,  TS_T_FLOAT32, 1, (void*) &(dcdc.soft_start_time),                     "DcdcSoftStart_s"},
+#endif
+
     // other configuration items
     //{0x33, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,   TS_T_BOOL,    0, (void*) &(??),   "WarningIndicator"},  // can be set externally
     //{0x33, TS_CONF, TS_READ_ALL | TS_WRITE_ALL,   TS_T_BOOL,    0, (void*) &(??),   "ErrorIndicator"},
@@ -137,6 +187,9 @@ const data_object_t data_objects[] = {
     {0x78, TS_OUTPUT, TS_READ_ALL, TS_T_UINT16,  0, (void*) &(charger.state),                           "ChgState"},
 #if FEATURE_DCDC_CONVERTER
     {0x79, TS_OUTPUT, TS_READ_ALL, TS_T_UINT16,  0, (void*) &(dcdc.state),                              "DCDCState"},
+    {0x98, TS_OUTPUT, TS_READ_ALL, TS_T_INT32,   0, (void*) &(dcdc.freq_divider),                       "DcdcFreqDiv"},
+    {0x99, TS_OUTPUT, TS_READ_ALL, TS_T_UINT16,  0, (void*) &(dcdc.deadtime_converged),                 "DcdcDeadtimeConverged"},
+    {0x9A, TS_OUTPUT, TS_READ_ALL, TS_T_FLOAT32, 2, (void*) &(dcdc.efficiency),                         "DcdcEfficiency_pct"},
 #endif
     {0x7A, TS_OUTPUT, TS_READ_ALL, TS_T_FLOAT32, 2, (void*) &(solar_terminal.current),                  "Solar_A"},
     {0x7B, TS_OUTPUT, TS_READ_ALL, TS_T_FLOAT32, 2, (void*) &(bat_terminal.sink_voltage_max),           "BatTarget_V"},
@@ -146,6 +199,16 @@ const data_object_t data_objects[] = {
     {0x7F, TS_OUTPUT, TS_READ_ALL, TS_T_FLOAT32, 2, (void*) &(load_terminal.power),                     "Load_W"},
 
     {0x90, TS_OUTPUT, TS_READ_ALL, TS_T_UINT32,  0, (void*) &(dev_stat.error_flags),                    "ErrorFlags"},
+    {0x91, TS_OUTPUT, TS_READ_ALL, TS_T_UINT16,  0, (void*) &(adc_capture.state),                      "AdcCaptureState"},
+    {0x92, TS_OUTPUT, TS_READ_ALL, TS_T_UINT32,  0, (void*) &(adc_capture.cause),                      "AdcCaptureCause"},
+    {0x93, TS_OUTPUT, TS_READ_ALL, TS_T_UINT32,  0, (void*) &(adc_capture.timestamp),                  "AdcCaptureTime_s"},
+    {0x94, TS_OUTPUT, TS_READ_ALL, TS_T_UINT32,  0, (void*) &(control_timing[CONTROL_TIER_FAST].wcet_us),   "WcetFast_us"},
+    {0x95, TS_OUTPUT, TS_READ_ALL, TS_T_UINT32,  0, (void*) &(control_timing[CONTROL_TIER_MEDIUM].wcet_us), "WcetMedium_us"},
+    {0x96, TS_OUTPUT, TS_READ_ALL, TS_T_UINT32,  0, (void*) &(control_timing[CONTROL_TIER_SLOW].wcet_us),   "WcetSlow_us"},
+    {0x97, TS_OUTPUT, TS_READ_ALL, TS_T_UINT16,  0, (void*) &(control_load_max),                       "CtrlLoadMax_pct"},
+    {0x9B, TS_OUTPUT, TS_READ_ALL, TS_T_FLOAT32, 1, (void*) &(charger.soc_uncertainty),                 "SOCUncertainty_pct"},
+    {0x9C, TS_OUTPUT, TS_READ_ALL, TS_T_FLOAT32, 3, (void*) &(charger.internal_resistance),             "BatIntEst_Ohm"},
+    {0x9D, TS_OUTPUT, TS_READ_ALL, TS_T_FLOAT32, 3, (void*) &(charger.wire_resistance),                 "BatWireEst_Ohm"},
 
     // RECORDED DATA ///////////////////////////////////////////////////////
     // using IDs >= 0xA0
@@ -191,12 +254,39 @@ const data_object_t data_objects[] = {
     //{0xD4, TS_CAL, TS_READ_ALL | TS_WRITE_MAKER, TS_T_FLOAT32, 1, (void*) &(dcdc.offset_voltage_stop),  "SolarOffsetStop_V"}
 #endif
 
+    // sensor calibration, stored in separate EEPROM region with SaveCalibration
+    // using IDs >= 0x100
+    {0x100, TS_CAL, TS_READ_ALL | TS_WRITE_MAKER, TS_T_FLOAT32, 4, (void*) &(adc_cal[ADC_CAL_V_BAT].gain),          "CalBatVGain"},
+    {0x101, TS_CAL, TS_READ_ALL | TS_WRITE_MAKER, TS_T_FLOAT32, 3, (void*) &(adc_cal[ADC_CAL_V_BAT].offset),        "CalBatVOffset_V"},
+    {0x102, TS_CAL, TS_READ_ALL | TS_WRITE_MAKER, TS_T_FLOAT32, 2, (void*) &(adc_cal[ADC_CAL_V_BAT].knee),          "CalBatVKnee_V"},
+    {0x103, TS_CAL, TS_READ_ALL | TS_WRITE_MAKER, TS_T_FLOAT32, 4, (void*) &(adc_cal[ADC_CAL_V_BAT].gain_high),     "CalBatVGainHigh"},
+    {0x104, TS_CAL, TS_READ_ALL | TS_WRITE_MAKER, TS_T_FLOAT32, 4, (void*) &(adc_cal[ADC_CAL_V_SOLAR].gain),        "CalSolarVGain"},
+    {0x105, TS_CAL, TS_READ_ALL | TS_WRITE_MAKER, TS_T_FLOAT32, 3, (void*) &(adc_cal[ADC_CAL_V_SOLAR].offset),      "CalSolarVOffset_V"},
+    {0x106, TS_CAL, TS_READ_ALL | TS_WRITE_MAKER, TS_T_FLOAT32, 2, (void*) &(adc_cal[ADC_CAL_V_SOLAR].knee),        "CalSolarVKnee_V"},
+    {0x107, TS_CAL, TS_READ_ALL | TS_WRITE_MAKER, TS_T_FLOAT32, 4, (void*) &(adc_cal[ADC_CAL_V_SOLAR].gain_high),   "CalSolarVGainHigh"},
+    {0x108, TS_CAL, TS_READ_ALL | TS_WRITE_MAKER, TS_T_FLOAT32, 4, (void*) &(adc_cal[ADC_CAL_I_LOAD].gain),         "CalLoadIGain"},
+    {0x109, TS_CAL, TS_READ_ALL | TS_WRITE_MAKER, TS_T_FLOAT32, 3, (void*) &(adc_cal[ADC_CAL_I_LOAD].offset),       "CalLoadIOffset_A"},
+    {0x10A, TS_CAL, TS_READ_ALL | TS_WRITE_MAKER, TS_T_FLOAT32, 2, (void*) &(adc_cal[ADC_CAL_I_LOAD].knee),         "CalLoadIKnee_A"},
+    {0x10B, TS_CAL, TS_READ_ALL | TS_WRITE_MAKER, TS_T_FLOAT32, 4, (void*) &(adc_cal[ADC_CAL_I_LOAD].gain_high),    "CalLoadIGainHigh"},
+    {0x10C, TS_CAL, TS_READ_ALL | TS_WRITE_MAKER, TS_T_FLOAT32, 4, (void*) &(adc_cal[ADC_CAL_I_SOLAR].gain),        "CalSolarIGain"},
+    {0x10D, TS_CAL, TS_READ_ALL | TS_WRITE_MAKER, TS_T_FLOAT32, 3, (void*) &(adc_cal[ADC_CAL_I_SOLAR].offset),      "CalSolarIOffset_A"},
+    {0x10E, TS_CAL, TS_READ_ALL | TS_WRITE_MAKER, TS_T_FLOAT32, 2, (void*) &(adc_cal[ADC_CAL_I_SOLAR].knee),        "CalSolarIKnee_A"},
+    {0x10F, TS_CAL, TS_READ_ALL | TS_WRITE_MAKER, TS_T_FLOAT32, 4, (void*) &(adc_cal[ADC_CAL_I_SOLAR].gain_high),   "CalSolarIGainHigh"},
+
     // FUNCTION CALLS (EXEC) //////////////////////////////////////////////////
 #ifndef UNIT_TEST
     {0xE0, TS_EXEC, TS_EXEC_ALL, TS_T_BOOL, 0, (void*) &NVIC_SystemReset,           "Reset"},
 #endif
     {0xE1, TS_EXEC, TS_EXEC_ALL, TS_T_BOOL, 0, (void*) &start_stm32_bootloader,     "BootloaderSTM"},
     {0xE2, TS_EXEC, TS_EXEC_ALL, TS_T_BOOL, 0, (void*) &eeprom_store_data,          "SaveSettings"},
+    {0xE3, TS_EXEC, TS_EXEC_ALL, TS_T_BOOL, 0, (void*) &adc_capture_arm,            "AdcCaptureArm"},
+    {0xE4, TS_EXEC, TS_EXEC_ALL, TS_T_BOOL, 0, (void*) &adc_capture_dump,           "AdcCaptureDump"},
+    {0xE5, TS_EXEC, TS_EXEC_MAKER, TS_T_BOOL, 0, (void*) &data_objects_store_calibration, "SaveCalibration"},
+    {0xE6, TS_EXEC, TS_EXEC_ALL, TS_T_BOOL, 0, (void*) &control_timing_reset,       "ResetControlTiming"},
+#if FEATURE_DCDC_CONVERTER
+    {0xE7, TS_EXEC, TS_EXEC_ALL, TS_T_BOOL, 0, (void*) &eff_map_dump,               "EffMapDump"},
+    {0xE8, TS_EXEC, TS_EXEC_ALL, TS_T_BOOL, 0, (void*) &eff_map_reset,              "EffMapReset"},
+#endif
 };
 
 // stores object-ids of values to be published via Serial
@@ -257,19 +347,54 @@ ThingSet ts(
     pub_channels, sizeof(pub_channels)/sizeof(ts_pub_channel_t)
 );
 
+// configuration update handshake between ThingSet callback and slow control tier
+enum ConfUpdateState {
+    CONF_UPDATE_IDLE,
+    CONF_UPDATE_REQUESTED,  ///< set by ThingSet callback, to be applied by slow control tier
+    CONF_UPDATE_VALID,      ///< applied, to be stored to EEPROM by main loop
+    CONF_UPDATE_INVALID     ///< rejected, to be stored to EEPROM by main loop
+};
+
+static volatile ConfUpdateState conf_update_state = CONF_UPDATE_IDLE;
+
 void data_objects_update_conf()
 {
-    bool changed;
+    // the new configuration must not be activated while ThingSet is still processing the
+    // request, but only between two calls of the charger state machine
+    conf_update_state = CONF_UPDATE_REQUESTED;
+}
+
+void data_objects_apply_conf()
+{
+    if (conf_update_state != CONF_UPDATE_REQUESTED) {
+        return;
+    }
+
     if (battery_conf_check(&bat_conf_user)) {
-        printf("New config valid and activated.\n");
         battery_conf_overwrite(&bat_conf_user, &bat_conf, &charger);
-        changed = true;
+        conf_update_state = CONF_UPDATE_VALID;
     }
     else {
-        printf("Check not passed, getting back old config.\n");
         battery_conf_overwrite(&bat_conf, &bat_conf_user);
+        conf_update_state = CONF_UPDATE_INVALID;
+    }
+}
+
+void data_objects_store_conf()
+{
+    bool changed;
+    if (conf_update_state == CONF_UPDATE_VALID) {
+        printf("New config valid and activated.\n");
+        changed = true;
+    }
+    else if (conf_update_state == CONF_UPDATE_INVALID) {
+        printf("Check not passed, getting back old config.\n");
         changed = false;
     }
+    else {
+        return;
+    }
+    conf_update_state = CONF_UPDATE_IDLE;
 
     // TODO: check also for changes in Load/USB EnDefault
     changed = true; // temporary hack
@@ -278,9 +403,25 @@ void data_objects_update_conf()
         eeprom_store_data();
 }
 
+void data_objects_store_calibration()
+{
+    if (adc_calibration_update()) {
+        eeprom_store_calibration();
+    }
+    else {
+        printf("Calibration invalid, reset to nominal values for affected channels.\n");
+    }
+}
+
 void data_objects_read_eeprom()
 {
     eeprom_restore_data();
+#if FEATURE_DCDC_CONVERTER
+    dcdc.conf_check();      // restored values are not checked by EEPROM functions
+#endif
+    if (eeprom_restore_calibration() && !adc_calibration_update()) {
+        printf("EEPROM: Calibration invalid, using nominal values.\n");
+    }
     if (battery_conf_check(&bat_conf_user)) {
         battery_conf_overwrite(&bat_conf_user, &bat_conf, &charger);
     }
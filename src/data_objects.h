@@ -25,7 +25,26 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+/** Callback after configuration changes via ThingSet
+ *
+ * Only requests the update, which is applied by data_objects_apply_conf() in the slow control
+ * tier right before the charger state machine.
+ */
 void data_objects_update_conf();
+
+/** Validates and activates a requested configuration update (called from slow control tier in
+ * the main loop)
+ */
+void data_objects_apply_conf();
+
+/** Stores the configuration to EEPROM after an update was applied (called from main loop)
+ */
+void data_objects_store_conf();
+
 void data_objects_read_eeprom();
 
+/** Validates and activates sensor calibration written via ThingSet and stores it to EEPROM
+ */
+void data_objects_store_calibration();
+
 #endif /* DATA_OBJECTS_H */
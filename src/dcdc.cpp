@@ -20,6 +20,7 @@
 #include "debug.h"
 
 #include "half_bridge.h"
+#include "efficiency_map.h"
 
 #include <time.h>       // for time(NULL) function
 #include <math.h>       // for fabs function
@@ -28,6 +29,59 @@
 
 extern DeviceStatus dev_stat;
 
+// incremental conductance MPPT: changes below these thresholds are treated as noise
+#define MPPT_INC_COND_DV_MIN    0.05    // V
+#define MPPT_INC_COND_DI_MIN    0.01    // A
+
+// upper limit of the configurable MPPT and scan step sizes (timer counts)
+#define MPPT_STEP_LIMIT         100
+
+// minimum time between two global MPPT scans triggered by power drops (s)
+#define DCDC_SCAN_MIN_INTERVAL  60
+
+// duty cycle step to reach the open circuit voltage at the beginning of a scan (limited by the
+// minimum duty cycle of the half bridge)
+#define DCDC_SCAN_START_STEP    10000
+
+// max. duty cycle step of the output voltage and current control loops (timer counts)
+#define DCDC_PI_STEP_MAX        20
+
+// valid range of the output voltage and current control loop gains, negative gains would result
+// in positive feedback and the integral gain must not be zero to reach the target
+#define DCDC_PI_GAIN_MAX        100
+#define DCDC_PI_KI_MIN          0.01
+
+// current limit of the fast tier which triggers an emergency stop (multiple of ls_current_max)
+#define DCDC_CURRENT_TRIP_RATIO 1.25
+
+// min. switching frequency in light-load mode (kHz), should stay above audible range
+#define DCDC_LIGHT_LOAD_FREQ_MIN    20
+
+// hysteresis of power thresholds for increasing the switching frequency in light-load mode
+#define DCDC_LIGHT_LOAD_HYST        1.2
+
+// hysteresis of the current threshold for switching back to synchronous rectification
+#define DCDC_SYNC_CURRENT_HYST      1.5
+
+// dead time perturbation in background and commissioning tuning mode (ns)
+#define DCDC_DEADTIME_STEP          40
+#define DCDC_DEADTIME_STEP_COARSE   80
+
+// control cycles per phase of the dead time tuning sequence, the first cycles of each phase are
+// not evaluated to let the MPPT settle
+#define DCDC_DEADTIME_WINDOW        (CONTROL_FREQUENCY * 2)
+#define DCDC_DEADTIME_SETTLE        (CONTROL_FREQUENCY / 2)
+
+// min. relative output power difference between A and B phases to change the dead time
+#define DCDC_DEADTIME_GAIN_MIN      0.0005
+
+// time after start during which the Vmpp/Voc ratio is learned, afterwards the open circuit
+// voltage measured before the start is considered outdated (s)
+#define DCDC_START_LEARN_TIME       60
+
+// low-pass filter coefficient for learning of the start-up cache
+#define DCDC_START_LEARN_FILTER     0.1
+
 #if FEATURE_DCDC_CONVERTER == 0
 
 Dcdc::Dcdc(PowerPort *hv_side, PowerPort *lv_side, DcdcOperationMode op_mode) {}
@@ -42,18 +96,274 @@ Dcdc::Dcdc(PowerPort *hv_side, PowerPort *lv_side, DcdcOperationMode op_mode)
     enabled        = true;
     state          = DCDC_STATE_OFF;
     ls_current_max = DCDC_CURRENT_MAX;
+    ls_current_max_ma = ls_current_max * 1000;
+    fast_limit_active = false;
+    fast_stop_request = false;
     hs_voltage_max = HIGH_SIDE_VOLTAGE_MAX;
     ls_voltage_max = LOW_SIDE_VOLTAGE_MAX;
     ls_voltage_min = 9.0;
     output_power_min = 1;         // switch off iff power < 1 W
     restart_interval = 60;
+    light_load_power = 10;
+    light_load_divider_max = PWM_FREQUENCY / DCDC_LIGHT_LOAD_FREQ_MIN;
+    freq_divider = 1;
+    sync_current_min = 1.0;
+    deadtime_tuning = DEADTIME_TUNING_OFF;
+    for (int i = 0; i < DCDC_DEADTIME_BINS; i++) {
+        deadtime_table[i] = PWM_DEADTIME;
+    }
+    deadtime_converged = 0;
+    deadtime_bin = 0;
+    deadtime_phase = -1;
+    deadtime_counter = 0;
+    deadtime_actual = PWM_DEADTIME;
+    efficiency = 0;
+    soft_start_time = 0.5;
+    for (int i = 0; i < DCDC_START_CACHE_BINS; i++) {
+        start_ratio[i] = 0;
+    }
+    start_duty_gain = 1.0;
+    start_voc = 0;
+    start_timestamp = 0;
+    soft_start_duty = 0;
+    soft_start_steps = 0;
     off_timestamp = -10000;       // start immediately
     pwm_delta = 1;                // start-condition of duty cycle pwr_inc_pwm_direction
+    pwm_step_prev = 0;
+    duty_prev = 0;
+    in_voltage_prev = 0;
+    in_current_prev = 0;
+    mppt_algorithm = MPPT_PO_FIXED;
+    mppt_step_min = 1;
+    mppt_step_max = 10;
+    mppt_step_gain = 2;
+    mppt_scan_interval = 15 * 60;
+    mppt_scan_power_drop = 0.5;
+    mppt_scan_step = 4;
+    scan_num_points = 0;
+    scan_index = -1;
+    scan_timestamp = 0;
+    cv_kp = 2;
+    cv_ki = 10;
+    cc_kp = 0.5;
+    cc_ki = 1;
+    cv_error_prev = 0;
+    cc_error_prev = 0;
+    cv_residual = 0;
+    cc_residual = 0;
+    reg_inc_sum = 0;
 
     // lower duty limit might have to be adjusted dynamically depending on LS voltage
     half_bridge_init(PWM_FREQUENCY, PWM_DEADTIME, 12 / hs_voltage_max, 0.97);
 }
 
+static int deadtime_limit(int deadtime)
+{
+    if (deadtime < PWM_DEADTIME_MIN) {
+        return PWM_DEADTIME_MIN;
+    }
+    else if (deadtime > PWM_DEADTIME_MAX) {
+        return PWM_DEADTIME_MAX;
+    }
+    return deadtime;
+}
+
+/** Limits value to the range min..max (NaN is set to min)
+ */
+static float limit_range(float value, float min, float max)
+{
+    if (!(value >= min)) {
+        return min;
+    }
+    else if (value > max) {
+        return max;
+    }
+    return value;
+}
+
+void Dcdc::conf_check()
+{
+    cv_kp = limit_range(cv_kp, 0, DCDC_PI_GAIN_MAX);
+    cv_ki = limit_range(cv_ki, DCDC_PI_KI_MIN, DCDC_PI_GAIN_MAX);
+    cc_kp = limit_range(cc_kp, 0, DCDC_PI_GAIN_MAX);
+    cc_ki = limit_range(cc_ki, DCDC_PI_KI_MIN, DCDC_PI_GAIN_MAX);
+
+    // step size limits of adaptive MPPT must not be inverted
+    mppt_step_min = limit_range(mppt_step_min, 1, MPPT_STEP_LIMIT);
+    mppt_step_max = limit_range(mppt_step_max, mppt_step_min, MPPT_STEP_LIMIT);
+    mppt_step_gain = limit_range(mppt_step_gain, 0, INFINITY);
+
+    // global MPPT scan must move towards lower input voltages
+    mppt_scan_step = limit_range(mppt_scan_step, 1, MPPT_STEP_LIMIT);
+    mppt_scan_power_drop = limit_range(mppt_scan_power_drop, 0, 1);
+
+    // converted to the number of control cycles of the start ramp
+    soft_start_time = limit_range(soft_start_time, 0, DCDC_SOFT_START_TIME_MAX);
+
+    // must not go below the min. switching frequency
+    if (light_load_divider_max > PWM_FREQUENCY / DCDC_LIGHT_LOAD_FREQ_MIN) {
+        light_load_divider_max = PWM_FREQUENCY / DCDC_LIGHT_LOAD_FREQ_MIN;
+    }
+
+    for (int i = 0; i < DCDC_DEADTIME_BINS; i++) {
+        deadtime_table[i] = deadtime_limit(deadtime_table[i]);
+    }
+}
+
+bool Dcdc::mppt_scan(PowerPort *in, PowerPort *out, int *step)
+{
+    if (mode == MODE_NANOGRID) {
+        return false;
+    }
+
+    if (scan_index < 0) {
+        bool scan_due = mppt_scan_interval > 0 &&
+            time(NULL) - scan_timestamp >= mppt_scan_interval;
+        bool power_drop = mppt_scan_power_drop > 0 &&
+            time(NULL) - scan_timestamp >= DCDC_SCAN_MIN_INTERVAL &&
+            power_prev > output_power_min && out->power < power_prev * (1 - mppt_scan_power_drop);
+
+        if (!scan_due && !power_drop) {
+            return false;
+        }
+        print_info("DC/DC global MPPT scan started (%s)\n", scan_due ? "interval" : "power drop");
+        scan_timestamp = time(NULL);
+        scan_index = 0;
+        *step = -DCDC_SCAN_START_STEP;
+        return true;
+    }
+
+    // duty cycle not changed by last step: limit of half bridge reached, point is a duplicate
+    bool duty_limit = scan_index > 0 && half_bridge_get_duty_cycle() == duty_prev;
+
+    if (!duty_limit) {
+        scan_voltage[scan_index] = in->voltage;
+        scan_power[scan_index] = out->power;
+        scan_index++;
+    }
+
+    if (!duty_limit && scan_index < DCDC_SCAN_POINTS_MAX &&
+        in->voltage > in->src_voltage_start)
+    {
+        *step = mppt_scan_step;
+        return true;
+    }
+
+    // scan finished: jump to global maximum
+    int max_index = 0;
+    for (int i = 1; i < scan_index; i++) {
+        if (scan_power[i] > scan_power[max_index]) {
+            max_index = i;
+        }
+    }
+    scan_num_points = scan_index;
+    scan_index = -1;
+
+    // actual duty cycle belongs to the last recorded point
+    *step = (max_index - scan_num_points + 1) * mppt_scan_step;
+    print_info("DC/DC global MPPT scan finished, max. power %.1f W at %.1f V\n",
+        scan_power[max_index], scan_voltage[max_index]);
+    return *step != 0;
+}
+
+int Dcdc::mppt_step(PowerPort *in, PowerPort *out)
+{
+    switch (mppt_algorithm) {
+        case MPPT_PO_ADAPTIVE:
+            return mppt_perturb_observe_adaptive(in, out);
+        case MPPT_INC_COND:
+            return mppt_incremental_conductance(in, out);
+        default:
+            return mppt_perturb_observe(in, out);
+    }
+}
+
+int Dcdc::mppt_perturb_observe(PowerPort *in, PowerPort *out)
+{
+    // power change can only be evaluated if the last step was caused by the MPPT
+    if (pwm_step_prev != 0 && power_prev > out->power) {
+        pwm_delta = -pwm_delta;
+    }
+    return pwm_delta;
+}
+
+int Dcdc::mppt_perturb_observe_adaptive(PowerPort *in, PowerPort *out)
+{
+    float duty = half_bridge_get_duty_cycle();
+    int step = mppt_step_min;
+
+    // slope can only be determined if the duty cycle was actually changed (not at the limits)
+    if (pwm_step_prev != 0 && duty != duty_prev) {
+        step = mppt_step_gain * fabs((out->power - power_prev) / pwm_step_prev) + 0.5;
+        if (step < mppt_step_min) {
+            step = mppt_step_min;
+        }
+        else if (step > mppt_step_max) {
+            step = mppt_step_max;
+        }
+    }
+    if (step < 1) {
+        step = 1;
+    }
+
+    if (pwm_step_prev != 0 && power_prev > out->power) {
+        pwm_delta = -pwm_delta;
+    }
+    return pwm_delta * step;
+}
+
+int Dcdc::mppt_incremental_conductance(PowerPort *in, PowerPort *out)
+{
+    // input current has negative sign, as the port is a source
+    float voltage = in->voltage;
+    float current = -in->current;
+    float dv = voltage - in_voltage_prev;
+    float di = current - in_current_prev;
+
+    in_voltage_prev = voltage;
+    in_current_prev = current;
+
+    if (fabs(dv) < MPPT_INC_COND_DV_MIN) {
+        if (fabs(di) < MPPT_INC_COND_DI_MIN) {
+            pwm_delta = -pwm_delta;     // at MPP or steady state: dither around operating point
+        }
+        else {
+            // irradiance changed at constant voltage: MPP voltage moves in the same direction
+            pwm_delta = (di > 0) ? -1 : 1;
+        }
+    }
+    else {
+        // dI/dV + I/V > 0 (left of MPP) is equal to dI * V + I * dV having the same sign as dV,
+        // which avoids divisions
+        float g = di * voltage + current * dv;
+        if (fabs(g) < MPPT_INC_COND_DI_MIN * voltage) {
+            pwm_delta = -pwm_delta;     // at MPP
+        }
+        else if ((g > 0) == (dv > 0)) {
+            pwm_delta = -1;             // left of MPP: increase input voltage
+        }
+        else {
+            pwm_delta = 1;              // right of MPP: decrease input voltage
+        }
+    }
+    return pwm_delta;
+}
+
+float Dcdc::pi_increment(float error, float *error_prev, float kp, float ki)
+{
+    // velocity form: u(k) - u(k-1) = Kp * (e(k) - e(k-1)) + Ki * e(k)
+    float inc = kp * (error - *error_prev) + ki * error;
+    *error_prev = error;
+
+    if (inc > DCDC_PI_STEP_MAX) {
+        return DCDC_PI_STEP_MAX;
+    }
+    else if (inc < -DCDC_PI_STEP_MAX) {
+        return -DCDC_PI_STEP_MAX;
+    }
+    return inc;
+}
+
 int Dcdc::duty_cycle_delta()
 {
     int pwr_inc_pwm_direction;      // direction of PWM duty cycle change for increasing power
@@ -75,11 +385,15 @@ int Dcdc::duty_cycle_delta()
         out = hvs;
     }
 
-    if (out->power >= output_power_min) {
+    // switching losses are reduced in light-load mode, so lower output power is still useful
+    if (out->power >= output_power_min / half_bridge_get_frequency_divider()) {
         power_good_timestamp = time(NULL);     // reset the time
     }
 
-    int pwr_inc_goal = 0;     // stores if we want to increase (+1) or decrease (-1) power
+    int pwr_inc_goal = 0;     // duty cycle step in direction of increasing power
+    int pwr_inc_fine = 0;     // same for CV/CC with dither resolution (1/PWM_DITHER_STEPS)
+    bool mppt = false;
+    bool tracking = false;
 
     print_test("P: %.2f, P_prev: %.2f, v_in: %.2f, v_out: %.2f, i_in: %.2f, i_out: %.2f, "
         "v_chg_target: %.2f, i_chg_max: %.2f, PWM: %.1f, chg_state: %d\n",
@@ -87,24 +401,48 @@ int Dcdc::duty_cycle_delta()
         out->sink_voltage_max, out->pos_current_limit, half_bridge_get_duty_cycle() * 100.0,
         state);
 
+    // Both regulation loops are updated in every cycle, so that the transfer between MPPT and
+    // CV/CC is bumpless. The duty cycle itself is the integrator state of the controllers, so
+    // only the fractional part of the increment (less than the dither resolution) is kept by the
+    // active loop and there is no integrator which could wind up at the duty cycle limits.
+    float cv_error = out->sink_voltage_max - out->pos_droop_res * out->current - out->voltage;
+    float cc_error = out->pos_current_limit - out->current;
+    float cv_inc = cv_residual + pi_increment(cv_error, &cv_error_prev, cv_kp, cv_ki);
+    float cc_inc = cc_residual + pi_increment(cc_error, &cc_error_prev, cc_kp, cc_ki);
+    cv_residual = 0;
+    cc_residual = 0;
+
     if (time(NULL) - power_good_timestamp > 10 ||      // more than 10s low power
          out->power < -1.0)           // or already generating negative power
     {
-        pwr_inc_goal = 0;     // switch off
+        state = DCDC_STATE_OFF;     // switch off
     }
-    else if (out->voltage > (out->sink_voltage_max - out->pos_droop_res * out->current))
+    else if (cv_inc < 1 && cv_inc <= cc_inc)
     {
-       // output voltage target reached
+        // output voltage target reached
         state = DCDC_STATE_CV;
-        pwr_inc_goal = -1;  // decrease output power
+        pwr_inc_fine = floorf(cv_inc * PWM_DITHER_STEPS);
+        if (reg_inc_sum + pwr_inc_fine > PWM_DITHER_STEPS) {
+            // max. one timer count above the last MPPT operating point, as the input power
+            // might be limited: further increase is left to the MPPT
+            pwr_inc_fine = PWM_DITHER_STEPS - reg_inc_sum;
+        }
+        cv_residual = cv_inc - (float)pwr_inc_fine / PWM_DITHER_STEPS;
     }
-    else if (out->current > out->pos_current_limit)
+    else if (cc_inc < 1)
     {
         // output charge current limit reached
         state = DCDC_STATE_CC;
-        pwr_inc_goal = -1;  // decrease output power
+        pwr_inc_fine = floorf(cc_inc * PWM_DITHER_STEPS);
+        if (reg_inc_sum + pwr_inc_fine > PWM_DITHER_STEPS) {
+            // max. one timer count above the last MPPT operating point, as the input power
+            // might be limited: further increase is left to the MPPT
+            pwr_inc_fine = PWM_DITHER_STEPS - reg_inc_sum;
+        }
+        cc_residual = cc_inc - (float)pwr_inc_fine / PWM_DITHER_STEPS;
     }
     else if (fabs(lvs->current) > ls_current_max    // current above hardware maximum
+        || fast_limit_active                        // same, detected by fast tier
         || temp_mosfets > 80                        // temperature limits exceeded
         || (in->voltage < (in->src_voltage_start - in->neg_droop_res * in->current)
             && out->current > 0.1)                  // input voltage below limit
@@ -112,23 +450,262 @@ int Dcdc::duty_cycle_delta()
     {
         state = DCDC_STATE_DERATING;
         pwr_inc_goal = -1;  // decrease output power
+        // continue MPPT away from the limit, otherwise the perturbation direction is kept and
+        // the duty cycle toggles between derating and MPPT step forever
+        pwm_delta = -1;
     }
     else if (out->power < output_power_min && out->voltage < out->src_voltage_start)
     {
         // no load condition (e.g. start-up of nanogrid) --> raise voltage
+        state = DCDC_STATE_MPPT;    // running without limitation, must not keep the OFF state
         pwr_inc_goal = 1;   // increase output power
     }
     else {
         // start MPPT
         state = DCDC_STATE_MPPT;
-        if (power_prev > out->power) {
-            pwm_delta = -pwm_delta;
+        tracking = true;
+        if (!mppt_scan(in, out, &pwr_inc_goal)) {
+            mppt = true;
+            pwr_inc_goal = mppt_step(in, out);
+
+            // don't overshoot the output voltage and current limits
+            int inc_max = (cv_inc < cc_inc) ? cv_inc : cc_inc;
+            if (pwr_inc_goal > inc_max) {
+                pwr_inc_goal = inc_max;
+            }
         }
-        pwr_inc_goal = pwm_delta;
+    }
+
+    if (!tracking) {
+        scan_index = -1;    // abort global scan if limits are reached
+    }
+
+    if (state != DCDC_STATE_OFF) {
+        light_load_control(out->power);
     }
 
     power_prev = out->power;
-    return pwr_inc_goal * pwr_inc_pwm_direction;
+    pwm_step_prev = mppt ? pwr_inc_goal * pwr_inc_pwm_direction : 0;
+    reg_inc_sum = (state == DCDC_STATE_CV || state == DCDC_STATE_CC) ?
+        reg_inc_sum + pwr_inc_fine : 0;
+    duty_prev = half_bridge_get_duty_cycle();
+    fast_limit_active = false;
+    return (pwr_inc_goal * PWM_DITHER_STEPS + pwr_inc_fine) * pwr_inc_pwm_direction;
+}
+
+void Dcdc::light_load_control(float power)
+{
+    int divider = half_bridge_get_frequency_divider();
+
+    // the switching frequency is reduced stepwise if the output power per switching period
+    // falls below the threshold and increased again with some hysteresis
+    if (light_load_power > 0 && power * divider < light_load_power &&
+        divider < light_load_divider_max)
+    {
+        divider++;
+    }
+    else if (divider > 1 && (light_load_power <= 0 ||
+        power * (divider - 1) > light_load_power * DCDC_LIGHT_LOAD_HYST))
+    {
+        divider--;
+    }
+
+    if (divider != half_bridge_get_frequency_divider()) {
+        half_bridge_set_frequency_divider(divider);
+        divider = half_bridge_get_frequency_divider();      // might be limited by timer
+        print_info("DC/DC switching frequency set to %d kHz (P = %.1f W)\n",
+            PWM_FREQUENCY / divider, power);
+    }
+    freq_divider = divider;
+}
+
+void Dcdc::sync_rectification_control()
+{
+    // only in buck mode the low-side MOSFET is the (synchronous) rectifier
+    bool buck = mode == MODE_MPPT_BUCK || (mode == MODE_NANOGRID && lvs->current > 0.1);
+
+    if (!buck || sync_current_min <= 0) {
+        if (!half_bridge_sync_rectification()) {
+            half_bridge_set_sync_rectification(true);
+        }
+    }
+    else if (half_bridge_sync_rectification() && lvs->current < sync_current_min) {
+        half_bridge_set_sync_rectification(false);
+        print_info("DC/DC diode emulation mode (I = %.2f A)\n", lvs->current);
+    }
+    else if (!half_bridge_sync_rectification() &&
+        lvs->current > sync_current_min * DCDC_SYNC_CURRENT_HYST)
+    {
+        half_bridge_set_sync_rectification(true);
+        print_info("DC/DC synchronous mode (I = %.2f A)\n", lvs->current);
+    }
+}
+
+void Dcdc::deadtime_control(float power)
+{
+    int bin = fabs(lvs->current) * DCDC_DEADTIME_BINS / ls_current_max;
+    if (bin >= DCDC_DEADTIME_BINS) {
+        bin = DCDC_DEADTIME_BINS - 1;
+    }
+
+    // the output power can only be compared for the same input conditions, i.e. at the MPP
+    bool tuning = deadtime_tuning != DEADTIME_TUNING_OFF && state == DCDC_STATE_MPPT;
+    // coarse steps during commissioning until the bin converged for the first time
+    int step = (deadtime_tuning == DEADTIME_TUNING_COMMISSIONING &&
+        (deadtime_converged & (1U << bin)) == 0) ? DCDC_DEADTIME_STEP_COARSE : DCDC_DEADTIME_STEP;
+
+    if (deadtime_phase >= 0 && (!tuning || bin != deadtime_bin)) {
+        deadtime_phase = -1;    // operating point changed: abort sequence
+    }
+    else if (deadtime_phase >= 0) {
+        if (deadtime_counter >= DCDC_DEADTIME_SETTLE) {
+            deadtime_power[(deadtime_phase == 1 || deadtime_phase == 2) ? 1 : 0] += power;
+        }
+        deadtime_counter++;
+        if (deadtime_counter >= DCDC_DEADTIME_WINDOW) {
+            deadtime_counter = 0;
+            deadtime_phase++;
+        }
+        if (deadtime_phase > 3) {
+            float gain = (deadtime_power[1] - deadtime_power[0]) /
+                (deadtime_power[0] + deadtime_power[1]);
+            int deadtime = deadtime_table[bin];
+            if (gain > DCDC_DEADTIME_GAIN_MIN) {
+                deadtime += step;
+            }
+            else if (gain < -DCDC_DEADTIME_GAIN_MIN) {
+                deadtime -= step;
+            }
+
+            deadtime = deadtime_limit(deadtime);
+
+            // converged if no significant gain or limits reached
+            if (deadtime == deadtime_table[bin]) {
+                deadtime_converged |= 1U << bin;
+            }
+            else {
+                deadtime_converged &= ~(1U << bin);
+                deadtime_table[bin] = deadtime;
+            }
+
+            if (deadtime_tuning == DEADTIME_TUNING_COMMISSIONING &&
+                deadtime_converged == (1U << DCDC_DEADTIME_BINS) - 1)
+            {
+                print_info("DC/DC dead time commissioning finished\n");
+                deadtime_tuning = DEADTIME_TUNING_BACKGROUND;
+                deadtime_converged = 0;
+            }
+            deadtime_phase = -1;
+        }
+    }
+    else if (tuning) {
+        deadtime_bin = bin;
+        deadtime_phase = 0;
+        deadtime_counter = 0;
+        deadtime_power[0] = 0;
+        deadtime_power[1] = 0;
+    }
+
+    int deadtime = deadtime_table[bin];
+    if (deadtime_phase >= 0) {
+        deadtime += (deadtime_phase == 1 || deadtime_phase == 2) ? step : -step;
+        deadtime = deadtime_limit(deadtime);
+    }
+
+    if (deadtime != deadtime_actual) {
+        half_bridge_set_deadtime(deadtime);
+        deadtime_actual = deadtime;
+    }
+}
+
+static int start_cache_bin(float voc, float voc_max)
+{
+    int bin = voc * DCDC_START_CACHE_BINS / voc_max;
+    if (bin < 0) {
+        return 0;
+    }
+    else if (bin >= DCDC_START_CACHE_BINS) {
+        return DCDC_START_CACHE_BINS - 1;
+    }
+    return bin;
+}
+
+float Dcdc::start_cache_duty()
+{
+    int bin = start_cache_bin(start_voc, hs_voltage_max);
+
+    // the ratio changes only slightly with temperature and irradiance, so the nearest learned
+    // bin is a better guess than the conservative default start duty cycle
+    for (int d = 0; d < DCDC_START_CACHE_BINS; d++) {
+        float ratio = 0;
+        if (bin - d >= 0 && start_ratio[bin - d] > 0) {
+            ratio = start_ratio[bin - d];
+        }
+        else if (bin + d < DCDC_START_CACHE_BINS && start_ratio[bin + d] > 0) {
+            ratio = start_ratio[bin + d];
+        }
+        if (ratio > 0) {
+            return start_duty_gain * lvs->voltage / (ratio * start_voc);
+        }
+    }
+    return 0;
+}
+
+void Dcdc::start_cache_update(int mppt_step_prev)
+{
+    // the P&O algorithms change direction when passing the MPP
+    if (start_voc <= 0 || state != DCDC_STATE_MPPT || mppt_step_prev * pwm_step_prev >= 0 ||
+        time(NULL) - start_timestamp > DCDC_START_LEARN_TIME ||
+        hvs->voltage >= start_voc || lvs->voltage <= 0)
+    {
+        return;
+    }
+
+    int bin = start_cache_bin(start_voc, hs_voltage_max);
+    float ratio = hvs->voltage / start_voc;
+    float gain = half_bridge_get_duty_cycle() * hvs->voltage / lvs->voltage;
+
+    if (start_ratio[bin] > 0) {
+        start_ratio[bin] += DCDC_START_LEARN_FILTER * (ratio - start_ratio[bin]);
+    }
+    else {
+        start_ratio[bin] = ratio;
+    }
+    start_duty_gain += DCDC_START_LEARN_FILTER * (gain - start_duty_gain);
+}
+
+bool Dcdc::soft_start_control()
+{
+    if (soft_start_steps <= 0) {
+        return false;
+    }
+    else if (state != DCDC_STATE_MPPT) {
+        soft_start_steps = 0;   // limits reached: leave it to the CV/CC control
+        return false;
+    }
+
+    float duty = half_bridge_get_duty_cycle();
+    half_bridge_set_duty_cycle(duty + (soft_start_duty - duty) / soft_start_steps);
+    soft_start_steps--;
+
+    // power changes during the ramp must not be evaluated by the MPPT
+    pwm_step_prev = 0;
+    return true;
+}
+
+void Dcdc::efficiency_update()
+{
+    // the input port is the source with negative power
+    PowerPort *in = (hvs->power < 0) ? hvs : lvs;
+    PowerPort *out = (hvs->power < 0) ? lvs : hvs;
+
+    if (-in->power > output_power_min && hvs->voltage > 0) {
+        float voltage_ratio = lvs->voltage / hvs->voltage;
+        float current_ratio = fabs(lvs->current) / ls_current_max;
+        eff_map_update(voltage_ratio, current_ratio, out->power / -in->power);
+        int eff = eff_map_get(voltage_ratio, current_ratio);
+        efficiency = (eff >= 0) ? eff * 0.01 : 0;
+    }
 }
 
 int Dcdc::check_start_conditions()
@@ -154,7 +731,8 @@ int Dcdc::check_start_conditions()
 
     if (hvs->pos_current_limit > 0 &&
         hvs->voltage < hvs->sink_voltage_max &&
-        hvs->voltage > hvs->sink_voltage_min &&
+        (hvs->voltage > hvs->sink_voltage_min ||
+            mode == MODE_NANOGRID) &&       // nanogrid has to be started up from zero voltage
         lvs->neg_current_limit < 0 &&
         lvs->voltage > lvs->src_voltage_start)
     {
@@ -166,6 +744,19 @@ int Dcdc::check_start_conditions()
 
 void Dcdc::control()
 {
+    // parameters may have been changed via ThingSet
+    conf_check();
+
+    // integer copy of the limit, so that the fast tier does not need float calculations
+    ls_current_max_ma = ls_current_max * 1000;
+
+    if (fast_stop_request) {
+        // half bridge was already stopped by the fast tier, only the state is updated here
+        fast_stop_request = false;
+        emergency_stop();
+        print_info("DC/DC Stop: emergency (current limit exceeded).\n");
+    }
+
     if (half_bridge_enabled()) {
         const char *stop_reason = NULL;
         if (lvs->voltage > ls_voltage_max || hvs->voltage > hs_voltage_max) {
@@ -175,12 +766,20 @@ void Dcdc::control()
             stop_reason = "disabled";
         }
         else {
+            int mppt_step_prev = pwm_step_prev;
             int step = duty_cycle_delta();
-            if (step == 0) {
+            if (state == DCDC_STATE_OFF) {
                 stop_reason =  "low power";
             }
             else {
-                half_bridge_duty_cycle_step(step);
+                if (!soft_start_control()) {
+                    // loop gains are valid for full frequency: keep duty cycle ratio changes equal
+                    half_bridge_duty_cycle_step_fine(step * half_bridge_get_frequency_divider());
+                }
+                start_cache_update(mppt_step_prev);
+                sync_rectification_control();
+                deadtime_control((mode == MODE_MPPT_BOOST) ? hvs->power : lvs->power);
+                efficiency_update();
             }
         }
 
@@ -221,19 +820,45 @@ void Dcdc::control()
                 startup_delay_counter++;
                 if (startup_delay_counter > num_wait_calls) {
                     const char *mode_name = NULL;
+                    half_bridge_set_frequency_divider(1);
                     if (startup_mode == 1) {
                         mode_name = "buck";
+                        // start with diode emulation to prevent discharging of the battery
+                        half_bridge_set_sync_rectification(sync_current_min <= 0);
                         // Don't start directly at Vmpp (approx. 0.8 * Voc) to prevent high inrush
-                        // currents and stress on MOSFETs
+                        // currents and stress on MOSFETs, but ramp up to the learned MPP
+                        start_voc = hvs->voltage;
+                        float duty_mpp = (soft_start_time > 0) ? start_cache_duty() : 0;
                         half_bridge_start(lvs->voltage / (hvs->voltage - 1));
+                        soft_start_steps = 0;
+                        if (duty_mpp > half_bridge_get_duty_cycle()) {
+                            soft_start_duty = duty_mpp;
+                            soft_start_steps = soft_start_time * CONTROL_FREQUENCY + 0.5;
+                            if (soft_start_steps < 1) {
+                                soft_start_steps = 1;
+                            }
+                        }
                     }
                     else {
                         mode_name = "boost";
+                        start_voc = 0;
+                        soft_start_steps = 0;
+                        half_bridge_set_sync_rectification(true);   // LS is the active switch
                         // Will automatically start with max. duty (0.97) if connected to a
                         // nanogrid not yet started up (zero voltage)
                         half_bridge_start(lvs->voltage / (hvs->voltage + 1));
                     }
+                    state = DCDC_STATE_MPPT;    // actual state is set by the first control cycle
                     power_good_timestamp = time(NULL);
+                    start_timestamp = time(NULL);
+                    scan_timestamp = time(NULL);    // first global scan after scan interval
+                    pwm_step_prev = 0;
+
+                    // initialize regulation loops with actual errors (no proportional kick)
+                    PowerPort *out = (startup_mode == 1) ? lvs : hvs;
+                    cv_error_prev = out->sink_voltage_max - out->pos_droop_res * out->current -
+                        out->voltage;
+                    cc_error_prev = out->pos_current_limit - out->current;
                     print_info("DC/DC %s mode start (HV: %.2fV, LV: %.2fV, PWM: %.1f).\n", mode_name,
                         hvs->voltage, lvs->voltage, half_bridge_get_duty_cycle() * 100);
                     startup_delay_counter = 0; // ensure we will have a delay before next start
@@ -259,6 +884,7 @@ void Dcdc::test()
 
         if (startup_delay_counter > num_wait_calls) {
             if (check_start_conditions() != 0) {
+                half_bridge_set_sync_rectification(true);
                 half_bridge_start(lvs->voltage / hvs->voltage);
                 print_info("DC/DC test mode start (HV: %.2fV, LV: %.2fV, PWM: %.1f).\n",
                     hvs->voltage, lvs->voltage, half_bridge_get_duty_cycle() * 100);
@@ -277,6 +903,25 @@ void Dcdc::emergency_stop()
     off_timestamp = time(NULL);
 }
 
+void Dcdc::fast_current_limit(int32_t current_ma)
+{
+    if (!half_bridge_enabled()) {
+        return;
+    }
+
+    int32_t current_abs = (current_ma > 0) ? current_ma : -current_ma;
+    if (current_abs > ls_current_max_ma * (int)(DCDC_CURRENT_TRIP_RATIO * 100) / 100) {
+        half_bridge_stop();
+        fast_stop_request = true;
+    }
+    else if (current_abs > ls_current_max_ma) {
+        // positive inductor current (buck): lower duty cycle reduces power and vice versa
+        // (the step is atomic, as control() may change the duty cycle at the same time)
+        half_bridge_duty_cycle_step(current_ma > 0 ? -1 : 1);
+        fast_limit_active = true;
+    }
+}
+
 void Dcdc::self_destruction()
 {
     print_error("Charge controller self-destruction called!\n");
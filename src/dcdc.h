@@ -54,6 +54,42 @@ enum DcdcControlState
     DCDC_STATE_DERATING ///< Hardware-limits (current or temperature) reached
 };
 
+/** Maximum power point tracking algorithm
+ */
+enum DcdcMpptAlgorithm
+{
+    MPPT_PO_FIXED,      ///< Perturb and observe with fixed step of one PWM timer count
+    MPPT_PO_ADAPTIVE,   ///< Perturb and observe with step size proportional to |dP/dD|
+    MPPT_INC_COND       ///< Incremental conductance (dI/dV compared to -I/V at input port)
+};
+
+/** Dead time tuning mode
+ */
+enum DcdcDeadtimeTuning
+{
+    DEADTIME_TUNING_OFF,            ///< Use stored dead time table without changes
+    DEADTIME_TUNING_BACKGROUND,     ///< Slow optimization with fine steps during normal operation
+    DEADTIME_TUNING_COMMISSIONING   ///< Coarse steps until all current bins converged, afterwards
+                                    ///< continue with background optimization
+};
+
+/** Number of inductor current bins with separate dead time setting
+ */
+#define DCDC_DEADTIME_BINS 4
+
+/** Number of open circuit voltage bins of the start-up cache (equally spaced up to
+ * hs_voltage_max)
+ */
+#define DCDC_START_CACHE_BINS 8
+
+/** Upper limit of the configurable soft start duration (s)
+ */
+#define DCDC_SOFT_START_TIME_MAX 10
+
+/** Max. number of points of the global MPPT scan (determines max. duration of the scan)
+ */
+#define DCDC_SCAN_POINTS_MAX 32
+
 /** DC/DC class
  *
  * Contains all data belonging to the DC/DC sub-component of the PCB, incl.
@@ -94,6 +130,26 @@ public:
      */
     void emergency_stop();
 
+    /** Fast cycle-by-cycle current limitation (integer only)
+     *
+     * Called from the fast control tier in the ADC DMA ISR. If the inductor current exceeds
+     * ls_current_max, the duty cycle is stepped by one timer count towards lower power. Above
+     * DCDC_CURRENT_TRIP_RATIO times the limit, the half bridge is stopped immediately.
+     *
+     * The state of the DC/DC is only changed by control(), which may be interrupted by this
+     * function. The limitation is passed to control() via request flags instead.
+     *
+     * @param current_ma Inductor current from fast filtered ADC view (mA)
+     */
+    void fast_current_limit(int32_t current_ma);
+
+    /** Limits the configuration parameters to valid ranges
+     *
+     * The parameters can be changed via ThingSet or restored from EEPROM without any checks, so
+     * this function is called at the beginning of each control cycle and after EEPROM restore.
+     */
+    void conf_check();
+
     /** Prevent overcharging of battery in case of shorted HS MOSFET
      *
      * This function switches the LS MOSFET continuously on to blow the battery input fuse. The
@@ -114,6 +170,10 @@ public:
     // current state
     float power_prev;           ///< Stores previous conversion power (set via dcdc_control)
     int pwm_delta;              ///< Direction of PWM change for MPPT
+    int pwm_step_prev;          ///< Last MPPT duty cycle step in timer counts (incl. direction)
+    float duty_prev;            ///< Duty cycle before last MPPT step
+    float in_voltage_prev;      ///< Input voltage at last MPPT step (incremental conductance)
+    float in_current_prev;      ///< Input current at last MPPT step (incremental conductance)
     int off_timestamp;          ///< Last time the DC/DC was switched off
     int power_good_timestamp;   ///< Last time the DC/DC reached above minimum output power
 
@@ -124,6 +184,58 @@ public:
     float ls_voltage_min;       ///< Minimum low-side voltage, e.g. for driver supply
     float output_power_min;     ///< Minimum output power (if lower, DC/DC is switched off)
 
+    // MPPT configuration
+    uint16_t mppt_algorithm;    ///< MPPT algorithm (see DcdcMpptAlgorithm)
+    int mppt_step_min;          ///< Minimum duty cycle step of adaptive MPPT (timer counts)
+    int mppt_step_max;          ///< Maximum duty cycle step of adaptive MPPT (timer counts)
+    float mppt_step_gain;       ///< Step size of adaptive MPPT per |dP/dD| (counts per W/count)
+    int mppt_scan_interval;     ///< Interval of global MPPT scan (s), 0 = disabled
+    float mppt_scan_power_drop; ///< Relative power drop within one control cycle which triggers
+                                ///< a global MPPT scan (0 = disabled)
+    int mppt_scan_step;         ///< Duty cycle step between two points of the scan (timer counts)
+
+    // global MPPT scan results (coarse P-V curve of the input port)
+    float scan_voltage[DCDC_SCAN_POINTS_MAX];   ///< Input voltage of scan points
+    float scan_power[DCDC_SCAN_POINTS_MAX];     ///< Output power of scan points
+    int scan_num_points;        ///< Number of valid scan points
+    int scan_timestamp;         ///< Last time a global MPPT scan was started
+
+    // output voltage (CV) and current (CC) control loops
+    float cv_kp;                ///< Proportional gain of voltage control (timer counts per V)
+    float cv_ki;                ///< Integral gain of voltage control (timer counts per V and
+                                ///< control cycle)
+    float cc_kp;                ///< Proportional gain of current control (timer counts per A)
+    float cc_ki;                ///< Integral gain of current control (timer counts per A and
+                                ///< control cycle)
+
+    // light-load mode (switching frequency foldback)
+    float light_load_power;     ///< Output power below which the switching frequency is reduced
+                                ///< (W, threshold per frequency divider step), 0 = disabled
+    int light_load_divider_max; ///< Max. divider of the switching frequency in light-load mode
+    int freq_divider;           ///< Actual divider of the switching frequency (1 = full frequency)
+
+    // diode emulation
+    float sync_current_min;     ///< Inductor current below which the low-side MOSFET is kept off
+                                ///< in buck mode (diode emulation), 0 = always synchronous
+
+    // dead time optimization
+    uint16_t deadtime_tuning;   ///< Dead time tuning mode (see DcdcDeadtimeTuning)
+    uint16_t deadtime_table[DCDC_DEADTIME_BINS];    ///< Dead time per inductor current bin (ns),
+                                ///< bins are equally spaced between 0 and ls_current_max
+    uint16_t deadtime_converged; ///< Bit mask of current bins where tuning has converged
+
+    // fast start-up
+    float soft_start_time;      ///< Duration of the ramp to the learned MPP duty cycle after
+                                ///< start in buck mode (s), 0 = start far from the MPP and let
+                                ///< the MPPT climb
+    float start_ratio[DCDC_START_CACHE_BINS];   ///< Learned Vmpp/Voc ratio per open circuit
+                                ///< voltage bin (0 = not yet learned)
+    float start_duty_gain;      ///< Learned ratio of actual and ideal (Vout/Vin) duty cycle at
+                                ///< the MPP, considers the converter losses
+
+    float efficiency;           ///< Mean efficiency of the actual operating point from the
+                                ///< efficiency map (%), 0 if not enough samples available
+
     // calibration parameters
     int restart_interval;       ///< Restart interval (s): When should we retry to start charging
                                 ///< after low output power cut-off?
@@ -131,9 +243,158 @@ public:
 private:
     /** Calculates the duty cycle change depending on operating mode and actual measurements
      *
-     * @returns duty cycle step (-1 or 1) or 0 if DC/DC should be switched off
+     * The state is set to DCDC_STATE_OFF if the DC/DC should be switched off.
+     *
+     * In CV/CC state, the duty cycle is changed with the dither resolution, but the power may
+     * only be increased by max. one timer count (at full switching frequency) above the last
+     * MPPT operating point. If the output stays below the CV/CC target, e.g. because the input
+     * power is limited, the increment accumulates in the residual and the MPPT takes over
+     * instead of moving the operating point beyond the MPP.
+     *
+     * @returns duty cycle step in 1/PWM_DITHER_STEPS timer counts (positive, negative or 0)
      */
     int duty_cycle_delta();
+
+    /** Discrete PI controller in velocity form
+     *
+     * @param error Control error (positive if output power may be increased)
+     * @param error_prev Error of previous control cycle (updated by this function)
+     * @param kp Proportional gain
+     * @param ki Integral gain
+     *
+     * @returns duty cycle increment in direction of increasing power (timer counts, limited
+     *          to DCDC_PI_STEP_MAX)
+     */
+    float pi_increment(float error, float *error_prev, float kp, float ki);
+
+    /** Light-load mode: reduces the switching frequency at low output power
+     *
+     * The divider is changed by one step per call, so that the transition is smooth. The minimum
+     * output power for switching off is reduced by the same divider, as switching losses are
+     * reduced accordingly.
+     *
+     * @param power Actual output power
+     */
+    void light_load_control(float power);
+
+    /** Switches between synchronous and asynchronous (diode emulation) operation
+     *
+     * In buck mode the low-side MOSFET is switched off below sync_current_min to prevent
+     * negative inductor current at light load. In boost mode, synchronous rectification is
+     * always enabled.
+     */
+    void sync_rectification_control();
+
+    /** Dead time selection and optimization
+     *
+     * Sets the dead time of the actual inductor current bin from the table. If tuning is
+     * enabled and the DC/DC is in MPPT state, the dead time is perturbed by +/- one step in an
+     * A-B-B-A sequence (cancels linear drift of the input power) and the table entry is moved
+     * in the direction of higher average output power.
+     *
+     * @param power Actual output power
+     */
+    void deadtime_control(float power);
+
+    int deadtime_bin;           ///< Current bin of the running tuning sequence
+    int deadtime_phase;         ///< Phase of the A-B-B-A sequence (-1 = no tuning running)
+    int deadtime_counter;       ///< Control cycles since start of the actual phase
+    float deadtime_power[2];    ///< Sum of output power with lower (A) and higher (B) dead time
+    int deadtime_actual;        ///< Dead time set in the half bridge (ns)
+
+    /** Ramps the duty cycle from the start value to the learned MPP after start-up
+     *
+     * The ramp is aborted as soon as the DC/DC leaves MPPT state, e.g. because the output
+     * voltage or current limits were reached.
+     *
+     * @returns true if the ramp is active and the duty cycle was set
+     */
+    bool soft_start_control();
+
+    /** Learns Vmpp/Voc ratio and duty cycle gain while the MPPT oscillates around the MPP
+     *
+     * @param mppt_step Actual MPPT step (0 if no MPPT step was taken)
+     */
+    void start_cache_update(int mppt_step);
+
+    /** Duty cycle close to the MPP based on the learned Vmpp/Voc ratio
+     *
+     * @returns duty cycle or 0 if nothing was learned yet for this open circuit voltage
+     */
+    float start_cache_duty();
+
+    /** Adds the conversion efficiency of the actual operating point to the efficiency map
+     *
+     * Only called while the converter is running and above output_power_min.
+     */
+    void efficiency_update();
+
+    float start_voc;            ///< Open circuit voltage before start in buck mode (0 = invalid)
+    int start_timestamp;        ///< Time of last start of the converter
+    float soft_start_duty;      ///< Target duty cycle of the start ramp
+    int soft_start_steps;       ///< Remaining control cycles of the start ramp
+
+    int32_t ls_current_max_ma;  ///< Copy of ls_current_max for fast tier (mA)
+    volatile bool fast_limit_active;    ///< Current limited by fast tier since last control()
+    volatile bool fast_stop_request;    ///< Half bridge stopped by fast tier (overcurrent)
+
+    float cv_error_prev;        ///< Voltage control error of previous control cycle
+    float cc_error_prev;        ///< Current control error of previous control cycle
+    float cv_residual;          ///< Duty cycle increment of voltage control below dither resolution
+    float cc_residual;          ///< Duty cycle increment of current control below dither resolution
+    int reg_inc_sum;            ///< Sum of CV/CC duty cycle steps since last MPPT step in
+                                ///< direction of increasing power (1/PWM_DITHER_STEPS counts)
+
+    /** Global MPPT scan to find the global maximum of the P-V curve, e.g. under partial shading
+     *
+     * The scan starts at the open circuit voltage of the input port (min. output power) and
+     * increases the duty cycle by mppt_scan_step per control cycle until the input voltage
+     * reaches the minimum (src_voltage_start) or DCDC_SCAN_POINTS_MAX points were recorded.
+     * Afterwards the duty cycle jumps to the point with maximum power and the local MPPT
+     * strategy takes over again.
+     *
+     * @param in Input port
+     * @param out Output port
+     * @param step Duty cycle step in direction of increasing output power (if scan active)
+     *
+     * @returns true if scan is active and step was set
+     */
+    bool mppt_scan(PowerPort *in, PowerPort *out, int *step);
+
+    int scan_index;             ///< Index of next scan point, -1 if no scan active
+
+    /** MPPT strategy selected by mppt_algorithm
+     *
+     * All strategies have the same interface: they get the input and output port (depending
+     * on buck or boost mode) and return the duty cycle step in timer counts in direction of
+     * increasing output power, i.e. positive steps draw more current from the input port.
+     *
+     * @param in Input port (e.g. solar panel in buck mode)
+     * @param out Output port (e.g. battery in buck mode)
+     *
+     * @returns step in direction of increasing output power (never 0)
+     */
+    int mppt_step(PowerPort *in, PowerPort *out);
+
+    /** Perturb and observe MPPT with fixed step size of one timer count
+     */
+    int mppt_perturb_observe(PowerPort *in, PowerPort *out);
+
+    /** Perturb and observe MPPT with variable step size
+     *
+     * The step size is proportional to the slope |dP/dD| of the power curve, so that the MPP is
+     * approached quickly if far away and tracked with fine steps close to it (between
+     * mppt_step_min and mppt_step_max timer counts).
+     */
+    int mppt_perturb_observe_adaptive(PowerPort *in, PowerPort *out);
+
+    /** Incremental conductance MPPT
+     *
+     * Compares the incremental conductance dI/dV with the negative conductance -I/V of the input
+     * port, which are equal at the MPP. In contrast to perturb and observe, the direction is also
+     * correct if the irradiance changes between two steps.
+     */
+    int mppt_incremental_conductance(PowerPort *in, PowerPort *out);
 };
 
 #endif /* DCDC_H */
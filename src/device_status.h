@@ -27,6 +27,7 @@
 #include "power_port.h"
 #include "load.h"
 #include "dcdc.h"
+#include "adc_capture.h"
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -172,7 +173,14 @@ public:
      * @brief sets one or more error flags in device state
      * @param e a single ErrorFlag or "bitwise ORed" ERR_XXX | ERR_YYY
      */
-    void set_error(uint32_t e) { error_flags |= e; }
+    void set_error(uint32_t e)
+    {
+        if ((error_flags & e) != e) {
+            // new error: freeze raw ADC data for later analysis
+            adc_capture_trigger(e & ~error_flags);
+        }
+        error_flags |= e;
+    }
 
     /**
      * @brief clears one or more error flags in device state
@@ -17,15 +17,36 @@
 #include "pcb.h"
 #include "thingset.h"
 #include "eeprom.h"
+#include "efficiency_map.h"
 #include <inttypes.h>
+#include <string.h>
 #include <time.h>
 
 // versioning of EEPROM layout (2 bytes)
 // change the version number each time the data object array below is changed!
-#define EEPROM_VERSION 3
+#define EEPROM_VERSION 6
+
+// versioning of calibration data layout, independent of EEPROM_VERSION so that calibration
+// survives changes of the configuration data objects
+#define EEPROM_CAL_VERSION 1
+
+// versioning of DC/DC control settings (MPPT and regulation loops)
+#define EEPROM_DCDC_VERSION 5
+
+// versioning of DC/DC efficiency map (raw binary data instead of ThingSet data objects)
+#define EEPROM_EFF_MAP_VERSION 1
+
+// versioning of custom battery OCV curve
+#define EEPROM_OCV_VERSION 1
 
 #define EEPROM_HEADER_SIZE 8    // bytes
 
+#define EEPROM_DATA_ADDR    0       // max. 300 bytes incl. header
+#define EEPROM_CAL_ADDR     320     // aligned to 32 byte pages of 24AA32
+#define EEPROM_DCDC_ADDR    480     // max. 160 bytes calibration data before this address
+#define EEPROM_EFF_MAP_ADDR 640     // max. 160 bytes DC/DC settings before this address
+#define EEPROM_OCV_ADDR     1056    // max. 416 bytes efficiency map before this address
+
 #define EEPROM_UPDATE_INTERVAL  (6*60*60)       // update every 6 hours
 
 extern ThingSet ts;
@@ -43,6 +64,31 @@ const uint16_t eeprom_data_objects[] = {
     0xA6 // day count
 };
 
+// stores object-ids of sensor calibration values (written by maker only)
+const uint16_t eeprom_cal_objects[] = {
+    0x100, 0x101, 0x102, 0x103,     // battery voltage
+    0x104, 0x105, 0x106, 0x107,     // solar voltage
+    0x108, 0x109, 0x10A, 0x10B,     // load current
+    0x10C, 0x10D, 0x10E, 0x10F      // solar / dcdc current
+};
+
+// stores object-ids of custom battery OCV curve (separate region, as main region is full)
+const uint16_t eeprom_ocv_objects[] = {
+    0x120, 0x121, 0x122, 0x123, 0x124, 0x125, 0x126, 0x127, 0x128, 0x129, 0x12A
+};
+
+#if FEATURE_DCDC_CONVERTER
+// stores object-ids of DC/DC control settings (separate region, as main region is full)
+const uint16_t eeprom_dcdc_objects[] = {
+    0x48, 0x49, 0x4A, 0x4B, 0x4C, 0x4D, 0x4E,  // MPPT settings
+    0x110, 0x111, 0x112, 0x113,     // CV/CC control loop gains
+    0x114, 0x115,                   // light-load mode
+    0x116,                          // diode emulation
+    0x117, 0x118, 0x119, 0x11A, 0x11B,  // dead time tuning
+    0x11C                           // soft start
+};
+#endif
+
 #ifndef UNIT_TEST
 
 uint32_t _calc_crc(uint8_t *buf, size_t len)
@@ -203,21 +249,31 @@ int eeprom_read (unsigned int addr, uint8_t* ret, int len)
 
 #if (defined(PIN_EEPROM_SDA) && defined(PIN_EEPROM_SCL)) || defined(STM32L0)
 
-// EEPROM layout:
+// EEPROM layout (per region):
 // bytes 0-1: Version number
 // bytes 2-3: number of data bytes
 // bytes 4-7: CRC32
 // byte 8: start of data
-
-void eeprom_restore_data()
+//
+// Regions:
+// EEPROM_DATA_ADDR: charge controller data objects (eeprom_data_objects)
+// EEPROM_CAL_ADDR: sensor calibration (eeprom_cal_objects)
+// EEPROM_DCDC_ADDR: DC/DC control settings (eeprom_dcdc_objects)
+// EEPROM_OCV_ADDR: custom battery OCV curve (eeprom_ocv_objects)
+
+/** Restores data objects stored in the EEPROM region starting at addr
+ *
+ * @returns true if data was valid and restored
+ */
+static bool _restore_region(unsigned int addr, uint16_t expected_version)
 {
     uint8_t buf_req[300];  // ThingSet request buffer
 
     // EEPROM header
     uint8_t buf_header[EEPROM_HEADER_SIZE];
-    if (eeprom_read(0, buf_header, EEPROM_HEADER_SIZE) < 0) {
+    if (eeprom_read(addr, buf_header, EEPROM_HEADER_SIZE) < 0) {
         printf("EEPROM: read error!\n");
-        return;
+        return false;
     }
     uint16_t version = *((uint16_t*)&buf_header[0]);
     uint16_t len     = *((uint16_t*)&buf_header[2]);
@@ -228,8 +284,8 @@ void eeprom_restore_data()
     //    buf_header[0], buf_header[1], buf_header[2], buf_header[3],
     //    buf_header[4], buf_header[5], buf_header[6], buf_header[7]);
 
-    if (version == EEPROM_VERSION && len <= sizeof(buf_req)) {
-        eeprom_read(EEPROM_HEADER_SIZE, buf_req, len);
+    if (version == expected_version && len <= sizeof(buf_req)) {
+        eeprom_read(addr + EEPROM_HEADER_SIZE, buf_req, len);
 
         //printf("Data (len=%d): ", len);
         //for (int i = 0; i < len; i++) printf("%.2x ", buf_req[i]);
@@ -237,6 +293,7 @@ void eeprom_restore_data()
         if (_calc_crc(buf_req, len) == crc) {
             int status = ts.init_cbor(buf_req, sizeof(buf_req));     // first byte is ignored
             printf("EEPROM: Data objects read and updated, ThingSet result: %d\n", status);
+            return true;
         }
         else {
             printf("EEPROM: CRC of data not correct, expected 0x%x (data_len = %d)\n", (unsigned int)crc, len);
@@ -245,17 +302,20 @@ void eeprom_restore_data()
     else {
         printf("EEPROM: Empty or data layout version changed\n");
     }
+    return false;
 }
 
-void eeprom_store_data()
+/** Stores data objects given by ids in the EEPROM region starting at addr
+ */
+static void _store_region(unsigned int addr, uint16_t version, const uint16_t *ids, size_t num_ids)
 {
     uint8_t buf[300];
 
-    int len = ts.pub_msg_cbor(buf + EEPROM_HEADER_SIZE, sizeof(buf) - EEPROM_HEADER_SIZE, eeprom_data_objects, sizeof(eeprom_data_objects)/sizeof(uint16_t));
+    int len = ts.pub_msg_cbor(buf + EEPROM_HEADER_SIZE, sizeof(buf) - EEPROM_HEADER_SIZE, ids, num_ids);
     uint32_t crc = _calc_crc(buf + EEPROM_HEADER_SIZE, len);
 
-    // store EEPROM_VERSION, number of bytes and CRC
-    *((uint16_t*)&buf[0]) = (uint16_t)EEPROM_VERSION;
+    // store version, number of bytes and CRC
+    *((uint16_t*)&buf[0]) = version;
     *((uint16_t*)&buf[2]) = (uint16_t)(len);   // length of data
     *((uint32_t*)&buf[4]) = crc;
 
@@ -268,7 +328,7 @@ void eeprom_store_data()
     if (len == 0) {
         printf("EEPROM: Data could not be stored, ThingSet error: %d\n", len);
     }
-    else if (eeprom_write(0, buf, len + EEPROM_HEADER_SIZE) < 0) {
+    else if (eeprom_write(addr, buf, len + EEPROM_HEADER_SIZE) < 0) {
         printf("EEPROM: Write error.\n");
     }
     else {
@@ -276,10 +336,103 @@ void eeprom_store_data()
     }
 }
 
+#if FEATURE_DCDC_CONVERTER
+
+/** Restores raw binary data from the EEPROM region starting at addr
+ *
+ * @returns true if data was valid and restored
+ */
+static bool _restore_raw(unsigned int addr, uint16_t expected_version, uint8_t *data, size_t size)
+{
+    uint8_t buf_header[EEPROM_HEADER_SIZE];
+    if (eeprom_read(addr, buf_header, EEPROM_HEADER_SIZE) < 0) {
+        printf("EEPROM: read error!\n");
+        return false;
+    }
+    uint16_t version = *((uint16_t*)&buf_header[0]);
+    uint16_t len     = *((uint16_t*)&buf_header[2]);
+    uint32_t crc     = *((uint32_t*)&buf_header[4]);
+
+    if (version == expected_version && len == size) {
+        eeprom_read(addr + EEPROM_HEADER_SIZE, data, len);
+        if (_calc_crc(data, len) == crc) {
+            return true;
+        }
+        memset(data, 0, size);      // discard invalid data
+        printf("EEPROM: CRC of raw data not correct\n");
+    }
+    return false;
+}
+
+static_assert(sizeof(eff_map) + EEPROM_HEADER_SIZE <= EEPROM_OCV_ADDR - EEPROM_EFF_MAP_ADDR,
+    "Efficiency map does not fit into its EEPROM region");
+
+/** Stores raw binary data in the EEPROM region starting at addr
+ *
+ * Header and data are written in one go starting at the page-aligned region address, as
+ * eeprom_write does not split the data at page boundaries if the start address is unaligned.
+ */
+static void _store_raw(unsigned int addr, uint16_t version, uint8_t *data, size_t size)
+{
+    uint8_t buf[EEPROM_OCV_ADDR - EEPROM_EFF_MAP_ADDR];
+
+    if (size > sizeof(buf) - EEPROM_HEADER_SIZE) {
+        printf("EEPROM: Data could not be stored, too large.\n");
+        return;
+    }
+
+    *((uint16_t*)&buf[0]) = version;
+    *((uint16_t*)&buf[2]) = (uint16_t)size;
+    *((uint32_t*)&buf[4]) = _calc_crc(data, size);
+    memcpy(buf + EEPROM_HEADER_SIZE, data, size);
+
+    if (eeprom_write(addr, buf, size + EEPROM_HEADER_SIZE) < 0) {
+        printf("EEPROM: Write error.\n");
+    }
+}
+
+#endif
+
+void eeprom_restore_data()
+{
+    _restore_region(EEPROM_DATA_ADDR, EEPROM_VERSION);
+    _restore_region(EEPROM_OCV_ADDR, EEPROM_OCV_VERSION);
+#if FEATURE_DCDC_CONVERTER
+    _restore_region(EEPROM_DCDC_ADDR, EEPROM_DCDC_VERSION);
+    _restore_raw(EEPROM_EFF_MAP_ADDR, EEPROM_EFF_MAP_VERSION, (uint8_t *)&eff_map, sizeof(eff_map));
+#endif
+}
+
+void eeprom_store_data()
+{
+    _store_region(EEPROM_DATA_ADDR, EEPROM_VERSION, eeprom_data_objects,
+        sizeof(eeprom_data_objects)/sizeof(uint16_t));
+    _store_region(EEPROM_OCV_ADDR, EEPROM_OCV_VERSION, eeprom_ocv_objects,
+        sizeof(eeprom_ocv_objects)/sizeof(uint16_t));
+#if FEATURE_DCDC_CONVERTER
+    _store_region(EEPROM_DCDC_ADDR, EEPROM_DCDC_VERSION, eeprom_dcdc_objects,
+        sizeof(eeprom_dcdc_objects)/sizeof(uint16_t));
+    _store_raw(EEPROM_EFF_MAP_ADDR, EEPROM_EFF_MAP_VERSION, (uint8_t *)&eff_map, sizeof(eff_map));
+#endif
+}
+
+bool eeprom_restore_calibration()
+{
+    return _restore_region(EEPROM_CAL_ADDR, EEPROM_CAL_VERSION);
+}
+
+void eeprom_store_calibration()
+{
+    _store_region(EEPROM_CAL_ADDR, EEPROM_CAL_VERSION, eeprom_cal_objects,
+        sizeof(eeprom_cal_objects)/sizeof(uint16_t));
+}
+
 #else
 
 void eeprom_store_data() {;}
 void eeprom_restore_data() {;}
+void eeprom_store_calibration() {;}
+bool eeprom_restore_calibration() { return false; }
 
 #endif
 
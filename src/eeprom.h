@@ -42,6 +42,16 @@ void eeprom_store_data();
  */
 void eeprom_restore_data();
 
+/** Store sensor calibration to separate EEPROM region
+ */
+void eeprom_store_calibration();
+
+/** Restore sensor calibration from EEPROM and write to variables in RAM
+ *
+ * @returns true if valid calibration data was found
+ */
+bool eeprom_restore_calibration();
+
 /** Stores data to EEPROM every 6 hours (can be called regularly)
  */
 void eeprom_update();
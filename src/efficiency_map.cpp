@@ -0,0 +1,91 @@
+/* LibreSolar charge controller firmware
+ * Copyright (c) 2016-2019 Martin Jäger (www.libre.solar)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "efficiency_map.h"
+
+#include <stdio.h>
+#include <string.h>
+
+EffMap eff_map;
+
+// efficiencies above this value can only be caused by measurement errors (0.01 %)
+#define EFF_MAP_EFFICIENCY_MAX  12000
+
+static int eff_map_bin(float ratio, int num_bins)
+{
+    int bin = ratio * num_bins;
+    if (bin < 0) {
+        return 0;
+    }
+    else if (bin >= num_bins) {
+        return num_bins - 1;
+    }
+    return bin;
+}
+
+void eff_map_update(float voltage_ratio, float current_ratio, float efficiency)
+{
+    int r = eff_map_bin(voltage_ratio, EFF_MAP_RATIO_BINS);
+    int c = eff_map_bin(current_ratio, EFF_MAP_CURRENT_BINS);
+
+    int eff = efficiency * 10000 + 0.5f;
+    if (eff < 0) {
+        eff = 0;
+    }
+    else if (eff > EFF_MAP_EFFICIENCY_MAX) {
+        eff = EFF_MAP_EFFICIENCY_MAX;
+    }
+
+    if (eff_map.count[r][c] >= EFF_MAP_COUNT_MAX) {
+        eff_map.sum[r][c] >>= 1;
+        eff_map.count[r][c] >>= 1;
+    }
+    eff_map.sum[r][c] += eff;
+    eff_map.count[r][c]++;
+}
+
+int eff_map_get(float voltage_ratio, float current_ratio)
+{
+    int r = eff_map_bin(voltage_ratio, EFF_MAP_RATIO_BINS);
+    int c = eff_map_bin(current_ratio, EFF_MAP_CURRENT_BINS);
+
+    if (eff_map.count[r][c] < EFF_MAP_SAMPLES_MIN) {
+        return -1;
+    }
+    return eff_map.sum[r][c] / eff_map.count[r][c];
+}
+
+void eff_map_reset()
+{
+    memset(&eff_map, 0, sizeof(eff_map));
+}
+
+void eff_map_dump()
+{
+    printf("# Efficiency map (%%), rows: V_lv/V_hv bins, columns: I/I_max bins\n");
+    for (int r = 0; r < EFF_MAP_RATIO_BINS; r++) {
+        for (int c = 0; c < EFF_MAP_CURRENT_BINS; c++) {
+            if (eff_map.count[r][c] < EFF_MAP_SAMPLES_MIN) {
+                printf(c == 0 ? "-" : ",-");
+            }
+            else {
+                unsigned int eff = eff_map.sum[r][c] / eff_map.count[r][c];
+                printf(c == 0 ? "%u.%02u" : ",%u.%02u", eff / 100, eff % 100);
+            }
+        }
+        printf("\n");
+    }
+}
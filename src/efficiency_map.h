@@ -0,0 +1,81 @@
+/* LibreSolar charge controller firmware
+ * Copyright (c) 2016-2019 Martin Jäger (www.libre.solar)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EFFICIENCY_MAP_H
+#define EFFICIENCY_MAP_H
+
+/** @file
+ *
+ * @brief Online map of the DC/DC conversion efficiency per operating point
+ *
+ * The efficiency is accumulated in a 2-D histogram binned by the voltage ratio V_lv / V_hv
+ * (approx. the duty cycle in buck mode) and the inductor current relative to its maximum.
+ * Each update only changes a single bin (O(1) time, no floating point division). When the
+ * number of samples of a bin reaches EFF_MAP_COUNT_MAX, sum and count are halved, so that
+ * older samples are gradually forgotten and changes like degrading MOSFETs or inductors
+ * become visible.
+ *
+ * The map is stored in its own EEPROM region in raw binary form and can be printed via
+ * ThingSet.
+ */
+
+#include <stdint.h>
+
+#define EFF_MAP_RATIO_BINS      8       ///< Bins of the voltage ratio V_lv / V_hv (0 to 1)
+#define EFF_MAP_CURRENT_BINS    8       ///< Bins of the relative inductor current (0 to 1)
+
+/** Number of samples after which sum and count of a bin are halved
+ */
+#define EFF_MAP_COUNT_MAX       32768
+
+/** Min. number of samples of a bin to get a valid efficiency
+ */
+#define EFF_MAP_SAMPLES_MIN     10
+
+/** Efficiency map data (layout is stored directly in the EEPROM)
+ */
+typedef struct {
+    uint32_t sum[EFF_MAP_RATIO_BINS][EFF_MAP_CURRENT_BINS];     ///< Sum of efficiencies (0.01 %)
+    uint16_t count[EFF_MAP_RATIO_BINS][EFF_MAP_CURRENT_BINS];   ///< Number of samples
+} EffMap;
+
+extern EffMap eff_map;
+
+/** Adds an efficiency sample to the bin of the given operating point
+ *
+ * Values outside the range of the map are assigned to the outer bins.
+ *
+ * @param voltage_ratio Ratio of low side and high side voltage (0 to 1)
+ * @param current_ratio Inductor current relative to max. current (0 to 1)
+ * @param efficiency Conversion efficiency (output power / input power)
+ */
+void eff_map_update(float voltage_ratio, float current_ratio, float efficiency);
+
+/** Mean efficiency of the bin of the given operating point
+ *
+ * @returns efficiency in 0.01 % or -1 if the bin has less than EFF_MAP_SAMPLES_MIN samples
+ */
+int eff_map_get(float voltage_ratio, float current_ratio);
+
+/** Deletes all samples (e.g. after replacement of power components)
+ */
+void eff_map_reset();
+
+/** Prints the map as CSV to the serial interface (efficiency in %, empty bins as -)
+ */
+void eff_map_dump();
+
+#endif /* EFFICIENCY_MAP_H */
@@ -20,8 +20,20 @@
 /** @file
  *
  * @brief PWM timer functions for half bridge of DC/DC converter
+ *
+ * The timer resolution is only approx. 170 counts at 70 kHz switching frequency and 24 MHz
+ * system clock. The duty cycle is internally stored with PWM_DITHER_BITS additional bits and
+ * the remaining fraction of a timer count is spread across PWM_DITHER_STEPS timer update events
+ * (sigma-delta pattern written to the CCR register by DMA). This increases the effective
+ * resolution without lowering the switching frequency.
  */
 
+#ifndef PWM_DITHER_BITS
+#define PWM_DITHER_BITS 4       // 16x higher effective resolution
+#endif
+
+#define PWM_DITHER_STEPS (1 << PWM_DITHER_BITS)
+
 /** Initiatializes the registers to generate the PWM signal and sets duty
  *  cycle limits
  *
@@ -42,6 +54,37 @@ void half_bridge_start(float pwm_duty);
  */
 void half_bridge_stop();
 
+/** Change the dead time between switching the two MOSFETs
+ *
+ * The caller is responsible for keeping the dead time within safe bounds.
+ *
+ * @param deadtime_ns Dead time in ns (rounded to timer clocks)
+ */
+void half_bridge_set_deadtime(int deadtime_ns);
+
+/** Get the actual dead time
+ *
+ * @returns Dead time in ns
+ */
+int half_bridge_get_deadtime();
+
+/** Enable or disable synchronous rectification
+ *
+ * If disabled, the low-side MOSFET is kept off and only its body diode conducts during the
+ * off-time of the high-side MOSFET (diode emulation). This prevents negative inductor current
+ * at light load in buck mode, but must not be used in boost mode, as the low-side MOSFET is the
+ * active switch.
+ *
+ * @param sync True for synchronous (complementary) operation of both MOSFETs
+ */
+void half_bridge_set_sync_rectification(bool sync);
+
+/** Get status of synchronous rectification
+ *
+ * @returns True if low-side MOSFET is driven complementary to the high-side MOSFET
+ */
+bool half_bridge_sync_rectification();
+
 /** Get status of the PWM output
  *
  * @returns True if PWM output enabled
@@ -54,12 +97,41 @@ bool half_bridge_enabled();
  */
 void half_bridge_set_duty_cycle(float duty);
 
-/** Adjust the duty cycle with minimum step size
+/** Adjust the duty cycle by full timer counts
  *
- * @param delta Number of steps (positive or negative)
+ * @param delta Number of timer counts (positive or negative)
  */
 void half_bridge_duty_cycle_step(int delta);
 
+/** Adjust the duty cycle with minimum step size (dither resolution)
+ *
+ * @param delta Number of steps of 1/PWM_DITHER_STEPS timer counts (positive or negative)
+ */
+void half_bridge_duty_cycle_step_fine(int delta);
+
+/** Calculate the sigma-delta pattern of CCR values for one dither cycle
+ *
+ * @param duty Duty cycle in 1/PWM_DITHER_STEPS timer counts
+ * @param pattern Array of PWM_DITHER_STEPS CCR values to be filled
+ */
+void half_bridge_dither_pattern(int32_t duty, uint16_t *pattern);
+
+/** Reduce the switching frequency, e.g. to decrease switching losses at light load
+ *
+ * The duty cycle ratio and its limits are kept, so the transition is smooth. The new period is
+ * applied at the next timer update event. The divider is limited so that the period still fits
+ * into the 16-bit timer register.
+ *
+ * @param divider Divider of the switching frequency set in half_bridge_init (1 = full frequency)
+ */
+void half_bridge_set_frequency_divider(int divider);
+
+/** Get the divider of the switching frequency
+ *
+ * @returns Divider (1 = full frequency as set in half_bridge_init)
+ */
+int half_bridge_get_frequency_divider();
+
 /** Read the currently set duty cycle
  *
  * @returns Duty cycle between 0.0 and 1.0
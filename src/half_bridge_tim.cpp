@@ -22,12 +22,18 @@
 
 
 static int _pwm_resolution;
-static float _min_duty;
-static float _max_duty;
+static int _freq_divider;
+static int32_t _min_duty;           // in 1/PWM_DITHER_STEPS timer counts
+static int32_t _max_duty;           // in 1/PWM_DITHER_STEPS timer counts
+static int32_t _duty;               // in 1/PWM_DITHER_STEPS timer counts
 static uint8_t _deadtime_clocks;
 
+// CCR values of one dither cycle, written to the CCR register by DMA at each timer update event
+static uint16_t _dither_pattern[PWM_DITHER_STEPS];
+
 
 static bool _enabled;
+static bool _sync_rectification = true;
 
 #ifndef UNIT_TEST
 
@@ -89,6 +95,9 @@ class PWM_TIM3
         // Auto Reload Register
         // center-aligned mode --> resolution is double
         TIM3->ARR = pwm_resolution;
+
+        // ARR preload enable: frequency changes are applied at the next update event
+        TIM3->CR1 |= TIM_CR1_ARPE;
     }
 
     static void start()
@@ -99,11 +108,33 @@ class PWM_TIM3
         // CCxNE = 1: Enable the output on OC1N
         // CCxNP = 0: Active high polarity on OC1N (default)
         TIM3->CCER |= TIM_CCER_CC3E;
+        ls_enable(_sync_rectification);
         TIM3->CCER |= TIM_CCER_CC4E;
     }
 
+    /** Low-side output may only be enabled if the high-side output is running as well, as the
+     *  low-side MOSFET must never be switched on alone
+     *
+     *  The output stays enabled (CC4E = 1) if the low-side MOSFET is kept off, so that the pin
+     *  is actively driven low instead of floating.
+     */
+    static void ls_enable(bool enable)
+    {
+        // OC4M = 110: PWM mode 1
+        // OC4M = 101: Force active level on OC4REF, i.e. low output level because of the
+        //             inverted polarity of the low-side channel (CC4P = 1)
+        uint32_t ccmr2 = TIM3->CCMR2 & ~(TIM_CCMR2_OC4M);
+        if (enable && (TIM3->CCER & TIM_CCER_CC3E)) {
+            TIM3->CCMR2 = ccmr2 | TIM_CCMR2_OC4M_2 | TIM_CCMR2_OC4M_1;
+        }
+        else {
+            TIM3->CCMR2 = ccmr2 | TIM_CCMR2_OC4M_2 | TIM_CCMR2_OC4M_0;
+        }
+    }
+
     static void stop()
     {
+        ls_enable(false);
         TIM3->CCER &= ~(TIM_CCER_CC3E);
         TIM3->CCER &= ~(TIM_CCER_CC4E);
     }
@@ -118,6 +149,60 @@ class PWM_TIM3
         TIM3->CCR3 = val;                    // high-side
         TIM3->CCR4 = val + _deadtime_clocks; // low-side
     }
+
+    static void set_resolution(uint32_t pwm_resolution)
+    {
+        TIM3->ARR = pwm_resolution;
+    }
+
+    static void update_disable(bool disable)
+    {
+        // UDIS = 1: no transfer of preloaded ARR and CCR values
+        if (disable) {
+            TIM3->CR1 |= TIM_CR1_UDIS;
+        }
+        else {
+            TIM3->CR1 &= ~(TIM_CR1_UDIS);
+        }
+    }
+
+    static void set_deadtime(uint8_t deadtime_clocks)
+    {
+        // low-side CCR is updated with the next duty cycle setting
+    }
+
+    static void _init_dither()
+    {
+        // TIM3_UP request is mapped to DMA channel 3
+        RCC->AHBENR |= RCC_AHBENR_DMA1EN;
+#if defined(STM32L0)
+        DMA1_CSELR->CSELR = (DMA1_CSELR->CSELR & ~DMA_CSELR_C3S) | (10 << DMA_CSELR_C3S_Pos);
+#endif
+        DMA1_Channel3->CPAR = (uint32_t)(&(TIM3->CCR3));
+        DMA1_Channel3->CMAR = (uint32_t)(&(_dither_pattern[0]));
+        DMA1_Channel3->CNDTR = PWM_DITHER_STEPS;
+        DMA1_Channel3->CCR =
+            DMA_CCR_MINC |          // memory increment mode enabled
+            DMA_CCR_MSIZE_0 |       // memory size 16-bit
+            DMA_CCR_PSIZE_0 |       // peripheral size 16-bit
+            DMA_CCR_CIRC |          // circular mode enable
+            DMA_CCR_DIR;            // read from memory
+
+        // DMA request at each update event (overflow and underflow in center-aligned mode)
+        TIM3->DIER |= TIM_DIER_UDE;
+    }
+
+    /** Only the high-side CCR is dithered by DMA. The low-side CCR is set according to the
+     *  highest CCR value of the pattern, so the deadtime is never shorter than configured.
+     */
+    static void set_dither(uint32_t ccr_max)
+    {
+        DMA1_Channel3->CCR &= ~(DMA_CCR_EN);    // no DMA access while pattern is changed
+        TIM3->CCR3 = _dither_pattern[0];        // high-side
+        TIM3->CCR4 = ccr_max + _deadtime_clocks; // low-side
+        DMA1_Channel3->CNDTR = PWM_DITHER_STEPS;
+        DMA1_Channel3->CCR |= DMA_CCR_EN;
+    }
 };
 
 #if defined(STM32F0)
@@ -171,24 +256,49 @@ class PWM_TIM1
         // center-aligned mode --> frequency is half the pwm_resolution;
         TIM1->ARR = pwm_resolution;
 
+        // ARR preload enable: frequency changes are applied at the next update event
+        TIM1->CR1 |= TIM_CR1_ARPE;
+
         // Break and Dead-Time Register
         // MOE  = 1: Main output enable
-        // OSSR = 0: Off-state selection for Run mode -> OC/OCN = 0
+        // OSSR = 1: Off-state selection for Run mode -> disabled OC/OCN driven to inactive level
+        //           (low-side kept off in diode emulation mode instead of floating)
         // OSSI = 0: Off-state selection for Idle mode -> OC/OCN = 0
+        TIM1->BDTR |= TIM_BDTR_OSSR;
         TIM1->BDTR |= (_deadtime_clocks & (uint32_t)0x7F); // ensure that only the last 7 bits are changed
 
         // Lock Break and Dead-Time Register
         // TODO: does not work properly... maybe HW bug?
-        TIM1->BDTR |= TIM_BDTR_LOCK_1 | TIM_BDTR_LOCK_0;
+        // Not possible with online dead time tuning, as any lock level also locks the DTG bits
+        //TIM1->BDTR |= TIM_BDTR_LOCK_1 | TIM_BDTR_LOCK_0;
+    }
+
+    static void set_deadtime(uint8_t deadtime_clocks)
+    {
+        TIM1->BDTR = (TIM1->BDTR & ~(TIM_BDTR_DTG)) | (deadtime_clocks & (uint32_t)0x7F);
     }
 
     static void start()
     {
         // Break and Dead-Time Register
         // MOE  = 1: Main output enable
+        ls_enable(_sync_rectification);
         TIM1->BDTR |= TIM_BDTR_MOE;
     }
 
+    static void ls_enable(bool enable)
+    {
+        // CC1NE = 0: complementary output (low-side) disabled and driven to inactive level
+        // (OSSR = 1), no dead time is inserted anymore for the high-side output, which is fine
+        // as the low-side MOSFET stays off
+        if (enable) {
+            TIM1->CCER |= TIM_CCER_CC1NE;
+        }
+        else {
+            TIM1->CCER &= ~(TIM_CCER_CC1NE);
+        }
+    }
+
     static void stop()
     {
         // Break and Dead-Time Register
@@ -205,6 +315,50 @@ class PWM_TIM1
     {
         TIM1->CCR1 = val;
     }
+
+    static void set_resolution(uint32_t pwm_resolution)
+    {
+        TIM1->ARR = pwm_resolution;
+    }
+
+    static void update_disable(bool disable)
+    {
+        // UDIS = 1: no transfer of preloaded ARR and CCR values
+        if (disable) {
+            TIM1->CR1 |= TIM_CR1_UDIS;
+        }
+        else {
+            TIM1->CR1 &= ~(TIM_CR1_UDIS);
+        }
+    }
+
+    static void _init_dither()
+    {
+        // TIM1_UP request is mapped to DMA channel 5
+        RCC->AHBENR |= RCC_AHBENR_DMA1EN;
+        DMA1_Channel5->CPAR = (uint32_t)(&(TIM1->CCR1));
+        DMA1_Channel5->CMAR = (uint32_t)(&(_dither_pattern[0]));
+        DMA1_Channel5->CNDTR = PWM_DITHER_STEPS;
+        DMA1_Channel5->CCR =
+            DMA_CCR_MINC |          // memory increment mode enabled
+            DMA_CCR_MSIZE_0 |       // memory size 16-bit
+            DMA_CCR_PSIZE_0 |       // peripheral size 16-bit
+            DMA_CCR_CIRC |          // circular mode enable
+            DMA_CCR_DIR;            // read from memory
+
+        // DMA request at each update event (overflow and underflow in center-aligned mode)
+        TIM1->DIER |= TIM_DIER_UDE;
+    }
+
+    /** Deadtime is inserted by the timer hardware for complementary outputs
+     */
+    static void set_dither(uint32_t ccr_max)
+    {
+        DMA1_Channel5->CCR &= ~(DMA_CCR_EN);    // no DMA access while pattern is changed
+        TIM1->CCR1 = _dither_pattern[0];
+        DMA1_Channel5->CNDTR = PWM_DITHER_STEPS;
+        DMA1_Channel5->CCR |= DMA_CCR_EN;
+    }
 };
 #endif
 
@@ -214,6 +368,11 @@ typedef PWM_TIM1 PWM_TIM_HW;
 typedef PWM_TIM3 PWM_TIM_HW;
 #endif
 
+// duty cycle may be changed from the fast control tier (ADC DMA ISR) and the control timer ISR,
+// so read-modify-write sequences must not be interrupted (nesting-safe, restores PRIMASK)
+#define HALF_BRIDGE_CRITICAL_BEGIN()    core_util_critical_section_enter()
+#define HALF_BRIDGE_CRITICAL_END()      core_util_critical_section_exit()
+
 #else /* #ifndef UNIT_TEST */
 
 const uint32_t SystemCoreClock = 24000000;
@@ -240,6 +399,10 @@ class PWM_UT
         m_started = false;
     }
 
+    static void ls_enable(bool enable)
+    {
+    }
+
     static int32_t get_ccr()
     {
         return m_ccr;
@@ -249,6 +412,28 @@ class PWM_UT
     {
         m_ccr = val;                    // high-side
     }
+
+    static void set_resolution(uint32_t pwm_resolution)
+    {
+        m_pwm_resolution = pwm_resolution;
+    }
+
+    static void update_disable(bool disable)
+    {
+    }
+
+    static void set_deadtime(uint8_t deadtime_clocks)
+    {
+    }
+
+    static void _init_dither()
+    {
+    }
+
+    static void set_dither(uint32_t ccr_max)
+    {
+        m_ccr = _dither_pattern[0];
+    }
 };
 
 uint32_t PWM_UT::m_pwm_resolution = 0;
@@ -257,6 +442,9 @@ uint32_t PWM_UT::m_ccr = 0;
 
 typedef PWM_UT PWM_TIM_HW;
 
+#define HALF_BRIDGE_CRITICAL_BEGIN()
+#define HALF_BRIDGE_CRITICAL_END()
+
 #endif /* UNIT_TEST */
 
 void half_bridge_init(int freq_kHz, int deadtime_ns, float min_duty, float max_duty)
@@ -270,20 +458,47 @@ void half_bridge_init(int freq_kHz, int deadtime_ns, float min_duty, float max_d
     // although the C operator precedence does the "right thing" to allow deadtime_ns < 1000 to 
     // be handled nicely, parentheses make this more explicit 
     _deadtime_clocks = ((SystemCoreClock / (1000000)) * deadtime_ns) / 1000;
+    if (_deadtime_clocks > 0x7F) {
+        _deadtime_clocks = 0x7F;
+    }
 
     PWM_TIM_HW::_init_registers(_pwm_resolution);
    // set PWM frequency and resolution (in fact half the resolution)
 
+    _freq_divider = 1;
+    _min_duty = min_duty * _pwm_resolution * PWM_DITHER_STEPS;
+    _max_duty = max_duty * _pwm_resolution * PWM_DITHER_STEPS;
 
-    _min_duty = min_duty * _pwm_resolution;
-    _max_duty = max_duty * _pwm_resolution;
+#if PWM_DITHER_BITS > 0
+    PWM_TIM_HW::_init_dither();
+#endif
 
     half_bridge_set_duty_cycle(max_duty);      // init with allowed value
 
     _enabled = false;
 }
 
-static void _half_bridge_set_duty_cycle(int duty_target)
+void half_bridge_dither_pattern(int32_t duty, uint16_t *pattern)
+{
+    uint32_t base = duty >> PWM_DITHER_BITS;
+    uint32_t fraction = duty & (PWM_DITHER_STEPS - 1);
+    uint32_t accumulator = 0;
+
+    // first-order sigma-delta modulation: the additional counts are spread evenly over the
+    // dither cycle, so that the resulting ripple has the highest possible frequency
+    for (int i = 0; i < PWM_DITHER_STEPS; i++) {
+        accumulator += fraction;
+        if (accumulator >= PWM_DITHER_STEPS) {
+            accumulator -= PWM_DITHER_STEPS;
+            pattern[i] = base + 1;
+        }
+        else {
+            pattern[i] = base;
+        }
+    }
+}
+
+static void _half_bridge_set_duty_cycle(int32_t duty_target)
 {
     // protection against wrong settings which could destroy the hardware
     if (duty_target < _min_duty) {
@@ -293,22 +508,76 @@ static void _half_bridge_set_duty_cycle(int duty_target)
         duty_target = _max_duty;
     }
 
-    PWM_TIM_HW::set_ccr(duty_target);
+    _duty = duty_target;
+
+#if PWM_DITHER_BITS > 0
+    half_bridge_dither_pattern(_duty, _dither_pattern);
+    PWM_TIM_HW::set_dither((_duty + PWM_DITHER_STEPS - 1) >> PWM_DITHER_BITS);
+#else
+    PWM_TIM_HW::set_ccr(_duty);
+#endif
 }
 
 void half_bridge_set_duty_cycle(float duty)
 {
-    _half_bridge_set_duty_cycle(_pwm_resolution * duty);
+    HALF_BRIDGE_CRITICAL_BEGIN();
+    _half_bridge_set_duty_cycle(_pwm_resolution * PWM_DITHER_STEPS * duty);
+    HALF_BRIDGE_CRITICAL_END();
 }
-#include <stdio.h>
+
 void half_bridge_duty_cycle_step(int delta)
 {
-    _half_bridge_set_duty_cycle(PWM_TIM_HW::get_ccr() + delta);
+    HALF_BRIDGE_CRITICAL_BEGIN();
+    _half_bridge_set_duty_cycle(_duty + delta * PWM_DITHER_STEPS);
+    HALF_BRIDGE_CRITICAL_END();
+}
+
+void half_bridge_duty_cycle_step_fine(int delta)
+{
+    HALF_BRIDGE_CRITICAL_BEGIN();
+    _half_bridge_set_duty_cycle(_duty + delta);
+    HALF_BRIDGE_CRITICAL_END();
+}
+
+void half_bridge_set_frequency_divider(int divider)
+{
+    // period of the 16-bit timer (ARR) must not overflow
+    int divider_max = 0xFFFF / (_pwm_resolution / _freq_divider);
+    if (divider > divider_max) {
+        divider = divider_max;
+    }
+
+    if (divider < 1 || divider == _freq_divider) {
+        return;
+    }
+
+    HALF_BRIDGE_CRITICAL_BEGIN();
+
+    // new period and duty cycle must be applied at the same update event
+    PWM_TIM_HW::update_disable(true);
+
+    _pwm_resolution = _pwm_resolution / _freq_divider * divider;
+    _min_duty = _min_duty / _freq_divider * divider;
+    _max_duty = _max_duty / _freq_divider * divider;
+    int32_t duty = _duty * divider / _freq_divider;     // same duty cycle ratio
+    _freq_divider = divider;
+
+    PWM_TIM_HW::set_resolution(_pwm_resolution);
+    _half_bridge_set_duty_cycle(duty);
+
+    PWM_TIM_HW::update_disable(false);
+
+    HALF_BRIDGE_CRITICAL_END();
+}
+
+int half_bridge_get_frequency_divider()
+{
+    return _freq_divider;
 }
 
 float half_bridge_get_duty_cycle()
 {
-    return (float)(PWM_TIM_HW::get_ccr()) / _pwm_resolution;
+    return (float)_duty / (_pwm_resolution * PWM_DITHER_STEPS);
 }
 
 void half_bridge_start(float pwm_duty)
@@ -325,6 +594,44 @@ void half_bridge_stop()
     _enabled = false;
 }
 
+void half_bridge_set_deadtime(int deadtime_ns)
+{
+    // rounded to the nearest timer clock, max. 7 bits of the TIM1 DTG register
+    int clocks = ((SystemCoreClock / 1000000) * deadtime_ns + 500) / 1000;
+    if (clocks < 1) {
+        clocks = 1;
+    }
+    else if (clocks > 0x7F) {
+        clocks = 0x7F;
+    }
+
+    HALF_BRIDGE_CRITICAL_BEGIN();
+    PWM_TIM_HW::update_disable(true);
+    _deadtime_clocks = clocks;
+    PWM_TIM_HW::set_deadtime(_deadtime_clocks);
+    _half_bridge_set_duty_cycle(_duty);
+    PWM_TIM_HW::update_disable(false);
+    HALF_BRIDGE_CRITICAL_END();
+}
+
+int half_bridge_get_deadtime()
+{
+    return _deadtime_clocks * 1000 / (SystemCoreClock / 1000000);
+}
+
+void half_bridge_set_sync_rectification(bool sync)
+{
+    _sync_rectification = sync;
+    if (_enabled) {
+        PWM_TIM_HW::ls_enable(sync);
+    }
+}
+
+bool half_bridge_sync_rectification()
+{
+    return _sync_rectification;
+}
+
 bool half_bridge_enabled()
 {
     return _enabled;
@@ -43,8 +43,9 @@ void control_timer_start(int freq_Hz)   // max. 10 kHz
     // Auto Reload Register sets interrupt frequency
     TIM16->ARR = 10000 / freq_Hz - 1;
 
-    // 1 = second-highest priority of STM32L0/F0
-    NVIC_SetPriority(TIM16_IRQn, 1);
+    // 3 = lowest priority of STM32L0/F0, so that the fast control tier in the ADC DMA
+    // interrupt (priority 2) can preempt the medium tier
+    NVIC_SetPriority(TIM16_IRQn, 3);
     NVIC_EnableIRQ(TIM16_IRQn);
 
     // Control Register 1
@@ -74,8 +75,9 @@ void control_timer_start(int freq_Hz)   // max. 10 kHz
     // Auto Reload Register sets interrupt frequency
     TIM7->ARR = 10000 / freq_Hz - 1;
 
-    // 1 = second-highest priority of STM32L0/F0
-    NVIC_SetPriority(TIM7_IRQn, 1);
+    // 3 = lowest priority of STM32L0/F0, so that the fast control tier in the ADC DMA
+    // interrupt (priority 2) can preempt the medium tier
+    NVIC_SetPriority(TIM7_IRQn, 3);
     NVIC_EnableIRQ(TIM7_IRQn);
 
     // Control Register 1
@@ -229,7 +231,6 @@ void hw_usb_out(bool enabled) {;}
 void init_watchdog(float timeout) {;}
 void feed_the_dog() {;}
 void control_timer_start(int freq_Hz) {;}
-void system_control() {;}
 void start_stm32_bootloader() {;}
 
 #endif /* UNIT_TEST */
@@ -40,9 +40,24 @@ void feed_the_dog();
 void control_timer_start(int freq_Hz);
 
 /** DC/DC or PWM control loop (implemented in main.cpp)
+ *
+ * Medium tier of the control functions, also triggers the slow tier once per second.
  */
 void system_control();
 
+/** Charger state machine and configuration updates (implemented in main.cpp)
+ *
+ * Slow tier of the control functions, called from the main loop. Does nothing unless
+ * triggered by system_control().
+ */
+void system_control_slow();
+
+/** Fast tier of the control functions, e.g. current limiting (implemented in main.cpp)
+ *
+ * Called from the ADC DMA interrupt after each processed block of conversion sequences.
+ */
+void system_control_fast();
+
 /** Reset device and start STM32 internal bootloader
  */
 void start_stm32_bootloader();
@@ -268,5 +268,6 @@ void leds_update_soc(int soc, bool load_off_low_soc)
 
 // dummy functions
 void leds_flicker(int led, int timeout) {}
+void leds_set_charging(bool enabled) {}
 
 #endif /* UNIT_TEST */
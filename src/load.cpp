@@ -126,7 +126,7 @@ static void short_circuit_comp_init()
 
 #ifdef PIN_I_LOAD_COMP
 
-extern "C" void ADC1_COMP_IRQHandler(void)
+void short_circuit_comp_isr()
 {
     // interrupt called because of COMP2?
     if (COMP2->CSR & COMP_CSR_COMP2VALUE) {
@@ -134,6 +134,7 @@ extern "C" void ADC1_COMP_IRQHandler(void)
         // is mainly used to indicate the failure.
         leds_flicker(LED_LOAD);
         short_circuit = true;
+        adc_capture_trigger(ERR_LOAD_SHORT_CIRCUIT);
     }
 
     // clear interrupt flag
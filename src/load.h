@@ -112,4 +112,11 @@ public:
     bool usb_enable;            ///< same for USB output
 };
 
+/** Short circuit comparator interrupt handler
+ *
+ * Called from ADC1_COMP_IRQHandler, as the comparator shares its interrupt vector with the ADC
+ * analog watchdog.
+ */
+void short_circuit_comp_isr();
+
 #endif /* LOAD_H */
@@ -14,14 +14,14 @@
  * limitations under the License.
  */
 
-#ifndef UNIT_TEST
-
 /** @file
  *
  * @brief Entry point of charge controller firmware
  */
 
+#ifndef UNIT_TEST
 #include "mbed.h"
+#endif
 
 #include "thingset.h"           // handles access to internal data via communication interfaces
 #include "pcb.h"                // hardware-specific settings
@@ -39,6 +39,11 @@
 #include "leds.h"               // LED switching using charlieplexing
 #include "device_status.h"                // log data (error memory, min/max measurements, etc.)
 #include "data_objects.h"       // for access to internal data via ThingSet
+#include "control_timing.h"     // execution time measurement of the control tiers
+#include "main.h"               // global variables of the charge controller
+
+#ifndef UNIT_TEST
+
 #include "thingset_serial.h"    // UART or USB serial communication
 #include "thingset_can.h"       // CAN bus communication
 
@@ -108,7 +113,7 @@ int main()
     // ADC, DMA and sensor calibration
     adc_setup();
     dma_setup();
-    adc_timer_start(1000);  // 1 kHz
+    adc_timer_start(ADC_SAMPLE_FREQUENCY);
     wait(0.5);      // wait for ADC to collect some measurement values
     update_measurements();
     calibrate_current_sensors();
@@ -145,6 +150,8 @@ int main()
     time_t last_call = timestamp;
     while (1) {
 
+        system_control_slow();
+
         ts_interfaces.process_asap();
         uext.process_asap();
 
@@ -153,22 +160,13 @@ int main()
 
             //printf("Still alive... time: %d, mode: %d\n", (int)time(NULL), dcdc.mode);
 
-            charger.discharge_control(&bat_conf);
-            charger.charge_control(&bat_conf);
-
-            #if FEATURE_DCDC_CONVERTER
-            bat_terminal.pass_voltage_targets(&dcdc_lv_port);
-            #endif
-            #if FEATURE_PWM_SWITCH
-            bat_terminal.pass_voltage_targets(&pwm_port_int);
-            #endif
-
             load.state_machine();
 
             // update regularly to cover changed battery configurations
             adc_set_lv_alerts(bat_conf.voltage_absolute_max * charger.num_batteries,
                 bat_conf.voltage_absolute_min * charger.num_batteries);
 
+            data_objects_store_conf();
             eeprom_update();
 
             leds_update_1s();
@@ -184,17 +182,49 @@ int main()
     }
 }
 
+#else
+
+extern time_t timestamp;        // defined in test/main.cpp for unit tests
+
+#endif /* UNIT_TEST */
+
+/** Fast tier of the control functions: current limiting and protection
+ *
+ * Called from the ADC DMA interrupt (1 kHz by default), so only integer calculations based on
+ * the fast filtered ADC view are allowed here. Voltage alerts are already checked for each
+ * sample in adc_update_value().
+ */
+void system_control_fast()
+{
+    uint32_t start = control_timing_now_us();
+
+    #if FEATURE_DCDC_CONVERTER
+    dcdc.fast_current_limit(adc_dcdc_current_fast());
+    #endif
+
+    control_timing_update(CONTROL_TIER_FAST, start);
+}
+
+// set by the control timer ISR once per second, cleared by the slow tier in the main loop
+static volatile bool slow_control_due = false;
+
 /** High priority function for DC/DC / PWM control and safety functions
  *
- * Called by control timer with 10 Hz frequency (see hardware.cpp).
+ * Called by control timer with 10 Hz frequency (see hardware.cpp) or by the ADC trace replay
+ * in unit tests. Runs the medium tier (DC/DC incl. MPPT and load control) in every call and
+ * the energy and SOC calculation once per second, which triggers the slow tier.
  */
 void system_control()
 {
     static int counter = 0;
+    uint32_t start = control_timing_now_us();
 
     // convert ADC readings to meaningful measurement values
     update_measurements();
 
+    // uses current steps caused by the DC/DC, PWM switch and load in the previous cycle
+    charger.update_resistance(&bat_conf);
+
     #if FEATURE_PWM_SWITCH
     ports_update_current_limits(&pwm_port_int, &bat_terminal, &load_terminal);
     pwm_switch.control();
@@ -221,8 +251,39 @@ void system_control()
         dev_stat.update_energy();
         dev_stat.update_min_max_values();
         charger.update_soc(&bat_conf);
+
+        slow_control_due = true;
     }
+
+    control_timing_update(CONTROL_TIER_MEDIUM, start);
     counter++;
 }
 
-#endif
+/** Slow tier of the control functions: configuration updates and charger state machine
+ *
+ * Called continuously from the main loop, but only runs once per second after the energy and
+ * SOC calculation in system_control(). Keeping it out of the control timer ISR avoids that the
+ * state machine (incl. its debug output) delays the DC/DC control.
+ */
+void system_control_slow()
+{
+    if (!slow_control_due) {
+        return;
+    }
+    slow_control_due = false;
+
+    uint32_t start = control_timing_now_us();
+
+    data_objects_apply_conf();      // configuration changes requested via ThingSet
+    charger.discharge_control(&bat_conf);
+    charger.charge_control(&bat_conf);
+
+    #if FEATURE_DCDC_CONVERTER
+    bat_terminal.pass_voltage_targets(&dcdc_lv_port);
+    #endif
+    #if FEATURE_PWM_SWITCH
+    bat_terminal.pass_voltage_targets(&pwm_port_int);
+    #endif
+
+    control_timing_update(CONTROL_TIER_SLOW, start);
+}
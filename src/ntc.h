@@ -0,0 +1,124 @@
+/* LibreSolar charge controller firmware
+ * Copyright (c) 2016-2019 Martin Jäger (www.libre.solar)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NTC_H
+#define NTC_H
+
+/** @file
+ *
+ * @brief
+ * Compile-time generated lookup table for NTC thermistor temperature measurement
+ *
+ * The NTC is assumed to be connected between ADC input and GND with a series resistor to the
+ * ADC reference voltage. The ratio of the ADC reading is independent of the reference voltage,
+ * so the table can be indexed directly by the filtered 12-bit ADC value.
+ */
+
+#include <stdint.h>
+
+#define NTC_TABLE_SHIFT 6                               ///< ADC counts per table step: 2^6 = 64
+#define NTC_TABLE_SIZE ((4096 >> NTC_TABLE_SHIFT) + 1)  ///< 65 entries incl. end point
+
+#define NTC_TABLE_TEMP_MAX 300.0        ///< Upper temperature clamp (°C)
+#define NTC_TABLE_TEMP_MIN -200.0       ///< Lower temperature clamp (°C)
+
+/** Natural logarithm usable in constant expressions
+ *
+ * Splits x into m * 2^k with m in [1, 2) and calculates ln(m) with the atanh series.
+ */
+static constexpr double ntc_ln(double x)
+{
+    int k = 0;
+    while (x >= 2.0) {
+        x /= 2.0;
+        k++;
+    }
+    while (x < 1.0) {
+        x *= 2.0;
+        k--;
+    }
+    double y = (x - 1.0) / (x + 1.0);
+    double y2 = y * y;
+    double term = y;
+    double sum = 0;
+    for (int n = 1; n < 40; n += 2) {
+        sum += term / n;
+        term *= y2;
+    }
+    return 2.0 * sum + k * 0.69314718055994530942;
+}
+
+/** Temperature table for an NTC described by Steinhart-Hart coefficients
+ *
+ * 1/T = A + B * ln(R) + C * ln(R)^3 with T in Kelvin and R in Ohm
+ *
+ * The Beta model is a special case with A = 1/T0 - ln(R0)/Beta, B = 1/Beta and C = 0.
+ */
+struct NtcTable
+{
+    int16_t temp[NTC_TABLE_SIZE];       ///< Temperature in 0.01 °C
+
+    constexpr NtcTable(double series_resistor, double a, double b, double c) : temp()
+    {
+        for (int i = 0; i < NTC_TABLE_SIZE; i++) {
+            int adc = i << NTC_TABLE_SHIFT;
+            if (adc < 1) {
+                adc = 1;
+            }
+            else if (adc > 4095) {
+                adc = 4095;
+            }
+            double ln_r = ntc_ln(series_resistor * adc / (4096 - adc));
+            double t = 1.0 / (a + b * ln_r + c * ln_r * ln_r * ln_r) - 273.15;
+            if (t > NTC_TABLE_TEMP_MAX) {
+                t = NTC_TABLE_TEMP_MAX;
+            }
+            else if (t < NTC_TABLE_TEMP_MIN) {
+                t = NTC_TABLE_TEMP_MIN;
+            }
+            temp[i] = (int16_t)(t * 100 + (t >= 0 ? 0.5 : -0.5));
+        }
+    }
+
+    /** Interpolated temperature
+     *
+     * @param adc Filtered 12-bit ADC value (0-4095)
+     *
+     * @returns Temperature in 0.01 °C
+     */
+    constexpr int32_t lookup(uint32_t adc) const
+    {
+        uint32_t i = adc >> NTC_TABLE_SHIFT;
+        int32_t frac = adc & ((1 << NTC_TABLE_SHIFT) - 1);
+        if (i >= NTC_TABLE_SIZE - 1) {
+            return temp[NTC_TABLE_SIZE - 1];
+        }
+        return temp[i] + (((temp[i + 1] - temp[i]) * frac) >> NTC_TABLE_SHIFT);
+    }
+};
+
+/** Creates table for an NTC described by its Beta value
+ *
+ * @param series_resistor Resistor between reference voltage and NTC (Ohm)
+ * @param beta Beta value of the NTC (K)
+ * @param r_nominal Nominal resistance of the NTC at 25°C (Ohm)
+ */
+static constexpr NtcTable ntc_table_beta(double series_resistor, double beta, double r_nominal)
+{
+    return NtcTable(series_resistor, 1.0 / 298.15 - ntc_ln(r_nominal) / beta, 1.0 / beta, 0);
+}
+
+#endif /* NTC_H */
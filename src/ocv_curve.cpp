@@ -0,0 +1,150 @@
+/* LibreSolar charge controller firmware
+ * Copyright (c) 2016-2019 Martin Jäger (www.libre.solar)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ocv_curve.h"
+
+#include <stddef.h>
+
+#define OCV_SOC_SCALE   1000    // ppm per 0.1 % of OcvPoint::soc
+
+// lead-acid: almost linear relation between acid density and OCV (positive temp. coefficient)
+static const OcvPoint ocv_points_flooded[] = {
+    { 0, 1900 }, { 500, 2005 }, { 1000, 2100 }
+};
+
+static const OcvPoint ocv_points_vrla[] = {
+    { 0, 1900 }, { 500, 2030 }, { 1000, 2150 }
+};
+
+// LFP: steep at both ends, very flat plateau in between
+static const OcvPoint ocv_points_lfp[] = {
+    { 0, 2900 }, { 25, 3100 }, { 50, 3180 }, { 100, 3220 }, { 200, 3250 }, { 300, 3270 },
+    { 400, 3285 }, { 500, 3295 }, { 600, 3300 }, { 650, 3310 }, { 700, 3322 }, { 800, 3328 },
+    { 900, 3335 }, { 950, 3350 }, { 1000, 3400 }
+};
+
+static const OcvPoint ocv_points_nmc[] = {
+    { 0, 3000 }, { 50, 3300 }, { 100, 3450 }, { 200, 3550 }, { 300, 3610 }, { 400, 3660 },
+    { 500, 3710 }, { 600, 3780 }, { 700, 3860 }, { 800, 3950 }, { 900, 4050 }, { 1000, 4150 }
+};
+
+static const OcvPoint ocv_points_nmc_hv[] = {
+    { 0, 3000 }, { 50, 3300 }, { 100, 3450 }, { 200, 3560 }, { 300, 3630 }, { 400, 3690 },
+    { 500, 3750 }, { 600, 3830 }, { 700, 3920 }, { 800, 4020 }, { 900, 4140 }, { 1000, 4280 }
+};
+
+#define OCV_NUM_POINTS(points) (sizeof(points) / sizeof(OcvPoint))
+
+const OcvCurve ocv_curve_flooded = { ocv_points_flooded, OCV_NUM_POINTS(ocv_points_flooded), 200 };
+const OcvCurve ocv_curve_vrla = { ocv_points_vrla, OCV_NUM_POINTS(ocv_points_vrla), 200 };
+const OcvCurve ocv_curve_lfp = { ocv_points_lfp, OCV_NUM_POINTS(ocv_points_lfp), 0 };
+const OcvCurve ocv_curve_nmc = { ocv_points_nmc, OCV_NUM_POINTS(ocv_points_nmc), -100 };
+const OcvCurve ocv_curve_nmc_hv = { ocv_points_nmc_hv, OCV_NUM_POINTS(ocv_points_nmc_hv), -100 };
+
+/** Binary search for the segment [i, i + 1] containing the given SOC (0.1 % resolution is
+ * sufficient, as the SOC of the points has the same resolution)
+ */
+static int ocv_segment_soc(const OcvCurve *curve, int32_t soc)
+{
+    int low = 0;
+    int high = curve->num_points - 1;
+    while (high - low > 1) {
+        int mid = (low + high) / 2;
+        if (soc < (int32_t)curve->points[mid].soc * OCV_SOC_SCALE) {
+            high = mid;
+        }
+        else {
+            low = mid;
+        }
+    }
+    return low;
+}
+
+/** Same as ocv_segment_soc, but searching for the voltage (µV)
+ */
+static int ocv_segment_voltage(const OcvCurve *curve, int32_t voltage)
+{
+    int low = 0;
+    int high = curve->num_points - 1;
+    while (high - low > 1) {
+        int mid = (low + high) / 2;
+        if (voltage < (int32_t)curve->points[mid].voltage * 1000) {
+            high = mid;
+        }
+        else {
+            low = mid;
+        }
+    }
+    return low;
+}
+
+int32_t ocv_curve_voltage(const OcvCurve *curve, int32_t soc, int temp, int32_t *slope)
+{
+    if (soc < 0) {
+        soc = 0;
+    }
+    else if (soc > 1000 * OCV_SOC_SCALE) {
+        soc = 1000 * OCV_SOC_SCALE;
+    }
+
+    int i = ocv_segment_soc(curve, soc);
+    const OcvPoint *p0 = &curve->points[i];
+    const OcvPoint *p1 = &curve->points[i + 1];
+    int32_t dv = ((int32_t)p1->voltage - p0->voltage) * 1000;
+    int32_t dsoc = ((int32_t)p1->soc - p0->soc) * OCV_SOC_SCALE;
+
+    if (slope != NULL) {
+        *slope = ((int64_t)dv << 16) / dsoc;
+    }
+    return (int32_t)p0->voltage * 1000 + (int64_t)dv * (soc - p0->soc * OCV_SOC_SCALE) / dsoc +
+        (int32_t)curve->temp_coeff * (temp - OCV_TEMP_REF);
+}
+
+int32_t ocv_curve_soc(const OcvCurve *curve, int32_t voltage, int temp)
+{
+    voltage -= (int32_t)curve->temp_coeff * (temp - OCV_TEMP_REF);
+
+    if (voltage <= (int32_t)curve->points[0].voltage * 1000) {
+        return 0;
+    }
+    else if (voltage >= (int32_t)curve->points[curve->num_points - 1].voltage * 1000) {
+        return 1000 * OCV_SOC_SCALE;
+    }
+
+    int i = ocv_segment_voltage(curve, voltage);
+    const OcvPoint *p0 = &curve->points[i];
+    const OcvPoint *p1 = &curve->points[i + 1];
+    int32_t dv = ((int32_t)p1->voltage - p0->voltage) * 1000;
+    int32_t dsoc = ((int32_t)p1->soc - p0->soc) * OCV_SOC_SCALE;
+
+    return (int32_t)p0->soc * OCV_SOC_SCALE + (int64_t)dsoc * (voltage - p0->voltage * 1000) / dv;
+}
+
+bool ocv_curve_custom(OcvCurve *curve, OcvPoint *points, const uint16_t *voltages,
+    int16_t temp_coeff)
+{
+    for (int i = 0; i < OCV_CUSTOM_POINTS; i++) {
+        if (i > 0 && voltages[i] <= voltages[i - 1]) {
+            return false;
+        }
+        points[i].soc = i * 1000 / (OCV_CUSTOM_POINTS - 1);
+        points[i].voltage = voltages[i];
+    }
+    curve->points = points;
+    curve->num_points = OCV_CUSTOM_POINTS;
+    curve->temp_coeff = temp_coeff;
+    return true;
+}
@@ -0,0 +1,98 @@
+/* LibreSolar charge controller firmware
+ * Copyright (c) 2016-2019 Martin Jäger (www.libre.solar)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OCV_CURVE_H
+#define OCV_CURVE_H
+
+/** @file
+ *
+ * @brief Open circuit voltage (OCV) vs. state of charge (SOC) curves of battery cells
+ *
+ * The curves of the supported cell chemistries are compile-time tables stored in flash. Points
+ * are not equidistant, so that the flat parts of a curve need only a few points and the knees
+ * are still resolved. Values between the points are linearly interpolated after a binary
+ * search of the segment.
+ *
+ * A custom curve with OCV_CUSTOM_POINTS equidistant points (SOC 0 %, 10 %, ..., 100 %) can be
+ * configured by the user via ThingSet.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Number of points of a custom OCV curve (SOC 0 %, 10 %, ..., 100 %)
+ */
+#define OCV_CUSTOM_POINTS       11
+
+/** Reference temperature of the OCV curves (°C)
+ */
+#define OCV_TEMP_REF            25
+
+/** Point of an OCV curve
+ */
+typedef struct {
+    uint16_t soc;               ///< State of charge (0.1 %)
+    uint16_t voltage;           ///< Open circuit voltage of one cell (mV)
+} OcvPoint;
+
+/** OCV curve of one cell
+ */
+typedef struct {
+    const OcvPoint *points;     ///< Points with strictly increasing SOC and voltage
+    uint8_t num_points;         ///< Number of points (min. 2)
+    int16_t temp_coeff;         ///< Temperature coefficient of the OCV (µV/K)
+} OcvCurve;
+
+extern const OcvCurve ocv_curve_flooded;
+extern const OcvCurve ocv_curve_vrla;       ///< GEL and AGM
+extern const OcvCurve ocv_curve_lfp;
+extern const OcvCurve ocv_curve_nmc;
+extern const OcvCurve ocv_curve_nmc_hv;
+
+/** OCV of one cell at given SOC and temperature
+ *
+ * @param curve OCV curve
+ * @param soc State of charge (ppm), clamped to 0 to 100 %
+ * @param temp Cell temperature (°C)
+ * @param slope Pointer to store the slope dOCV/dSOC (µV/ppm, Q16 fixed-point) or NULL
+ *
+ * @returns OCV in µV
+ */
+int32_t ocv_curve_voltage(const OcvCurve *curve, int32_t soc, int temp, int32_t *slope);
+
+/** SOC of one cell at given OCV and temperature (inverse of ocv_curve_voltage)
+ *
+ * @param curve OCV curve
+ * @param voltage Open circuit voltage of one cell (µV)
+ * @param temp Cell temperature (°C)
+ *
+ * @returns SOC in ppm (0 to 1000000)
+ */
+int32_t ocv_curve_soc(const OcvCurve *curve, int32_t voltage, int temp);
+
+/** Creates a curve from OCV_CUSTOM_POINTS equidistant voltages
+ *
+ * @param curve Curve to be initialized
+ * @param points Buffer for OCV_CUSTOM_POINTS points (must remain valid while curve is used)
+ * @param voltages OCV of one cell at SOC 0 %, 10 %, ..., 100 % (mV)
+ * @param temp_coeff Temperature coefficient of the OCV (µV/K)
+ *
+ * @returns true if the voltages are strictly increasing and the curve is valid
+ */
+bool ocv_curve_custom(OcvCurve *curve, OcvPoint *points, const uint16_t *voltages,
+    int16_t temp_coeff);
+
+#endif /* OCV_CURVE_H */
@@ -54,6 +54,75 @@
 #define CONTROL_FREQUENCY 10
 #endif
 
+/** Conversion time of one ADC channel (ns)
+ *
+ * 239.5 ADC clock cycles sampling time (required for internal reference and temperature sensor)
+ * plus 12.5 cycles for the conversion. The ADC clock is PCLK/4, i.e. 12 MHz for STM32F0 at
+ * 48 MHz and 8 MHz for STM32L0 at 32 MHz.
+ */
+#ifndef ADC_CONVERSION_TIME_NS
+#if defined(STM32F0)
+#define ADC_CONVERSION_TIME_NS 21000
+#else
+#define ADC_CONVERSION_TIME_NS 31500
+#endif
+#endif
+
+/** ADC sampling frequency (Hz)
+ *
+ * Each trigger starts one conversion sequence of all NUM_ADC_CH channels, which has to be
+ * finished before the next trigger (NUM_ADC_CH * ADC_CONVERSION_TIME_NS). Must be a multiple
+ * of 1000 Hz.
+ */
+#ifndef ADC_SAMPLE_FREQUENCY
+#define ADC_SAMPLE_FREQUENCY 1000
+#endif
+
+/** Time a voltage or current limit has to be exceeded before an ADC alert is triggered (us)
+ *
+ * Converted into a number of consecutive samples (min. 2) based on ADC_SAMPLE_FREQUENCY.
+ */
+#ifndef ADC_ALERT_DELAY_US
+#define ADC_ALERT_DELAY_US 2000
+#endif
+
+/** Number of ADC conversion sequences processed per DMA interrupt
+ *
+ * The DMA buffer holds two blocks of this size (ping-pong), one being filled by the DMA while
+ * the other one is processed. Default results in an interrupt rate of 1 kHz, so that the delay
+ * of the voltage alerts stays at 1-2 ms independent of the sampling frequency.
+ */
+#ifndef ADC_DMA_SEQUENCES
+#define ADC_DMA_SEQUENCES (ADC_SAMPLE_FREQUENCY / 1000)
+#endif
+
+/** Safe bounds of the half bridge dead time for online tuning (ns)
+ *
+ * PWM_DEADTIME is used as the start value. The bounds should be verified for each board
+ * (MOSFET switching times and gate driver delays). By default, the dead time may only be
+ * increased, as a shorter dead time than PWM_DEADTIME may cause shoot-through currents.
+ */
+#ifndef PWM_DEADTIME_MIN
+#define PWM_DEADTIME_MIN PWM_DEADTIME
+#endif
+#ifndef PWM_DEADTIME_MAX
+#define PWM_DEADTIME_MAX (PWM_DEADTIME * 2)
+#endif
+
+/** Number of ADC conversion sequences stored in the capture buffer (see adc_capture.h)
+ *
+ * Each sequence needs NUM_ADC_CH * 2 bytes of RAM. Set to 0 to disable the capture.
+ */
+#ifndef ADC_CAPTURE_DEPTH
+#define ADC_CAPTURE_DEPTH 64
+#endif
+
+/** Number of ADC conversion sequences kept in the capture buffer before the trigger event
+ */
+#ifndef ADC_CAPTURE_PRE_TRIGGER
+#define ADC_CAPTURE_PRE_TRIGGER (ADC_CAPTURE_DEPTH / 2)
+#endif
+
 /** Maximum Tj of MOSFETs (°C)
  *
  * This value is used for model-based control of overcurrent protection. It represents
@@ -86,4 +155,13 @@
 #define MOSFET_THERMAL_TIME_CONSTANT  5
 #endif
 
+/** NTC thermistor nominal resistance at 25°C (Ohm)
+ *
+ * Used together with NTC_BETA_VALUE, unless the board specifies the Steinhart-Hart coefficients
+ * NTC_STEINHART_HART_A, NTC_STEINHART_HART_B and NTC_STEINHART_HART_C instead.
+ */
+#ifndef NTC_NOMINAL_RESISTANCE
+#define NTC_NOMINAL_RESISTANCE 10000.0
+#endif
+
 #endif /* PCB_H */
@@ -84,7 +84,10 @@ extern "C" void TIM3_IRQHandler(void)
     TIM3->SR &= ~TIM_SR_UIF;       // clear update interrupt flag
 
     // turning the PWM switch on creates a short voltage rise, so inhibit alerts by 10 ms
-    adc_upper_alert_inhibit(ADC_POS_V_BAT, 10);
+    // (counter is kept running while switch is off, see pwm_signal_stop)
+    if (_pwm_active) {
+        adc_upper_alert_inhibit(ADC_POS_V_BAT, 10);
+    }
 }
 
 void pwm_signal_set_duty_cycle(float duty)
@@ -104,13 +107,22 @@ float pwm_signal_get_duty_cycle()
     return (float)(TIM3->CCR4) / _pwm_resolution;
 }
 
+int pwm_signal_on_samples(int samples_per_period)
+{
+    return TIM3->CCR4 * samples_per_period / _pwm_resolution;
+}
+
+int pwm_signal_phase(int samples_per_period)
+{
+    return TIM3->CNT * samples_per_period / _pwm_resolution;
+}
+
 void pwm_signal_start(float pwm_duty)
 {
     pwm_signal_set_duty_cycle(pwm_duty);
 
-    // Control Register 1
-    // TIM_CR1_CEN =  1: Counter enable
-    TIM3->CR1 |= TIM_CR1_CEN;   // edge-aligned mode
+    // Counter was already enabled together with the ADC timer in adc_timer_start() to get a
+    // fixed phase between ADC samples and PWM period
 
     // Capture/Compare Enable Register
     // CCxE = 1: Enable the output on OCx
@@ -124,7 +136,7 @@ void pwm_signal_start(float pwm_duty)
 
 void pwm_signal_stop()
 {
-    TIM3->CR1 &= ~(TIM_CR1_CEN);
+    // counter is not stopped to keep ADC sampling synchronized
     TIM3->CCER &= ~(TIM_CCER_CC4E);
     TIM3->CCR4 = 0;
     _pwm_active = false;
@@ -139,6 +151,8 @@ bool pwm_signal_high()
 
 // dummy functions for unit tests
 float pwm_signal_get_duty_cycle() { return 0; }
+int pwm_signal_on_samples(int samples_per_period) { return 0; }
+int pwm_signal_phase(int samples_per_period) { return 0; }
 void pwm_signal_set_duty_cycle(float duty) {;}
 void pwm_signal_duty_cycle_step(int delta) {;}
 void pwm_signal_init_registers(int freq_Hz) {;}
@@ -250,4 +264,14 @@ float PwmSwitch::get_duty_cycle()
     return pwm_signal_get_duty_cycle();
 }
 
+int PwmSwitch::on_samples(int samples_per_period)
+{
+    return pwm_signal_on_samples(samples_per_period);
+}
+
+int PwmSwitch::phase(int samples_per_period)
+{
+    return pwm_signal_phase(samples_per_period);
+}
+
 #endif /* FEATURE_PWM_SWITCH */
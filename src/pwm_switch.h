@@ -65,6 +65,22 @@ public:
      */
     float get_duty_cycle();
 
+    /** Number of equally spaced samples per PWM period that fall into the on-interval
+     *
+     * Integer calculation based on the timer compare value, so it can be used in ISRs.
+     *
+     * @param samples_per_period Number of samples per PWM period
+     */
+    int on_samples(int samples_per_period);
+
+    /** Index of the last equally spaced sample within the current PWM period
+     *
+     * Based on the timer counter, so it can be used to synchronize sampling in ISRs.
+     *
+     * @param samples_per_period Number of samples per PWM period
+     */
+    int phase(int samples_per_period);
+
     PowerPort *terminal;            ///< Pointer to external power port (terminal)
     PowerPort *port_int;            ///< Pointer to internal power port (junction with load and battery)
 
@@ -0,0 +1,85 @@
+/* LibreSolar charge controller firmware
+ * Copyright (c) 2016-2019 Martin Jäger (www.libre.solar)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "resistance_est.h"
+
+#include <math.h>
+
+#define RES_EST_STEP_MIN        0.1f    // A, min. current change between two control calls
+#define RES_EST_MAX             1.0f    // Ohm, max. plausible resistance
+#define RES_EST_FORGETTING      0.98f   // weight of previous steps (memory of approx. 50 steps)
+#define RES_EST_PRIOR_WEIGHT    0.1f    // A², weight of the initial resistance
+#define RES_EST_OUTLIER_FACTOR  3.0f    // rejection threshold (multiples of the deviation)
+#define RES_EST_DEVIATION_MIN   0.002f  // Ohm, lower limit of the rejection threshold
+#define RES_EST_GATE_WIDENING   1.2f    // widening of the threshold after a rejected step
+#define RES_EST_STEPS_MIN       5       // accepted steps before the estimate is used
+
+void resistance_est_init(ResistanceEst *est, float resistance)
+{
+    est->sum_di_di = RES_EST_PRIOR_WEIGHT;
+    est->sum_dv_di = resistance * RES_EST_PRIOR_WEIGHT;
+    est->resistance = resistance;
+    est->deviation = resistance / 2;    // wide threshold until the first steps were accepted
+    est->num_steps = 0;
+    est->num_rejected = 0;
+    est->prev_valid = false;
+    est->configured = true;
+}
+
+void resistance_est_pause(ResistanceEst *est)
+{
+    est->prev_valid = false;
+}
+
+bool resistance_est_valid(const ResistanceEst *est)
+{
+    return est->num_steps >= RES_EST_STEPS_MIN;
+}
+
+bool resistance_est_update(ResistanceEst *est, float voltage, float current)
+{
+    float dv = voltage - est->voltage_prev;
+    float di = current - est->current_prev;
+    bool step = est->prev_valid && fabsf(di) >= RES_EST_STEP_MIN;
+
+    est->voltage_prev = voltage;
+    est->current_prev = current;
+    est->prev_valid = true;
+
+    if (!step) {
+        return false;
+    }
+
+    // positive current charges the battery, so the voltage rises with the current
+    float r = dv / di;
+    float threshold = RES_EST_OUTLIER_FACTOR * est->deviation;
+    if (threshold < RES_EST_DEVIATION_MIN) {
+        threshold = RES_EST_DEVIATION_MIN;
+    }
+    if (r < 0 || r > RES_EST_MAX || fabsf(r - est->resistance) > threshold) {
+        // slowly open the gate, so that a real change of the resistance is accepted eventually
+        est->deviation *= RES_EST_GATE_WIDENING;
+        est->num_rejected++;
+        return false;
+    }
+
+    est->sum_dv_di = RES_EST_FORGETTING * est->sum_dv_di + dv * di;
+    est->sum_di_di = RES_EST_FORGETTING * est->sum_di_di + di * di;
+    est->resistance = est->sum_dv_di / est->sum_di_di;
+    est->deviation += (1 - RES_EST_FORGETTING) * (fabsf(r - est->resistance) - est->deviation);
+    est->num_steps++;
+    return true;
+}
@@ -0,0 +1,82 @@
+/* LibreSolar charge controller firmware
+ * Copyright (c) 2016-2019 Martin Jäger (www.libre.solar)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef RESISTANCE_EST_H
+#define RESISTANCE_EST_H
+
+/** @file
+ *
+ * @brief Online estimation of the battery series resistance from current steps
+ *
+ * Natural current steps at the battery terminal (DC/DC start/stop, MPPT perturbations, load
+ * switching) cause an immediate voltage change across the series resistance, while the OCV and
+ * the polarization voltage change much slower. The resistance is estimated as the ratio of the
+ * voltage and current changes between two consecutive control calls:
+ *
+ *     R = dV / dI
+ *
+ * Voltage and current measurements pass through the same ADC low pass filter, so the ratio is
+ * not affected by the filter delay.
+ *
+ * Accepted steps are combined by weighted least squares with exponential forgetting, so that
+ * large steps have a higher weight than small ones. Implausible ratios and outliers far away
+ * from the current estimate (e.g. caused by a load switching during a DC/DC step) are rejected.
+ *
+ * The update needs only a few multiplications, so it can be called in the control loop.
+ */
+
+#include <stdbool.h>
+
+/** Estimator data
+ */
+typedef struct {
+    bool configured;            ///< Estimator was initialized
+    bool prev_valid;            ///< Previous measurement can be used for the next step
+    float voltage_prev;         ///< Voltage of the previous call (V)
+    float current_prev;         ///< Current of the previous call (A)
+    float sum_dv_di;            ///< Weighted sum of dV * dI (V·A)
+    float sum_di_di;            ///< Weighted sum of dI² (A²)
+    float resistance;           ///< Estimated resistance (Ohm)
+    float deviation;            ///< Mean absolute deviation of accepted steps (Ohm)
+    unsigned int num_steps;     ///< Number of accepted steps
+    unsigned int num_rejected;  ///< Number of rejected steps
+} ResistanceEst;
+
+/** Initializes the estimator
+ *
+ * @param est Estimator data
+ * @param resistance Initial resistance (Ohm), e.g. from the battery configuration
+ */
+void resistance_est_init(ResistanceEst *est, float resistance);
+
+/** Estimator update with a new measurement, should be called in every control cycle
+ *
+ * @param est Estimator data
+ * @param voltage Battery terminal voltage (V)
+ * @param current Battery current (A)
+ *
+ * @returns true if a current step was detected and accepted
+ */
+bool resistance_est_update(ResistanceEst *est, float voltage, float current);
+
+/** Ignores the previous measurement, e.g. while the terminal voltage is regulated
+ */
+void resistance_est_pause(ResistanceEst *est);
+
+/** Checks if enough steps were accepted to use the estimate
+ */
+bool resistance_est_valid(const ResistanceEst *est);
+
+#endif /* RESISTANCE_EST_H */
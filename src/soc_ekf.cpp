@@ -0,0 +1,201 @@
+/* LibreSolar charge controller firmware
+ * Copyright (c) 2016-2019 Martin Jäger (www.libre.solar)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "soc_ekf.h"
+
+#include <math.h>
+#include <stddef.h>
+
+#define SOC_EKF_SIGMA_SOC_INIT  200000      // ppm, uncertainty of the initial SOC from OCV
+#define SOC_EKF_SIGMA_SOC_FULL  5000        // ppm, uncertainty after the battery was fully charged
+#define SOC_EKF_SIGMA_SOC       5           // ppm, process noise of the SOC per second
+#define SOC_EKF_CURRENT_ERROR   2           // %, relative error of the current measurement
+#define SOC_EKF_SIGMA_V_RC_INIT 50000       // µV, uncertainty of the initial RC voltage
+#define SOC_EKF_SIGMA_V_RC      1000        // µV, process noise of the RC voltage per second
+#define SOC_EKF_SIGMA_V         20000       // µV, voltage measurement and model error per battery
+#define SOC_EKF_RESISTANCE_ERROR 30         // %, uncertainty of the resistances R0 and R1
+#define SOC_EKF_INNOVATION_MAX  2000000     // µV, limits the measurement error (prevents overflow)
+
+// upper limits of the variances (keep the 64-bit intermediate results in range)
+#define SOC_EKF_VAR_SOC_MAX     ((int64_t)SOC_EKF_SIGMA_SOC_INIT * SOC_EKF_SIGMA_SOC_INIT)
+#define SOC_EKF_VAR_V_RC_MAX    ((int64_t)1000000 * 1000000)
+
+void soc_ekf_init(SocEkf *ekf, const OcvCurve *curve, int num_cells, int num_batteries,
+    float capacity, float r0, float r1, float tau)
+{
+    ekf->curve = curve;
+    ekf->num_cells = num_cells * num_batteries;
+    // SOC change per mAs: 1e6 ppm / (capacity * 3600 * 1000 mAs)
+    ekf->soc_gain = (capacity > 0) ? 1e6f / (capacity * 3.6e6f) * (1 << 24) + 0.5f : 0;
+    ekf->r0 = r0 * num_batteries * 1e6f + 0.5f;
+    ekf->r1 = r1 * num_batteries * 1e6f + 0.5f;
+    ekf->rc_decay = (tau > 0) ? expf(-1.0f / tau) * 65536 + 0.5f : 0;
+    ekf->meas_var = (int64_t)SOC_EKF_SIGMA_V * num_batteries * SOC_EKF_SIGMA_V * num_batteries;
+    ekf->temperature = OCV_TEMP_REF;
+    ekf->configured = true;
+    ekf->initialized = false;
+}
+
+int32_t soc_ekf_ocv(const SocEkf *ekf, int32_t soc, int32_t *slope)
+{
+    int32_t ocv = ocv_curve_voltage(ekf->curve, soc, ekf->temperature, slope);
+    if (slope != NULL) {
+        *slope *= ekf->num_cells;
+    }
+    return ocv * ekf->num_cells;
+}
+
+static void soc_ekf_predict(SocEkf *ekf, int32_t current)
+{
+    // coulomb counting (charging current has positive sign)
+    int64_t delta = (int64_t)current * ekf->soc_gain + ekf->soc_residual;
+    int32_t delta_soc = delta >> 24;
+    ekf->soc += delta_soc;
+    ekf->soc_residual = delta - ((int64_t)delta_soc << 24);
+
+    // RC element: V_rc(k+1) = a * V_rc(k) + (1 - a) * R1 * I
+    int32_t v_rc_inf = (int64_t)ekf->r1 * current / 1000;
+    ekf->v_rc = ((int64_t)ekf->rc_decay * ekf->v_rc +
+        (int64_t)(65536 - ekf->rc_decay) * v_rc_inf) >> 16;
+
+    // P = A * P * A^T + Q with A = [1 0; 0 a]
+    int32_t sigma_soc = SOC_EKF_SIGMA_SOC +
+        ((delta_soc < 0) ? -delta_soc : delta_soc) * SOC_EKF_CURRENT_ERROR / 100;
+    ekf->p[0][0] += (int64_t)sigma_soc * sigma_soc;
+    ekf->p[0][1] = (ekf->p[0][1] * ekf->rc_decay) >> 16;
+    ekf->p[1][0] = ekf->p[0][1];
+    ekf->p[1][1] = (((ekf->p[1][1] * ekf->rc_decay) >> 16) * ekf->rc_decay >> 16) +
+        (int64_t)SOC_EKF_SIGMA_V_RC * SOC_EKF_SIGMA_V_RC;
+}
+
+static void soc_ekf_correct(SocEkf *ekf, int32_t voltage, int32_t current)
+{
+    int32_t h;      // dOCV/dSOC (µV/ppm, Q16), dV/dV_rc = 1
+    int32_t ocv = soc_ekf_ocv(ekf, ekf->soc, &h);
+    int32_t v_pred = ocv + ekf->v_rc + (int64_t)ekf->r0 * current / 1000;
+
+    int32_t err = voltage * 1000 - v_pred;
+    if (err > SOC_EKF_INNOVATION_MAX) {
+        err = SOC_EKF_INNOVATION_MAX;
+    }
+    else if (err < -SOC_EKF_INNOVATION_MAX) {
+        err = -SOC_EKF_INNOVATION_MAX;
+    }
+
+    // P * H^T and innovation covariance S = H * P * H^T + R
+    int64_t ph0 = ((ekf->p[0][0] * h) >> 16) + ekf->p[0][1];
+    int64_t ph1 = ((ekf->p[1][0] * h) >> 16) + ekf->p[1][1];
+    // uncertain resistances cause a model error proportional to the current, which must not
+    // be interpreted as a SOC error (especially important for flat OCV curves)
+    int64_t sigma_res = (int64_t)(ekf->r0 + ekf->r1) * current / 1000 *
+        SOC_EKF_RESISTANCE_ERROR / 100;
+    int64_t s = ((ph0 * h) >> 16) + ph1 + ekf->meas_var + sigma_res * sigma_res;
+
+    // Kalman gain (Q16)
+    int64_t k0 = (ph0 << 16) / s;
+    int64_t k1 = (ph1 << 16) / s;
+
+    ekf->soc += (k0 * err) >> 16;
+    ekf->v_rc += (k1 * err) >> 16;
+
+    // P = P - K * H * P = P - K * (P * H^T)^T
+    ekf->p[0][0] -= (k0 * ph0) >> 16;
+    ekf->p[0][1] -= (k0 * ph1) >> 16;
+    ekf->p[1][1] -= (k1 * ph1) >> 16;
+    ekf->p[1][0] = ekf->p[0][1];
+}
+
+void soc_ekf_update(SocEkf *ekf, int32_t voltage, int32_t current, int temp)
+{
+    if (!ekf->configured) {
+        return;
+    }
+
+    // OCV curve not known (e.g. unknown battery type): coulomb counting only
+    bool ocv_valid = ekf->curve != NULL && ekf->num_cells > 0;
+    ekf->temperature = temp;
+
+    if (!ekf->initialized) {
+        int32_t ocv = voltage * 1000 - (int64_t)ekf->r0 * current / 1000;
+        ekf->soc = ocv_valid ?
+            ocv_curve_soc(ekf->curve, ocv / ekf->num_cells, temp) : SOC_EKF_FULL;
+        ekf->soc_residual = 0;
+        ekf->v_rc = 0;
+        ekf->p[0][0] = SOC_EKF_VAR_SOC_MAX;
+        ekf->p[0][1] = 0;
+        ekf->p[1][0] = 0;
+        ekf->p[1][1] = (int64_t)SOC_EKF_SIGMA_V_RC_INIT * SOC_EKF_SIGMA_V_RC_INIT;
+        ekf->initialized = true;
+        return;
+    }
+
+    soc_ekf_predict(ekf, current);
+    if (ocv_valid) {
+        soc_ekf_correct(ekf, voltage, current);
+    }
+
+    // keep states and covariance in a valid range
+    if (ekf->soc < 0) {
+        ekf->soc = 0;
+    }
+    else if (ekf->soc > SOC_EKF_FULL) {
+        ekf->soc = SOC_EKF_FULL;
+    }
+    if (ekf->p[0][0] < 1) {
+        ekf->p[0][0] = 1;
+    }
+    else if (ekf->p[0][0] > SOC_EKF_VAR_SOC_MAX) {
+        ekf->p[0][0] = SOC_EKF_VAR_SOC_MAX;
+    }
+    if (ekf->p[1][1] < 1) {
+        ekf->p[1][1] = 1;
+    }
+    else if (ekf->p[1][1] > SOC_EKF_VAR_V_RC_MAX) {
+        ekf->p[1][1] = SOC_EKF_VAR_V_RC_MAX;
+    }
+}
+
+void soc_ekf_set_full(SocEkf *ekf)
+{
+    ekf->soc = SOC_EKF_FULL;
+    ekf->soc_residual = 0;
+    ekf->p[0][0] = (int64_t)SOC_EKF_SIGMA_SOC_FULL * SOC_EKF_SIGMA_SOC_FULL;
+    ekf->p[0][1] = 0;
+    ekf->p[1][0] = 0;
+    ekf->initialized = true;
+}
+
+uint32_t soc_ekf_uncertainty(const SocEkf *ekf)
+{
+    // integer square root (bitwise), P[0][0] is limited to SOC_EKF_VAR_SOC_MAX < 2^36
+    uint64_t var = ekf->p[0][0];
+    uint64_t res = 0;
+    uint64_t bit = (uint64_t)1 << 36;
+    while (bit > var) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (var >= res + bit) {
+            var -= res + bit;
+            res = (res >> 1) + bit;
+        }
+        else {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+    return res;
+}
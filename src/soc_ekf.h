@@ -0,0 +1,110 @@
+/* LibreSolar charge controller firmware
+ * Copyright (c) 2016-2019 Martin Jäger (www.libre.solar)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SOC_EKF_H
+#define SOC_EKF_H
+
+/** @file
+ *
+ * @brief State of charge estimation with an extended Kalman filter in fixed-point arithmetic
+ *
+ * The battery is modelled by its open circuit voltage (OCV) as a function of the SOC, the
+ * internal resistance R0 and one RC element (R1, tau) for the polarization voltage:
+ *
+ *     V_bat = OCV(SOC) + V_rc + R0 * I
+ *
+ * State vector: SOC (ppm) and V_rc (µV). The prediction step uses coulomb counting of the
+ * battery current, the measurement step corrects the states with the terminal voltage. The
+ * filter weights both automatically: in the flat part of an OCV curve (e.g. LFP cells) the
+ * voltage contains hardly any information about the SOC, so coulomb counting dominates.
+ *
+ * All calculations of the update use integer arithmetic (64-bit intermediate results), as the
+ * Cortex-M0 does not have an FPU. Floating point numbers are only used for the configuration.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ocv_curve.h"
+
+/** SOC of a fully charged battery (ppm)
+ */
+#define SOC_EKF_FULL            1000000
+
+/** Kalman filter data
+ */
+typedef struct {
+    // configuration (set by soc_ekf_init)
+    const OcvCurve *curve;      ///< OCV curve of one cell (NULL: coulomb counting only)
+    int32_t num_cells;          ///< Number of cells in series
+    int32_t soc_gain;           ///< SOC change per mAs (ppm, Q24 fixed-point)
+    int32_t r0;                 ///< Internal resistance (µOhm)
+    int32_t r1;                 ///< Resistance of the RC element (µOhm)
+    int32_t rc_decay;           ///< Decay of V_rc within one second: exp(-1 s / tau) (Q16)
+    int64_t meas_var;           ///< Variance of the voltage measurement (µV²)
+    bool configured;            ///< Configuration valid
+
+    // states
+    bool initialized;           ///< States were initialized with the first measurement
+    int32_t soc;                ///< State of charge (ppm)
+    int32_t soc_residual;       ///< Part of the coulomb counting below 1 ppm (Q24)
+    int32_t v_rc;               ///< Voltage of the RC element (µV)
+    int temperature;            ///< Last battery temperature (°C)
+    int64_t p[2][2];            ///< Error covariance matrix (ppm², ppm·µV, µV²)
+} SocEkf;
+
+/** Configures the filter (states are initialized with the first measurement)
+ *
+ * @param ekf Filter data
+ * @param curve OCV curve of one cell or NULL if unknown
+ * @param num_cells Number of cells per battery
+ * @param num_batteries Number of batteries in series
+ * @param capacity Battery capacity (Ah)
+ * @param r0 Internal resistance of one battery (Ohm)
+ * @param r1 Resistance of the RC element of one battery (Ohm)
+ * @param tau Time constant of the RC element (s)
+ */
+void soc_ekf_init(SocEkf *ekf, const OcvCurve *curve, int num_cells, int num_batteries,
+    float capacity, float r0, float r1, float tau);
+
+/** Prediction and measurement update, must be called exactly once per second
+ *
+ * @param ekf Filter data
+ * @param voltage Battery terminal voltage (mV)
+ * @param current Battery current (mA), positive sign for charging
+ * @param temp Battery temperature (°C) for correction of the OCV
+ */
+void soc_ekf_update(SocEkf *ekf, int32_t voltage, int32_t current, int temp);
+
+/** Sets the SOC to 100% with low uncertainty (e.g. after the end of the CV phase)
+ */
+void soc_ekf_set_full(SocEkf *ekf);
+
+/** Standard deviation of the SOC estimate (ppm)
+ */
+uint32_t soc_ekf_uncertainty(const SocEkf *ekf);
+
+/** OCV of the complete battery at given SOC and last temperature
+ *
+ * @param ekf Filter data
+ * @param soc State of charge (ppm), clamped to 0 to 100 %
+ * @param slope Pointer to store the slope dOCV/dSOC (µV/ppm, Q16 fixed-point) or NULL
+ *
+ * @returns OCV in µV
+ */
+int32_t soc_ekf_ocv(const SocEkf *ekf, int32_t soc, int32_t *slope);
+
+#endif /* SOC_EKF_H */
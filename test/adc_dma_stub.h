@@ -34,4 +34,17 @@ void prepare_adc_readings(AdcValues values);
 void prepare_adc_filtered();
 void clear_adc_filtered();
 uint32_t get_adc_filtered(uint32_t channel);
+uint32_t get_adc_filtered_fast(uint32_t channel);
+void set_adc_filtered(uint32_t channel, uint32_t raw);
+void set_adc_reading(uint32_t channel, uint16_t raw);
+uint16_t get_adc_reading(uint32_t channel);
+
+/** Scaling of the filtered ADC value using floating point arithmetics (reference)
+ */
+float adc_scaled_float(uint32_t channel, float gain);
+
+/** Scaling of the filtered ADC value using the fixed-point implementation and the
+ * scale factors of update_measurements()
+ */
+float adc_scaled_fixed(uint32_t channel);
 #endif
\ No newline at end of file
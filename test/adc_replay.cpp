@@ -0,0 +1,214 @@
+/* LibreSolar charge controller firmware
+ * Copyright (c) 2016-2019 Martin Jäger (www.libre.solar)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "adc_replay.h"
+
+#include "adc_dma.h"
+#include "half_bridge.h"
+#include "hardware.h"
+#include "main.h"
+
+#include <chrono>
+#include <string.h>
+#include <time.h>
+
+// arbitrary start of the simulated unix time (must be large enough for the charger timeouts)
+#define REPLAY_TIME_START 1500000000
+
+extern time_t timestamp;
+
+/** Simulated time for native unit tests
+ *
+ * Replaces the time() function of the C library, so that all timeouts in the firmware which are
+ * based on time(NULL) follow the timestamp incremented by system_control().
+ */
+time_t time(time_t *t) noexcept
+{
+    time_t now = REPLAY_TIME_START + timestamp;
+    if (t != NULL) {
+        *t = now;
+    }
+    return now;
+}
+
+int adc_trace_read_csv(FILE *file, AdcTrace *trace)
+{
+    char line[200];
+    int num_sequences = 0;
+
+    trace->readings.clear();
+    trace->sample_rate = ADC_SAMPLE_FREQUENCY;
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#') {
+            const char *rate = strstr(line, "sample rate:");
+            if (rate != NULL) {
+                sscanf(rate, "sample rate: %d", &trace->sample_rate);
+            }
+            continue;
+        }
+        if (line[0] == '\n' || line[0] == '\r') {
+            continue;
+        }
+
+        // first column is the sample index
+        char *pos = strchr(line, ',');
+        for (int ch = 0; ch < NUM_ADC_CH; ch++) {
+            unsigned int value;
+            if (pos == NULL || sscanf(pos + 1, "%u", &value) != 1 || value > 4095) {
+                return -1;
+            }
+            trace->readings.push_back(value << 4);
+            pos = strchr(pos + 1, ',');
+        }
+        num_sequences++;
+    }
+    return num_sequences;
+}
+
+int adc_trace_read_binary(FILE *file, AdcTrace *trace, int sample_rate)
+{
+    uint8_t buf[2];
+
+    trace->readings.clear();
+    trace->sample_rate = sample_rate;
+
+    while (fread(buf, 1, 2, file) == 2) {
+        trace->readings.push_back(buf[0] | (buf[1] << 8));     // little endian
+    }
+    if (trace->readings.size() % NUM_ADC_CH != 0) {
+        return -1;
+    }
+    return trace->readings.size() / NUM_ADC_CH;
+}
+
+void adc_trace_write_csv(FILE *file, const AdcTrace *trace)
+{
+    fprintf(file, "# ADC trace, sample rate: %d Hz\n", trace->sample_rate);
+    for (size_t s = 0; s < trace->readings.size() / NUM_ADC_CH; s++) {
+        fprintf(file, "%d", (int)s);
+        for (int ch = 0; ch < NUM_ADC_CH; ch++) {
+            fprintf(file, ",%u", trace->readings[s * NUM_ADC_CH + ch] >> 4);
+        }
+        fprintf(file, "\n");
+    }
+}
+
+void adc_trace_write_binary(FILE *file, const AdcTrace *trace)
+{
+    for (size_t i = 0; i < trace->readings.size(); i++) {
+        uint8_t buf[2] = { (uint8_t)(trace->readings[i] & 0xFF), (uint8_t)(trace->readings[i] >> 8) };
+        fwrite(buf, 1, 2, file);
+    }
+}
+
+/** Tasks called once per second in the main loop (without communication)
+ *
+ * The charger state machine is part of the slow control tier in system_control_slow().
+ */
+static void replay_slow_tasks()
+{
+    load.state_machine();
+
+    adc_set_lv_alerts(bat_conf.voltage_absolute_max * charger.num_batteries,
+        bat_conf.voltage_absolute_min * charger.num_batteries);
+}
+
+static void replay_record(AdcReplayResult *result, uint32_t time_ms)
+{
+    AdcReplayRecord rec;
+    rec.time_ms = time_ms;
+    rec.bat_voltage = bat_terminal.voltage;
+    rec.bat_current = bat_terminal.current;
+    rec.solar_voltage = solar_terminal.voltage;
+    rec.solar_current = solar_terminal.current;
+    rec.load_current = load_terminal.current;
+#if FEATURE_DCDC_CONVERTER
+    rec.dcdc_power = dcdc_lv_port.power;
+    rec.dcdc_state = dcdc.state;
+    rec.dcdc_duty = half_bridge_get_duty_cycle();
+#else
+    rec.dcdc_power = 0;
+    rec.dcdc_state = 0;
+    rec.dcdc_duty = 0;
+#endif
+    rec.chg_state = charger.state;
+    rec.soc = charger.soc;
+    result->records.push_back(rec);
+}
+
+void adc_replay(const AdcTrace *trace, const AdcReplayConf *conf, AdcReplayResult *result)
+{
+    // the readings are copied into a static buffer, as the ADC module keeps the pointer
+    static uint16_t sequence[NUM_ADC_CH];
+
+    const int seq_per_control = trace->sample_rate / CONTROL_FREQUENCY;
+    const size_t num_sequences = trace->readings.size() / NUM_ADC_CH;
+    uint32_t time_ms = result->num_control_calls * 1000 / CONTROL_FREQUENCY;
+
+    if (seq_per_control < 1 || trace->sample_rate % CONTROL_FREQUENCY != 0) {
+        printf("ADC replay: sample rate %d Hz not a multiple of control frequency\n",
+            trace->sample_rate);
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int r = 0; r < conf->repeat; r++) {
+        for (size_t s = 0; s < num_sequences; s++) {
+            memcpy(sequence, &trace->readings[s * NUM_ADC_CH], sizeof(sequence));
+            adc_update_block(sequence, 1);
+            result->num_sequences++;
+
+            // fast control tier is called by the DMA ISR after each complete buffer
+            if (result->num_sequences % ADC_DMA_SEQUENCES == 0) {
+                system_control_fast();
+                result->num_fast_calls++;
+            }
+
+            if (result->num_sequences % seq_per_control == 0) {
+                system_control();
+                system_control_slow();      // main loop runs after each control timer ISR
+                result->num_control_calls++;
+                time_ms += 1000 / CONTROL_FREQUENCY;
+
+                if (conf->slow_tasks && result->num_control_calls % CONTROL_FREQUENCY == 0) {
+                    replay_slow_tasks();
+                }
+                if (conf->record) {
+                    replay_record(result, time_ms);
+                }
+            }
+        }
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    result->elapsed_s += std::chrono::duration<double>(end - start).count();
+    result->simulated_s += (double)num_sequences * conf->repeat / trace->sample_rate;
+}
+
+void adc_replay_write_records(FILE *file, const AdcReplayResult *result)
+{
+    fprintf(file, "time_ms,bat_V,bat_A,solar_V,solar_A,load_A,dcdc_W,dcdc_state,dcdc_duty,"
+        "chg_state,soc\n");
+    for (size_t i = 0; i < result->records.size(); i++) {
+        const AdcReplayRecord *rec = &result->records[i];
+        fprintf(file, "%u,%.3f,%.3f,%.3f,%.3f,%.3f,%.2f,%u,%.4f,%u,%u\n",
+            (unsigned int)rec->time_ms, rec->bat_voltage, rec->bat_current, rec->solar_voltage,
+            rec->solar_current, rec->load_current, rec->dcdc_power, rec->dcdc_state,
+            rec->dcdc_duty, rec->chg_state, rec->soc);
+    }
+}
@@ -0,0 +1,127 @@
+/* LibreSolar charge controller firmware
+ * Copyright (c) 2016-2019 Martin Jäger (www.libre.solar)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef ADC_REPLAY_H
+#define ADC_REPLAY_H
+
+/** @file
+ *
+ * @brief Replay of recorded raw ADC traces through the control stack in native unit tests
+ *
+ * Traces contain the raw readings of complete ADC conversion sequences (NUM_ADC_CH channels in
+ * the order of the ADC_POS_... enum). Two formats are supported:
+ *
+ * - CSV as printed by adc_capture_dump(): one sequence per line with sample index followed by
+ *   12-bit readings, lines starting with # are comments (sample rate is taken from the header)
+ * - Binary: raw DMA buffer content, i.e. left-aligned 16-bit readings in little endian
+ *
+ * Each sequence is passed to adc_update_block() like in the DMA ISR and system_control_fast() is
+ * called after every ADC_DMA_SEQUENCES sequences. system_control() is called with
+ * CONTROL_FREQUENCY and the 1 s tasks of the main loop (load state machine, etc.) can be run as
+ * well. The simulated timestamp is used for time(NULL), so traces are replayed as fast
+ * as possible independent of their duration.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+
+#include "pcb.h"
+
+/** Raw ADC trace
+ */
+typedef struct {
+    std::vector<uint16_t> readings;     ///< Left-aligned readings, NUM_ADC_CH per sequence
+    int sample_rate;                    ///< Sample rate of the sequences (Hz)
+} AdcTrace;
+
+/** Controller state recorded after each call of system_control()
+ */
+typedef struct {
+    uint32_t time_ms;               ///< Simulated time since start of replay
+    float bat_voltage;              ///< Battery terminal voltage (V)
+    float bat_current;              ///< Battery terminal current (A)
+    float solar_voltage;            ///< Solar terminal voltage (V)
+    float solar_current;            ///< Solar terminal current (A)
+    float load_current;             ///< Load terminal current (A)
+    float dcdc_power;               ///< DC/DC output power (W)
+    uint16_t dcdc_state;            ///< DC/DC control state (see DcdcControlState)
+    float dcdc_duty;                ///< Duty cycle of the half bridge
+    unsigned int chg_state;         ///< Charger state (see ChargerState)
+    uint16_t soc;                   ///< Battery state of charge (%)
+} AdcReplayRecord;
+
+/** Replay configuration
+ */
+typedef struct {
+    int repeat;                     ///< Number of times the trace is replayed
+    bool slow_tasks;                ///< Run 1 s tasks of the main loop (load, alerts, etc.)
+    bool record;                    ///< Store AdcReplayRecord after each system_control() call
+} AdcReplayConf;
+
+/** Replay results
+ */
+typedef struct {
+    unsigned long num_sequences;    ///< Number of processed ADC sequences
+    unsigned long num_fast_calls;   ///< Number of system_control_fast() calls
+    unsigned long num_control_calls; ///< Number of system_control() calls
+    double simulated_s;             ///< Simulated time (s)
+    double elapsed_s;               ///< Host CPU (wall clock) time needed for the replay (s)
+    std::vector<AdcReplayRecord> records;
+} AdcReplayResult;
+
+/** Read CSV trace in the format of adc_capture_dump()
+ *
+ * @param file Opened trace file
+ * @param trace Trace to be filled (sample rate defaults to ADC_SAMPLE_FREQUENCY if not found
+ *              in header)
+ *
+ * @returns number of sequences or -1 in case of format error
+ */
+int adc_trace_read_csv(FILE *file, AdcTrace *trace);
+
+/** Read binary trace (raw DMA buffer content)
+ *
+ * @param file Opened trace file
+ * @param trace Trace to be filled
+ * @param sample_rate Sample rate of the recorded sequences (Hz)
+ *
+ * @returns number of sequences or -1 in case of incomplete sequences
+ */
+int adc_trace_read_binary(FILE *file, AdcTrace *trace, int sample_rate);
+
+/** Write trace in CSV format (same as adc_capture_dump())
+ */
+void adc_trace_write_csv(FILE *file, const AdcTrace *trace);
+
+/** Write trace in binary format
+ */
+void adc_trace_write_binary(FILE *file, const AdcTrace *trace);
+
+/** Replay trace through adc_update_block() and system_control()
+ *
+ * The sample rate of the trace must be a multiple of CONTROL_FREQUENCY.
+ *
+ * @param trace Trace to be replayed
+ * @param conf Replay configuration
+ * @param result Replay results (records are appended)
+ */
+void adc_replay(const AdcTrace *trace, const AdcReplayConf *conf, AdcReplayResult *result);
+
+/** Write recorded controller states as CSV, e.g. for regression comparisons
+ */
+void adc_replay_write_records(FILE *file, const AdcReplayResult *result);
+
+#endif /* ADC_REPLAY_H */
@@ -0,0 +1,61 @@
+/* LibreSolar charge controller firmware
+ * Copyright (c) 2016-2019 Martin Jäger (www.libre.solar)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stdio.h>
+#include <chrono>
+
+/** Runs a benchmark only in the benchmark-native environment
+ *
+ * Benchmarks only print execution times without assertions, so they are not part of the normal
+ * unit-test run.
+ */
+#ifdef BENCHMARK
+#define RUN_BENCHMARK(func) RUN_TEST(func)
+#else
+#define RUN_BENCHMARK(func)
+#endif
+
+/** Runs a function several times and returns the average execution time
+ *
+ * Only meaningful for relative comparisons, as the native host has an FPU and a different
+ * instruction set than the Cortex-M0 target.
+ *
+ * @param func Function (or lambda) to be measured
+ * @param iterations Number of calls
+ *
+ * @returns Average execution time in nanoseconds
+ */
+template<typename F>
+double benchmark_ns(F func, int iterations)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        func(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+/** Prints benchmark result in a common format
+ */
+static inline void benchmark_print(const char *name, double value, const char *unit)
+{
+    printf("BENCHMARK %-40s %10.2f %s\n", name, value, unit);
+}
+
+#endif /* BENCHMARK_H */
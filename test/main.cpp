@@ -58,10 +58,18 @@ time_t timestamp;    // current unix timestamp (independent of time(NULL), as it
 int main()
 {
     adc_tests();
+    adc_capture_tests();
     bat_charger_tests();
+    soc_ekf_tests();
+    ocv_curve_tests();
+    resistance_est_tests();
     power_port_tests();
     half_brigde_tests();
     dcdc_tests();
+    mppt_tests();
+    efficiency_map_tests();
     device_status_tests();
     load_tests();
+    plant_sim_tests();      // changes state of all control objects
+    adc_replay_tests();     // must be last, changes state of all control objects
 }
\ No newline at end of file
@@ -0,0 +1,228 @@
+/* LibreSolar charge controller firmware
+ * Copyright (c) 2016-2019 Martin Jäger (www.libre.solar)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "plant_sim.h"
+
+#include "adc_dma.h"
+#include "half_bridge.h"
+#include "hardware.h"
+#include "main.h"
+#include "adc_dma_stub.h"
+
+#include <chrono>
+#include <math.h>
+
+extern time_t timestamp;
+
+// increase of the cell temperature above ambient at 1000 W/m² (°C)
+#define PLANT_CELL_TEMP_RISE    25
+
+float plant_irradiance_clear_sky(double hour)
+{
+    if (hour < 6 || hour > 18) {
+        return 0;
+    }
+    return pow(sin(M_PI * (hour - 6) / 12), 1.5);
+}
+
+float plant_irradiance_cloudy(double hour)
+{
+    float irradiance = plant_irradiance_clear_sky(hour);
+    if (hour > 10 && hour < 14) {
+        // clouds passing every 10 minutes for 2 minutes, shading 70% with 10 s edges
+        float t = fmod((hour - 10) * 3600, 600);
+        float shading = 0;
+        if (t > 300 && t < 310) {
+            shading = (t - 300) / 10;
+        }
+        else if (t >= 310 && t < 410) {
+            shading = 1;
+        }
+        else if (t >= 410 && t < 420) {
+            shading = (420 - t) / 10;
+        }
+        irradiance *= 1 - 0.7 * shading;
+    }
+    return irradiance;
+}
+
+float plant_ambient_temp_summer(double hour)
+{
+    return 17.5 + 7.5 * sin(M_PI * (hour - 9) / 12);
+}
+
+float plant_load_evening(double hour)
+{
+    return (hour >= 18 && hour < 23) ? 2.0 : 0;
+}
+
+/** Battery open circuit voltage incl. steep voltage rise when fully charged
+ */
+static float battery_ocv(const SimBattery *bat)
+{
+    float soc = (bat->soc < 0) ? 0 : bat->soc;
+    return bat->ocv_empty + (bat->ocv_full - bat->ocv_empty) * soc +
+        bat->overcharge_rise * pow(soc, 20);
+}
+
+void plant_sim_init(PlantConf *conf)
+{
+    half_bridge_stop();
+    half_bridge_init(70, 200, 12 / dcdc.hs_voltage_max, 0.97);
+
+    battery_conf_init(&bat_conf, BAT_TYPE_GEL, 6, conf->battery.capacity);
+    battery_init_dc_bus(&bat_terminal, &bat_conf, 1);
+    charger.num_batteries = 1;
+    charger.state = CHG_STATE_IDLE;
+    charger.time_state_changed = 0;
+    charger.res_est.configured = false;
+    solar_terminal.init_solar();
+    load_terminal.init_load(bat_conf.voltage_absolute_max);
+
+#if FEATURE_PWM_SWITCH
+    pwm_switch.enabled = false;     // simulated plant only contains the DC/DC converter
+#endif
+
+    dcdc.mode = MODE_MPPT_BUCK;
+    dcdc.enabled = true;
+    dcdc.off_timestamp = 0;
+    dcdc.temp_mosfets = 25;
+
+    // zero current readings for the offset calibration
+    AdcValues values = {};
+    values.battery_voltage = battery_ocv(&conf->battery);
+    values.bat_temperature = 25;
+    prepare_adc_readings(values);
+    prepare_adc_filtered();
+    calibrate_current_sensors();
+    update_measurements();
+}
+
+/** Operating point of the averaged buck converter between panel and battery
+ *
+ * The battery terminal voltage increases with the charging current, which depends on the panel
+ * voltage V_bat / duty, so it is solved by bisection.
+ */
+static void buck_operating_point(const PvPanel *pv, float irradiance, const SimBattery *bat,
+    float efficiency, float i_load, float *v_pv, float *i_pv, float *v_bat, float *i_dcdc)
+{
+    float ocv = battery_ocv(bat);
+    float voc = pv_open_circuit_voltage(pv, irradiance);
+    float duty = half_bridge_enabled() ? half_bridge_get_duty_cycle() : 0;
+
+    *v_bat = ocv - bat->resistance * i_load;
+    *v_pv = voc;
+    *i_pv = 0;
+    *i_dcdc = 0;
+    if (duty <= 0 || voc <= 0) {
+        return;
+    }
+
+    float v_low = *v_bat;
+    float v_high = *v_bat + bat->resistance * pv->isc * irradiance / duty;
+    for (int i = 0; i < 30; i++) {
+        float v = (v_low + v_high) / 2;
+        float v_in = (v / duty < voc) ? v / duty : voc;
+        float i_out = efficiency * v_in * pv_current(pv, irradiance, v_in) / v;
+        if (v - ocv > bat->resistance * (i_out - i_load)) {
+            v_high = v;
+        }
+        else {
+            v_low = v;
+        }
+    }
+    *v_bat = v_low;
+    *v_pv = (*v_bat / duty < voc) ? *v_bat / duty : voc;
+    *i_pv = pv_current(pv, irradiance, *v_pv);
+    *i_dcdc = efficiency * *v_pv * *i_pv / *v_bat;
+}
+
+void plant_sim_run(PlantConf *conf, double start_hour, double hours, PlantResult *result)
+{
+    const double dt_h = 1.0 / CONTROL_FREQUENCY / 3600;
+    const long num_steps = hours * 3600 * CONTROL_FREQUENCY;
+    SimBattery *bat = &conf->battery;
+    float p_max = 0;
+
+    if (result->simulated_s == 0) {
+        result->soc_min = bat->soc;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (long step = 0; step < num_steps; step++) {
+        double hour = fmod(start_hour + step * dt_h, 24.0);
+        float irradiance = conf->irradiance(hour);
+        float temp_ambient = conf->ambient_temp(hour);
+        PvPanel pv = pv_at_temperature(&conf->panel,
+            temp_ambient + PLANT_CELL_TEMP_RISE * irradiance);
+
+        float i_load = (load.state == LOAD_STATE_ON) ? conf->load_current(hour) : 0;
+        float v_pv, i_pv, v_bat, i_dcdc;
+        buck_operating_point(&pv, irradiance, bat, conf->converter_efficiency, i_load,
+            &v_pv, &i_pv, &v_bat, &i_dcdc);
+
+        // battery state update (coulomb counting)
+        bat->soc += (i_dcdc - i_load) * dt_h / bat->capacity;
+        if (bat->soc > 1) {
+            bat->soc = 1;
+        }
+        if (bat->soc < result->soc_min) {
+            result->soc_min = bat->soc;
+        }
+
+        // theoretical max. power only changes slowly: calculated once per second
+        if (step % CONTROL_FREQUENCY == 0) {
+            p_max = pv_max_power_unshaded(&pv, irradiance);
+        }
+        result->energy_pv += v_pv * i_pv * dt_h;
+        result->energy_pv_max += p_max * dt_h;
+        if (dcdc.state == DCDC_STATE_MPPT && half_bridge_enabled()) {
+            result->energy_mppt += v_pv * i_pv * dt_h;
+            result->energy_mppt_max += p_max * dt_h;
+        }
+        if (i_dcdc > i_load) {
+            result->energy_bat_in += v_bat * (i_dcdc - i_load) * dt_h;
+        }
+        result->energy_load += v_bat * i_load * dt_h;
+
+        // measurements of the firmware
+        AdcValues values = {};
+        values.solar_voltage = v_pv;
+        values.battery_voltage = v_bat;
+        values.dcdc_current = i_dcdc;
+        values.load_current = i_load;
+        values.bat_temperature = temp_ambient;
+        values.internal_temperature = temp_ambient;
+        prepare_adc_readings(values);
+        prepare_adc_filtered();
+
+        // plant state is only updated once per control cycle, so the fast tier is called once
+        system_control_fast();
+        system_control();
+        system_control_slow();
+
+        // 1 s tasks of the main loop
+        if (step % CONTROL_FREQUENCY == CONTROL_FREQUENCY - 1) {
+            load.state_machine();
+        }
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    result->elapsed_s += std::chrono::duration<double>(end - start).count();
+    result->simulated_s += num_steps / (double)CONTROL_FREQUENCY;
+    result->soc_end = bat->soc;
+}
@@ -0,0 +1,108 @@
+/* LibreSolar charge controller firmware
+ * Copyright (c) 2016-2019 Martin Jäger (www.libre.solar)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef PLANT_SIM_H
+#define PLANT_SIM_H
+
+/** @file
+ *
+ * @brief Closed-loop simulation of PV panel, buck converter, battery and load for native tests
+ *
+ * The plant state is converted into ADC readings (prepare_adc_readings) in every control cycle,
+ * so that the complete firmware control path is used: update_measurements(), the fast tier,
+ * Dcdc::control() with MPPT and the half bridge, the charger state machine, SOC estimation and
+ * the load state machine. The simulated time is used for time(NULL), so a day is simulated in
+ * a few seconds.
+ *
+ * Plant models:
+ *
+ * - PV panel: single diode model (see pv_model.h) with cell temperature depending on ambient
+ *   temperature and irradiance
+ * - Buck converter: averaged model in continuous conduction mode with constant efficiency
+ * - Battery: OCV depending on SOC (incl. steep rise when fully charged) and internal resistance
+ * - Load: current profile, only drawn while the load output is switched on
+ */
+
+#include "pv_model.h"
+
+/** Simulated battery
+ */
+typedef struct {
+    float capacity;             ///< Capacity (Ah)
+    float ocv_empty;            ///< Open circuit voltage at 0% SOC (V)
+    float ocv_full;             ///< Open circuit voltage at 100% SOC, without overcharge rise (V)
+    float overcharge_rise;      ///< Additional voltage rise at 100% SOC when charging (V)
+    float resistance;           ///< Internal resistance (Ohm)
+    float soc;                  ///< Actual state of charge (0 to 1)
+} SimBattery;
+
+/** Plant configuration incl. profiles as function of the hour of day
+ */
+typedef struct {
+    PvPanel panel;                          ///< Panel parameters at 25°C
+    SimBattery battery;                     ///< Battery parameters and initial SOC
+    float converter_efficiency;             ///< Efficiency of the DC/DC converter
+    float (*irradiance)(double hour);       ///< Irradiance relative to 1000 W/m²
+    float (*ambient_temp)(double hour);     ///< Ambient temperature (°C)
+    float (*load_current)(double hour);     ///< Current drawn by the load if switched on (A)
+} PlantConf;
+
+/** Simulation results
+ */
+typedef struct {
+    double simulated_s;         ///< Simulated time (s)
+    double elapsed_s;           ///< Host CPU (wall clock) time needed for the simulation (s)
+    double energy_pv;           ///< Energy harvested from the PV panel (Wh)
+    double energy_pv_max;       ///< Theoretical max. energy of the PV panel (Wh)
+    double energy_mppt;         ///< Harvested energy while the DC/DC was in MPPT state (Wh)
+    double energy_mppt_max;     ///< Theoretical max. energy while the DC/DC was in MPPT state (Wh)
+    double energy_bat_in;       ///< Energy charged into the battery (Wh)
+    double energy_load;         ///< Energy supplied to the load (Wh)
+    float soc_min;              ///< Min. simulated battery SOC (0 to 1)
+    float soc_end;              ///< Simulated battery SOC at the end (0 to 1)
+} PlantResult;
+
+/** Clear-sky irradiance between 6:00 and 18:00
+ */
+float plant_irradiance_clear_sky(double hour);
+
+/** Clear-sky irradiance with passing clouds around noon
+ */
+float plant_irradiance_cloudy(double hour);
+
+/** Ambient temperature between 10°C at night and 25°C in the afternoon
+ */
+float plant_ambient_temp_summer(double hour);
+
+/** Load of 2 A in the evening (18:00 to 23:00)
+ */
+float plant_load_evening(double hour);
+
+/** Initializes the firmware objects (battery, charger, ports, DC/DC) for the simulated plant
+ *
+ * @param conf Plant configuration
+ */
+void plant_sim_init(PlantConf *conf);
+
+/** Runs the closed-loop simulation
+ *
+ * @param conf Plant configuration (battery SOC is updated)
+ * @param start_hour Hour of day at the start of the simulation
+ * @param hours Duration of the simulation (h)
+ * @param result Simulation results (energies are accumulated)
+ */
+void plant_sim_run(PlantConf *conf, double start_hour, double hours, PlantResult *result);
+
+#endif /* PLANT_SIM_H */
@@ -0,0 +1,166 @@
+/* LibreSolar charge controller firmware
+ * Copyright (c) 2016-2019 Martin Jäger (www.libre.solar)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pv_model.h"
+
+#include "half_bridge.h"
+#include "main.h"
+
+#include <math.h>
+
+float pv_current(const PvPanel *pv, float irradiance, float voltage)
+{
+    // saturation current such that I = 0 at Voc for 1000 W/m²
+    float i_sat = pv->isc / (exp(pv->voc / pv->vt) - 1);
+    float current = pv->isc * irradiance - i_sat * (exp(voltage / pv->vt) - 1);
+    return (current > 0) ? current : 0;
+}
+
+PvPanel pv_at_temperature(const PvPanel *pv, float temp_cell)
+{
+    PvPanel pv_temp;
+    pv_temp.isc = pv->isc * (1 + PV_TEMP_COEFF_ISC * (temp_cell - 25));
+    pv_temp.voc = pv->voc * (1 + PV_TEMP_COEFF_VOC * (temp_cell - 25));
+    pv_temp.vt = pv->vt * (273.15 + temp_cell) / 298.15;
+    return pv_temp;
+}
+
+// forward voltage of bypass diodes
+#define PV_BYPASS_DIODE_VOLTAGE 0.4
+
+/** Voltage of one half of the panel at given current (incl. bypass diode)
+ */
+static float pv_half_voltage(const PvPanel *pv, float irradiance, float current)
+{
+    float vt = pv->vt / 2;
+    float i_sat = pv->isc / (exp(pv->voc / pv->vt) - 1);
+    float i_ph = pv->isc * irradiance;
+    if (current >= i_ph) {
+        return -PV_BYPASS_DIODE_VOLTAGE;
+    }
+    return vt * log((i_ph - current) / i_sat + 1);
+}
+
+float pv_current_shaded(const PvPanel *pv, float irradiance, float shading, float voltage)
+{
+    if (shading >= 1.0) {
+        return pv_current(pv, irradiance, voltage);
+    }
+
+    // voltage is monotonically decreasing with current: find current by bisection
+    float i_low = 0;
+    float i_high = pv->isc * irradiance;
+    for (int i = 0; i < 30; i++) {
+        float current = (i_low + i_high) / 2;
+        float v = pv_half_voltage(pv, irradiance, current) +
+            pv_half_voltage(pv, irradiance * shading, current);
+        if (v > voltage) {
+            i_low = current;
+        }
+        else {
+            i_high = current;
+        }
+    }
+    return i_low;
+}
+
+float pv_open_circuit_voltage(const PvPanel *pv, float irradiance)
+{
+    if (irradiance <= 0) {
+        return 0;
+    }
+    float i_sat = pv->isc / (exp(pv->voc / pv->vt) - 1);
+    return pv->vt * log(pv->isc * irradiance / i_sat + 1);
+}
+
+float pv_max_power(const PvPanel *pv, float irradiance, float shading)
+{
+    float voc = pv_open_circuit_voltage(pv, irradiance);
+    float p_max = 0;
+    for (float v = 0; v < voc; v += 0.01) {
+        float p = v * pv_current_shaded(pv, irradiance, shading, v);
+        if (p > p_max) {
+            p_max = p;
+        }
+    }
+    return p_max;
+}
+
+float pv_max_power_unshaded(const PvPanel *pv, float irradiance)
+{
+    const float ratio = 0.618034;
+    float v_low = 0;
+    float v_high = pv_open_circuit_voltage(pv, irradiance);
+    for (int i = 0; i < 30; i++) {
+        float v1 = v_high - ratio * (v_high - v_low);
+        float v2 = v_low + ratio * (v_high - v_low);
+        if (v1 * pv_current(pv, irradiance, v1) < v2 * pv_current(pv, irradiance, v2)) {
+            v_low = v1;
+        }
+        else {
+            v_high = v2;
+        }
+    }
+    float v = (v_low + v_high) / 2;
+    return v * pv_current(pv, irradiance, v);
+}
+
+float pv_buck_control_step(const PvPanel *pv, float irradiance, float bat_voltage,
+    float shading, float bat_resistance, float switching_loss)
+{
+    float voc = pv_open_circuit_voltage(pv, irradiance);
+    float v_bat = bat_voltage;
+    float v_in = voc;
+    float i_in = 0;
+    if (half_bridge_enabled()) {
+        float duty = half_bridge_get_duty_cycle();
+
+        // battery terminal voltage increases with charge current I_bat = I_in / duty, solved by
+        // bisection (continuous conduction mode, panel cannot exceed its open circuit voltage)
+        float v_low = bat_voltage;
+        float v_high = bat_voltage + bat_resistance * pv->isc * irradiance / duty;
+        for (int i = 0; i < 30 && bat_resistance > 0; i++) {
+            float v = (v_low + v_high) / 2;
+            float v_pv = (v / duty < voc) ? v / duty : voc;
+            if (v - bat_voltage > bat_resistance *
+                pv_current_shaded(pv, irradiance, shading, v_pv) / duty) {
+                v_high = v;
+            }
+            else {
+                v_low = v;
+            }
+        }
+        v_bat = v_low;
+        v_in = (v_bat / duty < voc) ? v_bat / duty : voc;
+        i_in = pv_current_shaded(pv, irradiance, shading, v_in);
+    }
+    float power = v_in * i_in;
+    float power_out = power;
+    if (half_bridge_enabled()) {
+        power_out -= switching_loss / half_bridge_get_frequency_divider();
+    }
+
+    hv_terminal.voltage = v_in;
+    hv_terminal.current = -i_in;
+    hv_terminal.power = -power;
+    dcdc_lv_port.voltage = v_bat;
+    dcdc_lv_port.current = power_out / v_bat;
+    dcdc_lv_port.power = power_out;
+
+    dcdc.control();
+
+    return power_out;
+}
@@ -0,0 +1,105 @@
+/* LibreSolar charge controller firmware
+ * Copyright (c) 2016-2019 Martin Jäger (www.libre.solar)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef PV_MODEL_H
+#define PV_MODEL_H
+
+/** @file
+ *
+ * @brief Simple PV panel model and closed-loop buck converter for native MPPT tests
+ */
+
+/** PV panel parameters (single diode model without series and parallel resistance)
+ */
+typedef struct {
+    float isc;          ///< Short circuit current at 1000 W/m² (A)
+    float voc;          ///< Open circuit voltage at 1000 W/m² (V)
+    float vt;           ///< Thermal voltage of all cells in series incl. ideality factor (V)
+} PvPanel;
+
+/** Temperature coefficients of crystalline silicon cells (relative change per K)
+ */
+#define PV_TEMP_COEFF_VOC   -0.0032
+#define PV_TEMP_COEFF_ISC   0.0005
+
+/** Panel parameters at a different cell temperature
+ *
+ * @param pv Panel parameters at standard test conditions (25°C)
+ * @param temp_cell Cell temperature (°C)
+ */
+PvPanel pv_at_temperature(const PvPanel *pv, float temp_cell);
+
+/** Current of PV panel at given voltage
+ *
+ * @param pv Panel parameters
+ * @param irradiance Irradiance relative to 1000 W/m²
+ * @param voltage Panel voltage
+ *
+ * @returns panel current (A), never negative (blocking diode)
+ */
+float pv_current(const PvPanel *pv, float irradiance, float voltage);
+
+/** Current of partially shaded PV panel at given voltage
+ *
+ * The panel consists of two halves with one bypass diode each. The second half receives only
+ * a part of the irradiance, which results in two local maxima of the P-V curve.
+ *
+ * @param pv Panel parameters
+ * @param irradiance Irradiance of the first half relative to 1000 W/m²
+ * @param shading Irradiance of the second half relative to the first half
+ * @param voltage Panel voltage
+ *
+ * @returns panel current (A), never negative (blocking diode)
+ */
+float pv_current_shaded(const PvPanel *pv, float irradiance, float shading, float voltage);
+
+/** Voltage of PV panel in open circuit condition
+ */
+float pv_open_circuit_voltage(const PvPanel *pv, float irradiance);
+
+/** Theoretical maximum power of the PV panel (found by fine voltage sweep)
+ *
+ * @param pv Panel parameters
+ * @param irradiance Irradiance relative to 1000 W/m²
+ * @param shading Irradiance of the second half relative to the first half
+ */
+float pv_max_power(const PvPanel *pv, float irradiance, float shading = 1.0);
+
+/** Theoretical maximum power of an unshaded PV panel (found by golden-section search)
+ *
+ * Much faster than pv_max_power, as the P-V curve has only one maximum without shading.
+ */
+float pv_max_power_unshaded(const PvPanel *pv, float irradiance);
+
+/** Closed-loop step of a buck converter connected to a PV panel and a battery
+ *
+ * The panel voltage is calculated from the actual duty cycle of the half bridge, the resulting
+ * voltages, currents and powers are written to hv_terminal and dcdc_lv_port before calling
+ * dcdc.control() once. Only switching losses are considered (proportional to the switching
+ * frequency, other losses are neglected).
+ *
+ * @param pv Panel parameters
+ * @param irradiance Irradiance relative to 1000 W/m²
+ * @param bat_voltage Battery open circuit voltage
+ * @param shading Irradiance of the second half relative to the first half
+ * @param bat_resistance Battery internal resistance (0 = stiff battery)
+ * @param switching_loss Switching losses at full switching frequency (W)
+ *
+ * @returns power delivered to the battery in this step (W)
+ */
+float pv_buck_control_step(const PvPanel *pv, float irradiance, float bat_voltage,
+    float shading = 1.0, float bat_resistance = 0, float switching_loss = 0);
+
+#endif /* PV_MODEL_H */
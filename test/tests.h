@@ -3,14 +3,30 @@
 
 void bat_charger_tests();
 
+void soc_ekf_tests();
+
+void ocv_curve_tests();
+
+void resistance_est_tests();
+
 void adc_tests();
 
+void adc_capture_tests();
+
 void power_port_tests();
 
 void half_brigde_tests();
 
 void dcdc_tests();
 
+void mppt_tests();
+
+void efficiency_map_tests();
+
 void device_status_tests();
 
 void load_tests();
+
+void plant_sim_tests();
+
+void adc_replay_tests();
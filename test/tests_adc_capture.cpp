@@ -0,0 +1,84 @@
+#include "tests.h"
+#include "adc_capture.h"
+#include "device_status.h"
+#include "pcb.h"
+
+extern DeviceStatus dev_stat;
+
+static void feed_samples(int num, uint16_t start_value)
+{
+    uint16_t readings[NUM_ADC_CH];
+    for (int s = 0; s < num; s++) {
+        for (int i = 0; i < NUM_ADC_CH; i++) {
+            readings[i] = (uint16_t)(start_value + s) << 4;
+        }
+        adc_capture_sample(readings);
+    }
+}
+
+void capture_keeps_pre_and_post_trigger_samples()
+{
+    adc_capture_arm();
+    feed_samples(ADC_CAPTURE_DEPTH * 2, 0);     // ring buffer overflow before trigger
+    adc_capture_trigger(ERR_BAT_OVERVOLTAGE);
+    TEST_ASSERT_EQUAL(ADC_CAPTURE_TRIGGERED, adc_capture.state);
+
+    feed_samples(ADC_CAPTURE_DEPTH - ADC_CAPTURE_PRE_TRIGGER, 1000);
+    TEST_ASSERT_EQUAL(ADC_CAPTURE_FROZEN, adc_capture.state);
+    TEST_ASSERT_EQUAL(ERR_BAT_OVERVOLTAGE, adc_capture.cause);
+
+    // last sample before and first sample after trigger
+    TEST_ASSERT_EQUAL(ADC_CAPTURE_DEPTH * 2 - 1, adc_capture_read(-1, 0));
+    TEST_ASSERT_EQUAL(1000, adc_capture_read(0, 0));
+    TEST_ASSERT_EQUAL(ADC_CAPTURE_DEPTH * 2 - ADC_CAPTURE_PRE_TRIGGER,
+        adc_capture_read(-ADC_CAPTURE_PRE_TRIGGER, 0));
+}
+
+void capture_frozen_until_rearmed()
+{
+    adc_capture_arm();
+    feed_samples(10, 0);
+    adc_capture_trigger(ERR_BAT_OVERVOLTAGE);
+    feed_samples(ADC_CAPTURE_DEPTH, 1000);
+
+    // further samples and triggers must not change buffer
+    adc_capture_trigger(ERR_BAT_UNDERVOLTAGE);
+    feed_samples(10, 2000);
+    TEST_ASSERT_EQUAL(ERR_BAT_OVERVOLTAGE, adc_capture.cause);
+    TEST_ASSERT_EQUAL(10, adc_capture_num_pre_trigger());
+    TEST_ASSERT_EQUAL(0, adc_capture_read(-10, 0));
+    TEST_ASSERT_EQUAL(1000, adc_capture_read(0, 0));
+
+    adc_capture_arm();
+    TEST_ASSERT_EQUAL(ADC_CAPTURE_ARMED, adc_capture.state);
+    TEST_ASSERT_EQUAL(0, adc_capture_num_samples());
+}
+
+void capture_triggered_by_new_error_flag()
+{
+    dev_stat.clear_error(ERR_ANY_ERROR);
+    dev_stat.set_error(ERR_BAT_UNDERVOLTAGE);
+    adc_capture_arm();
+
+    // flag already set: no trigger
+    dev_stat.set_error(ERR_BAT_UNDERVOLTAGE);
+    TEST_ASSERT_EQUAL(ADC_CAPTURE_ARMED, adc_capture.state);
+
+    dev_stat.set_error(ERR_BAT_UNDERVOLTAGE | ERR_LOAD_SHORT_CIRCUIT);
+    TEST_ASSERT_EQUAL(ADC_CAPTURE_TRIGGERED, adc_capture.state);
+    TEST_ASSERT_EQUAL(ERR_LOAD_SHORT_CIRCUIT, adc_capture.cause);
+
+    dev_stat.clear_error(ERR_ANY_ERROR);
+    adc_capture_arm();
+}
+
+void adc_capture_tests()
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(capture_keeps_pre_and_post_trigger_samples);
+    RUN_TEST(capture_frozen_until_rearmed);
+    RUN_TEST(capture_triggered_by_new_error_flag);
+
+    UNITY_END();
+}
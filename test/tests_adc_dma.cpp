@@ -4,6 +4,9 @@
 #include "adc_dma_stub.h"
 
 #include "main.h"
+#include "benchmark.h"
+#include "ntc.h"
+#include "pcb.h"
 
 static AdcValues adcval;
 
@@ -34,6 +37,76 @@ void check_filtering()
     TEST_ASSERT_EQUAL(get_adc_filtered(ADC_POS_V_SOLAR), adc_filtered_bak[ADC_POS_V_SOLAR]);
 }
 
+void check_median_spike_rejection()
+{
+    set_adc_filtered(ADC_POS_I_LOAD, 1000);
+
+    // single spike must not have any effect on fast or slow view
+    set_adc_reading(ADC_POS_I_LOAD, 4000);
+    adc_update_value(ADC_POS_I_LOAD);
+    set_adc_reading(ADC_POS_I_LOAD, 1000);
+    adc_update_value(ADC_POS_I_LOAD);
+    TEST_ASSERT_EQUAL(1000, get_adc_filtered_fast(ADC_POS_I_LOAD));
+    TEST_ASSERT_EQUAL(1000, get_adc_filtered(ADC_POS_I_LOAD));
+
+    prepare_adc_readings(adcval);
+    prepare_adc_filtered();
+}
+
+void check_fast_view_faster_than_slow_view()
+{
+    set_adc_filtered(ADC_POS_I_LOAD, 1000);
+    set_adc_reading(ADC_POS_I_LOAD, 2000);
+    for (int i = 0; i < 10; i++) {
+        adc_update_value(ADC_POS_I_LOAD);
+    }
+    TEST_ASSERT(get_adc_filtered_fast(ADC_POS_I_LOAD) > 1900);
+    TEST_ASSERT(get_adc_filtered(ADC_POS_I_LOAD) < 1500);
+
+    prepare_adc_readings(adcval);
+    prepare_adc_filtered();
+}
+
+void check_decimation()
+{
+    // temperatures: slow view updated only once per 16 samples
+    set_adc_filtered(ADC_POS_TEMP_BAT, 1000);
+    set_adc_reading(ADC_POS_TEMP_BAT, 2000);
+    for (int i = 0; i < 15; i++) {
+        adc_update_value(ADC_POS_TEMP_BAT);
+    }
+    TEST_ASSERT_EQUAL(1000, get_adc_filtered(ADC_POS_TEMP_BAT));
+    adc_update_value(ADC_POS_TEMP_BAT);
+    TEST_ASSERT(get_adc_filtered(ADC_POS_TEMP_BAT) > 1000);
+
+    prepare_adc_readings(adcval);
+    prepare_adc_filtered();
+}
+
+void check_pwm_synchronous_solar_sampling()
+{
+    // PWM switch off: solar channels sampled exactly once per PWM period
+    const int seq_per_period = ADC_SAMPLE_FREQUENCY / PWM_FREQUENCY;
+    uint16_t block[seq_per_period * NUM_ADC_CH];
+
+    prepare_adc_readings(adcval);
+    prepare_adc_filtered();
+    set_adc_filtered(ADC_POS_V_SOLAR, 1000);
+    for (int s = 0; s < seq_per_period; s++) {
+        set_adc_reading(ADC_POS_V_SOLAR, 2000);
+        for (int i = 0; i < NUM_ADC_CH; i++) {
+            block[s * NUM_ADC_CH + i] = get_adc_reading(i);
+        }
+    }
+    adc_update_block(block, seq_per_period);
+
+    // only one EMA step with filter constant 1/2
+    TEST_ASSERT_EQUAL(1500, get_adc_filtered_fast(ADC_POS_V_SOLAR));
+
+    prepare_adc_readings(adcval);
+    prepare_adc_filtered();
+}
+
 void check_solar_terminal_readings()
 {
     TEST_ASSERT_EQUAL_FLOAT(adcval.solar_voltage, round(hv_terminal.voltage * 10) / 10);
@@ -41,6 +114,23 @@ void check_solar_terminal_readings()
         -round(hv_terminal.current * 10) / 10);
 }
 
+void check_hv_current_fixed_point()
+{
+    update_measurements();
+
+    // rounded instead of truncated, so max. error is 1 mA
+    TEST_ASSERT_FLOAT_WITHIN(0.001, dcdc_lv_port.current * lv_terminal.voltage / hv_terminal.voltage,
+        -hv_terminal.current);
+
+    // HV side voltage below half of LV side voltage: no current possible
+    set_adc_filtered(ADC_POS_V_SOLAR, get_adc_filtered(ADC_POS_V_BAT) / 4);
+    update_measurements();
+    TEST_ASSERT_EQUAL_FLOAT(0, hv_terminal.current);
+
+    prepare_adc_filtered();
+    update_measurements();
+}
+
 void check_bat_terminal_readings()
 {
     TEST_ASSERT_EQUAL_FLOAT(adcval.battery_voltage, round(lv_terminal.voltage * 10) / 10);
@@ -65,6 +155,172 @@ void check_temperature_readings()
     TEST_ASSERT_EQUAL_FLOAT(adcval.bat_temperature, round(charger.bat_temperature * 10) / 10);
 }
 
+/** Fixed-point scaling must match the floating point reference within 1 LSB of the ADC
+ */
+void check_fixed_point_scaling()
+{
+    const uint32_t channels[] = { ADC_POS_V_BAT, ADC_POS_V_SOLAR, ADC_POS_I_LOAD, ADC_POS_I_DCDC };
+    const float gains[] = { ADC_GAIN_V_BAT, ADC_GAIN_V_SOLAR, ADC_GAIN_I_LOAD, ADC_GAIN_I_DCDC };
+
+    set_adc_filtered(ADC_POS_VREF_MCU, (uint32_t)(1.224 / 3.3 * 4096));
+
+    for (unsigned int ch = 0; ch < sizeof(channels) / sizeof(channels[0]); ch++) {
+        float lsb = 3.3 / 4096 * gains[ch];
+        for (uint32_t raw = 0; raw < 4096; raw++) {
+            set_adc_filtered(channels[ch], raw);
+            TEST_ASSERT_FLOAT_WITHIN(lsb, adc_scaled_float(channels[ch], gains[ch]),
+                adc_scaled_fixed(channels[ch]));
+        }
+    }
+    prepare_adc_filtered();
+}
+
+void benchmark_fixed_point_scaling()
+{
+    volatile float sink = 0;
+    set_adc_filtered(ADC_POS_VREF_MCU, (uint32_t)(1.224 / 3.3 * 4096));
+
+    double t_float = benchmark_ns([&](int i) {
+        set_adc_filtered(ADC_POS_V_BAT, i & 0xFFF);
+        sink = adc_scaled_float(ADC_POS_V_BAT, ADC_GAIN_V_BAT);
+    }, 1000000);
+    double t_fixed = benchmark_ns([&](int i) {
+        set_adc_filtered(ADC_POS_V_BAT, i & 0xFFF);
+        sink = adc_scaled_fixed(ADC_POS_V_BAT);
+    }, 1000000);
+    double t_update = benchmark_ns([&](int i) {
+        update_measurements();
+    }, 100000);
+
+    benchmark_print("adc_scaled (float)", t_float, "ns");
+    benchmark_print("adc_scaled (fixed-point)", t_fixed, "ns");
+    benchmark_print("update_measurements", t_update, "ns");
+    (void)sink;
+
+    prepare_adc_filtered();
+}
+
+/** Previous floating point calculation of NTC temperature (Beta model)
+ */
+static float ntc_temp_formula(uint32_t adc)
+{
+    float rts = NTC_SERIES_RESISTOR * adc / (4096 - adc);
+    return 1.0/(1.0/(273.15+25) + 1.0/NTC_BETA_VALUE*log(rts/NTC_NOMINAL_RESISTANCE)) - 273.15;
+}
+
+void check_ntc_lookup_table()
+{
+    constexpr NtcTable table =
+        ntc_table_beta(NTC_SERIES_RESISTOR, NTC_BETA_VALUE, NTC_NOMINAL_RESISTANCE);
+
+    for (uint32_t adc = 1; adc < 4096; adc++) {
+        float temp = ntc_temp_formula(adc);
+        if (temp > -30 && temp < 110) {
+            // relevant range: max. interpolation error 0.3°C
+            TEST_ASSERT_FLOAT_WITHIN(0.3, temp, table.lookup(adc) * 0.01);
+        }
+    }
+
+    // no sensor connected (ADC input pulled to VCC) must result in < -50°C
+    TEST_ASSERT(table.lookup(4095) < -5000);
+}
+
+void check_ntc_steinhart_hart()
+{
+    // Semitec 103AT-2 coefficients
+    constexpr double a = 0.8781e-3;
+    constexpr double b = 2.5302e-4;
+    constexpr double c = 1.8542e-7;
+    constexpr NtcTable table(10000.0, a, b, c);
+
+    for (uint32_t adc = 512; adc < 3584; adc += 7) {
+        double ln_r = log(10000.0 * adc / (4096 - adc));
+        double temp = 1.0 / (a + b * ln_r + c * ln_r * ln_r * ln_r) - 273.15;
+        TEST_ASSERT_FLOAT_WITHIN(0.3, temp, table.lookup(adc) * 0.01);
+    }
+}
+
+static void reset_calibration()
+{
+    for (int i = 0; i < ADC_CAL_NUM; i++) {
+        adc_cal[i] = { 1.0, 0.0, 0.0, 1.0 };
+    }
+    adc_calibration_update();
+    update_measurements();
+}
+
+void check_calibration_gain_offset()
+{
+    update_measurements();
+    float v_bat_nominal = lv_terminal.voltage;
+    float i_load_nominal = load_terminal.current;
+
+    adc_cal[ADC_CAL_V_BAT].gain = 1.02;
+    adc_cal[ADC_CAL_V_BAT].offset = -0.1;
+    adc_cal[ADC_CAL_I_LOAD].gain = 0.95;
+    adc_cal[ADC_CAL_I_LOAD].offset = 0.05;
+    TEST_ASSERT_TRUE(adc_calibration_update());
+    update_measurements();
+
+    TEST_ASSERT_FLOAT_WITHIN(0.005, v_bat_nominal * 1.02 - 0.1, lv_terminal.voltage);
+    TEST_ASSERT_FLOAT_WITHIN(0.005, i_load_nominal * 0.95 + 0.05, load_terminal.current);
+
+    reset_calibration();
+    TEST_ASSERT_EQUAL_FLOAT(v_bat_nominal, lv_terminal.voltage);
+}
+
+void check_calibration_piecewise()
+{
+    update_measurements();
+    float v_solar_nominal = hv_terminal.voltage;
+
+    // knee below measured value: second segment used
+    adc_cal[ADC_CAL_V_SOLAR].knee = 20.0;
+    adc_cal[ADC_CAL_V_SOLAR].gain_high = 1.1;
+    TEST_ASSERT_TRUE(adc_calibration_update());
+    update_measurements();
+    TEST_ASSERT_FLOAT_WITHIN(0.005, 20.0 + (v_solar_nominal - 20.0) * 1.1, hv_terminal.voltage);
+
+    // knee above measured value: only first segment used
+    adc_cal[ADC_CAL_V_SOLAR].knee = 40.0;
+    TEST_ASSERT_TRUE(adc_calibration_update());
+    update_measurements();
+    TEST_ASSERT_FLOAT_WITHIN(0.001, v_solar_nominal, hv_terminal.voltage);
+
+    reset_calibration();
+}
+
+void check_calibration_invalid_reset()
+{
+    adc_cal[ADC_CAL_I_SOLAR].gain = 3.0;
+    adc_cal[ADC_CAL_V_BAT].gain = 1.01;
+    TEST_ASSERT_FALSE(adc_calibration_update());
+
+    // only invalid channel is reset
+    TEST_ASSERT_EQUAL_FLOAT(1.0, adc_cal[ADC_CAL_I_SOLAR].gain);
+    TEST_ASSERT_EQUAL_FLOAT(1.01, adc_cal[ADC_CAL_V_BAT].gain);
+
+    reset_calibration();
+}
+
+void benchmark_ntc_lookup_table()
+{
+    static constexpr NtcTable table =
+        ntc_table_beta(NTC_SERIES_RESISTOR, NTC_BETA_VALUE, NTC_NOMINAL_RESISTANCE);
+    volatile float sink = 0;
+
+    double t_formula = benchmark_ns([&](int i) {
+        sink = ntc_temp_formula(1 + (i & 0xFFE));
+    }, 1000000);
+    double t_table = benchmark_ns([&](int i) {
+        sink = table.lookup(1 + (i & 0xFFE)) * 0.01;
+    }, 1000000);
+
+    benchmark_print("ntc_temp (log formula)", t_formula, "ns");
+    benchmark_print("ntc_temp (lookup table)", t_table, "ns");
+    (void)sink;
+}
+
 void adc_alert_undervoltage_triggering()
 {
     dev_stat.clear_error(ERR_ANY_ERROR);
@@ -92,6 +348,39 @@ void adc_alert_undervoltage_triggering()
     TEST_ASSERT_EQUAL(false, dev_stat.has_error(ERR_BAT_UNDERVOLTAGE));
 }
 
+void adc_alert_undervoltage_triggering_in_dma_block()
+{
+    dev_stat.clear_error(ERR_ANY_ERROR);
+    battery_conf_init(&bat_conf, BAT_TYPE_LFP, 4, 100);
+    adc_set_lv_alerts(bat_conf.voltage_absolute_max, bat_conf.voltage_absolute_min);
+    prepare_adc_filtered();
+
+    // block of 4 sequences with undervoltage in the last two sequences only
+    uint16_t block[4 * NUM_ADC_CH];
+    AdcValues undervoltage = adcval;
+    undervoltage.battery_voltage = bat_conf.voltage_absolute_min - 0.1;
+    for (int s = 0; s < 4; s++) {
+        prepare_adc_readings(s < 2 ? adcval : undervoltage);
+        for (int i = 0; i < NUM_ADC_CH; i++) {
+            block[s * NUM_ADC_CH + i] = get_adc_reading(i);
+        }
+    }
+
+    adc_update_block(block, 3);
+    TEST_ASSERT_EQUAL(false, dev_stat.has_error(ERR_BAT_UNDERVOLTAGE));
+    adc_update_block(&block[3 * NUM_ADC_CH], 1);
+    TEST_ASSERT_EQUAL(true, dev_stat.has_error(ERR_BAT_UNDERVOLTAGE));
+
+    // reset values
+    adcval.battery_voltage = 13;
+    prepare_adc_readings(adcval);
+    prepare_adc_filtered();
+    update_measurements();
+
+    charger.discharge_control(&bat_conf);
+    TEST_ASSERT_EQUAL(false, dev_stat.has_error(ERR_BAT_UNDERVOLTAGE));
+}
+
 void adc_alert_overvoltage_triggering()
 {
     dev_stat.clear_error(ERR_ANY_ERROR);
@@ -123,6 +412,76 @@ void adc_alert_overvoltage_triggering()
     TEST_ASSERT_EQUAL(false, dev_stat.has_error(ERR_BAT_OVERVOLTAGE));
 }
 
+void adc_alert_limits_calibrated()
+{
+    dev_stat.clear_error(ERR_ANY_ERROR);
+    battery_conf_init(&bat_conf, BAT_TYPE_LFP, 4, 100);
+    adc_cal[ADC_CAL_V_BAT].gain = 1.05;
+    adc_cal[ADC_CAL_V_BAT].offset = 0.1;
+    TEST_ASSERT_TRUE(adc_calibration_update());
+    adc_set_lv_alerts(bat_conf.voltage_absolute_max, bat_conf.voltage_absolute_min);
+    prepare_adc_filtered();
+
+    // measured voltage below limit, but calibrated voltage above
+    adcval.battery_voltage = (bat_conf.voltage_absolute_min + 0.05 - 0.1) / 1.05;
+    prepare_adc_readings(adcval);
+    adc_update_value(ADC_POS_V_BAT);
+    adc_update_value(ADC_POS_V_BAT);
+    adc_update_value(ADC_POS_V_BAT);
+    TEST_ASSERT_EQUAL(false, dev_stat.has_error(ERR_BAT_UNDERVOLTAGE));
+
+    adcval.battery_voltage = (bat_conf.voltage_absolute_min - 0.05 - 0.1) / 1.05;
+    prepare_adc_readings(adcval);
+    adc_update_value(ADC_POS_V_BAT);
+    adc_update_value(ADC_POS_V_BAT);
+    TEST_ASSERT_EQUAL(true, dev_stat.has_error(ERR_BAT_UNDERVOLTAGE));
+
+    // reset values
+    reset_calibration();
+    adc_set_lv_alerts(bat_conf.voltage_absolute_max, bat_conf.voltage_absolute_min);
+    adcval.battery_voltage = 13;
+    prepare_adc_readings(adcval);
+    prepare_adc_filtered();
+    update_measurements();
+
+    charger.discharge_control(&bat_conf);
+    TEST_ASSERT_EQUAL(false, dev_stat.has_error(ERR_BAT_UNDERVOLTAGE));
+}
+
+void adc_alert_overvoltage_inhibit()
+{
+    dev_stat.clear_error(ERR_ANY_ERROR);
+    battery_conf_init(&bat_conf, BAT_TYPE_LFP, 4, 100);
+    adc_set_lv_alerts(bat_conf.voltage_absolute_max, bat_conf.voltage_absolute_min);
+    prepare_adc_filtered();
+
+    adcval.battery_voltage = bat_conf.voltage_absolute_max + 0.1;
+    prepare_adc_readings(adcval);
+
+    // no alert during inhibit time of 10 ms
+    adc_upper_alert_inhibit(ADC_POS_V_BAT, 10);
+    for (int i = 0; i < 10 * ADC_SAMPLE_FREQUENCY / 1000; i++) {
+        adc_update_value(ADC_POS_V_BAT);
+    }
+    TEST_ASSERT_EQUAL(false, dev_stat.has_error(ERR_BAT_OVERVOLTAGE));
+
+    // afterwards 2 consecutive samples needed again
+    adc_update_value(ADC_POS_V_BAT);
+    TEST_ASSERT_EQUAL(false, dev_stat.has_error(ERR_BAT_OVERVOLTAGE));
+    adc_update_value(ADC_POS_V_BAT);
+    TEST_ASSERT_EQUAL(true, dev_stat.has_error(ERR_BAT_OVERVOLTAGE));
+
+    // reset values
+    adcval.battery_voltage = 12;
+    prepare_adc_readings(adcval);
+    prepare_adc_filtered();
+    update_measurements();
+
+    charger.time_state_changed = time(NULL) - bat_conf.time_limit_recharge - 1;
+    charger.charge_control(&bat_conf);
+    TEST_ASSERT_EQUAL(false, dev_stat.has_error(ERR_BAT_OVERVOLTAGE));
+}
+
 /** ADC conversion test
  *
  * Purpose: Check if raw data from 2 voltage and 2 current measurements are converted
@@ -141,19 +500,38 @@ void adc_tests()
     UNITY_BEGIN();
 
     RUN_TEST(check_filtering);
+    RUN_TEST(check_median_spike_rejection);
+    RUN_TEST(check_fast_view_faster_than_slow_view);
+    RUN_TEST(check_decimation);
+    RUN_TEST(check_pwm_synchronous_solar_sampling);
 
     // call original update_measurements function
     update_measurements();
 
     RUN_TEST(check_solar_terminal_readings);
+    RUN_TEST(check_hv_current_fixed_point);
     RUN_TEST(check_bat_terminal_readings);
     RUN_TEST(check_load_terminal_readings);
     RUN_TEST(check_lv_bus_int_readings);
 
-    //RUN_TEST(check_temperature_readings);     // TODO
+    RUN_TEST(check_temperature_readings);
+
+    RUN_TEST(check_calibration_gain_offset);
+    RUN_TEST(check_calibration_piecewise);
+    RUN_TEST(check_calibration_invalid_reset);
+
+    RUN_TEST(check_ntc_lookup_table);
+    RUN_TEST(check_ntc_steinhart_hart);
+    RUN_BENCHMARK(benchmark_ntc_lookup_table);
+
+    RUN_TEST(check_fixed_point_scaling);
+    RUN_BENCHMARK(benchmark_fixed_point_scaling);
 
     RUN_TEST(adc_alert_undervoltage_triggering);
+    RUN_TEST(adc_alert_undervoltage_triggering_in_dma_block);
     RUN_TEST(adc_alert_overvoltage_triggering);
+    RUN_TEST(adc_alert_overvoltage_inhibit);
+    RUN_TEST(adc_alert_limits_calibrated);
 
     UNITY_END();
 }
\ No newline at end of file
@@ -0,0 +1,192 @@
+
+#include "tests.h"
+#include "adc_replay.h"
+#include "adc_dma.h"
+
+#include "main.h"
+#include "benchmark.h"
+#include "control_timing.h"
+#include "pcb.h"
+
+extern time_t timestamp;
+
+/** Creates a trace with constant readings as recorded from a device
+ */
+static void make_trace(AdcTrace *trace, int num_sequences, float bat_voltage, float solar_voltage,
+    float dcdc_current, float load_current)
+{
+    uint16_t seq[NUM_ADC_CH] = {};
+    seq[ADC_POS_VREF_MCU] = (uint16_t)(1.224 / 3.3 * 4096);
+    seq[ADC_POS_V_BAT] = (uint16_t)(bat_voltage / (ADC_GAIN_V_BAT) / 3.3 * 4096);
+    seq[ADC_POS_V_SOLAR] = (uint16_t)(solar_voltage / (ADC_GAIN_V_SOLAR) / 3.3 * 4096);
+    seq[ADC_POS_I_DCDC] = (uint16_t)(dcdc_current / (ADC_GAIN_I_DCDC) / 3.3 * 4096);
+    seq[ADC_POS_I_LOAD] = (uint16_t)(load_current / (ADC_GAIN_I_LOAD) / 3.3 * 4096);
+    seq[ADC_POS_TEMP_BAT] = 2048;       // approx. 30°C
+    seq[ADC_POS_TEMP_MCU] = 632;        // approx. 30°C
+
+    trace->sample_rate = ADC_SAMPLE_FREQUENCY;
+    trace->readings.clear();
+    for (int s = 0; s < num_sequences; s++) {
+        for (int ch = 0; ch < NUM_ADC_CH; ch++) {
+            trace->readings.push_back(seq[ch] << 4);
+        }
+    }
+}
+
+void csv_and_binary_traces_identical()
+{
+    AdcTrace trace, trace_csv, trace_bin;
+    make_trace(&trace, 100, 12.0, 30.0, 3.0, 1.0);
+
+    FILE *f = tmpfile();
+    adc_trace_write_csv(f, &trace);
+    rewind(f);
+    TEST_ASSERT_EQUAL(100, adc_trace_read_csv(f, &trace_csv));
+    fclose(f);
+
+    f = tmpfile();
+    adc_trace_write_binary(f, &trace);
+    rewind(f);
+    TEST_ASSERT_EQUAL(100, adc_trace_read_binary(f, &trace_bin, trace.sample_rate));
+    fclose(f);
+
+    TEST_ASSERT_EQUAL(ADC_SAMPLE_FREQUENCY, trace_csv.sample_rate);
+    TEST_ASSERT_TRUE(trace.readings == trace_csv.readings);
+    TEST_ASSERT_TRUE(trace.readings == trace_bin.readings);
+}
+
+void csv_trace_with_invalid_line_rejected()
+{
+    AdcTrace trace;
+    FILE *f = tmpfile();
+    fprintf(f, "# ADC capture state: 2, cause: 0x00000001, timestamp: 0, sample rate: 2000 Hz\n");
+    fprintf(f, "-1,1,2\n");
+    rewind(f);
+    TEST_ASSERT_EQUAL(-1, adc_trace_read_csv(f, &trace));
+    TEST_ASSERT_EQUAL(2000, trace.sample_rate);
+    fclose(f);
+}
+
+void replay_calls_control_with_control_frequency()
+{
+    AdcTrace trace;
+    AdcReplayConf conf = { 2, true, true };
+    AdcReplayResult result = {};
+    time_t timestamp_start = timestamp;
+
+    make_trace(&trace, ADC_SAMPLE_FREQUENCY, 12.0, 30.0, 3.0, 1.0);    // 1 s
+    adc_replay(&trace, &conf, &result);
+
+    TEST_ASSERT_EQUAL(2 * ADC_SAMPLE_FREQUENCY, result.num_sequences);
+    TEST_ASSERT_EQUAL(2 * CONTROL_FREQUENCY, result.num_control_calls);
+    TEST_ASSERT_EQUAL(2 * CONTROL_FREQUENCY, result.records.size());
+    TEST_ASSERT_EQUAL_FLOAT(2.0, result.simulated_s);
+    TEST_ASSERT_EQUAL(2, timestamp - timestamp_start);
+    TEST_ASSERT_EQUAL(2000, result.records.back().time_ms);
+}
+
+void replay_calls_control_tiers()
+{
+    AdcTrace trace;
+    AdcReplayConf conf = { 3, false, false };
+    AdcReplayResult result = {};
+
+    control_timing_reset();
+    make_trace(&trace, ADC_SAMPLE_FREQUENCY, 12.0, 30.0, 3.0, 1.0);
+    adc_replay(&trace, &conf, &result);
+
+    TEST_ASSERT_EQUAL(3 * ADC_SAMPLE_FREQUENCY / ADC_DMA_SEQUENCES, result.num_fast_calls);
+    TEST_ASSERT_EQUAL(result.num_fast_calls, control_timing[CONTROL_TIER_FAST].num_calls);
+    TEST_ASSERT_EQUAL(3 * CONTROL_FREQUENCY, control_timing[CONTROL_TIER_MEDIUM].num_calls);
+    TEST_ASSERT_EQUAL(3, control_timing[CONTROL_TIER_SLOW].num_calls);
+    for (int i = 0; i < CONTROL_TIER_NUM; i++) {
+        TEST_ASSERT(control_timing[i].wcet_us >= control_timing[i].time_us);
+    }
+
+    control_timing_reset();
+    TEST_ASSERT_EQUAL(0, control_timing[CONTROL_TIER_MEDIUM].wcet_us);
+    TEST_ASSERT_EQUAL(0, control_load_max);
+}
+
+void replay_records_measurements()
+{
+    AdcTrace trace;
+    AdcReplayConf conf = { 1, false, true };
+    AdcReplayResult result = {};
+
+    make_trace(&trace, ADC_SAMPLE_FREQUENCY, 13.0, 25.0, 2.0, 1.0);
+    adc_replay(&trace, &conf, &result);
+
+    // filters have settled at the end of the trace
+    const AdcReplayRecord *rec = &result.records.back();
+    TEST_ASSERT_FLOAT_WITHIN(0.1, 13.0, rec->bat_voltage);
+    TEST_ASSERT_FLOAT_WITHIN(0.1, 1.0, rec->load_current);
+    TEST_ASSERT_FLOAT_WITHIN(0.1, 25.0, hv_terminal.voltage);
+    TEST_ASSERT_FLOAT_WITHIN(0.1, 2.0, dcdc_lv_port.current);
+
+    // header + one line per record
+    char line[200];
+    int num_lines = 0;
+    FILE *f = tmpfile();
+    adc_replay_write_records(f, &result);
+    rewind(f);
+    while (fgets(line, sizeof(line), f) != NULL) {
+        num_lines++;
+    }
+    fclose(f);
+    TEST_ASSERT_EQUAL(CONTROL_FREQUENCY + 1, num_lines);
+}
+
+void replay_time_used_for_timeouts()
+{
+    AdcTrace trace;
+    AdcReplayConf conf = { 5, false, false };
+    AdcReplayResult result = {};
+
+    make_trace(&trace, ADC_SAMPLE_FREQUENCY, 12.0, 30.0, 0.0, 0.0);
+    time_t start = time(NULL);
+    adc_replay(&trace, &conf, &result);
+    TEST_ASSERT_EQUAL(5, time(NULL) - start);
+}
+
+void benchmark_replay()
+{
+    AdcTrace trace;
+    AdcReplayConf conf = { 600, true, false };      // 10 minutes
+    AdcReplayResult result = {};
+
+    make_trace(&trace, ADC_SAMPLE_FREQUENCY, 12.5, 30.0, 3.0, 1.0);
+    adc_replay(&trace, &conf, &result);
+
+    benchmark_print("adc_replay (simulated hours per second)",
+        result.simulated_s / 3600 / result.elapsed_s, "h/s");
+    benchmark_print("adc_replay per ADC sequence",
+        result.elapsed_s * 1e9 / result.num_sequences, "ns");
+
+    // host WCET only indicates the relative cost of the tiers, not the MCU execution time
+    benchmark_print("control tier fast WCET (host)",
+        control_timing[CONTROL_TIER_FAST].wcet_us, "us");
+    benchmark_print("control tier medium WCET (host)",
+        control_timing[CONTROL_TIER_MEDIUM].wcet_us, "us");
+    benchmark_print("control tier slow WCET (host)",
+        control_timing[CONTROL_TIER_SLOW].wcet_us, "us");
+}
+
+/** Replay of raw ADC traces through the control stack
+ *
+ * Must run after the other tests, as the replay changes the state of all control objects.
+ */
+void adc_replay_tests()
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(csv_and_binary_traces_identical);
+    RUN_TEST(csv_trace_with_invalid_line_rejected);
+    RUN_TEST(replay_calls_control_with_control_frequency);
+    RUN_TEST(replay_calls_control_tiers);
+    RUN_TEST(replay_records_measurements);
+    RUN_TEST(replay_time_used_for_timeouts);
+    RUN_BENCHMARK(benchmark_replay);
+
+    UNITY_END();
+}
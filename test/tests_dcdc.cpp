@@ -27,6 +27,7 @@ static void init_structs_buck()
     dcdc.power_prev = 0;
     dcdc.pwm_delta = 1;
     dcdc.enabled = true;
+    dcdc.mppt_algorithm = MPPT_PO_FIXED;
 }
 
 static void start_buck()
@@ -61,6 +62,7 @@ static void init_structs_boost()
     dcdc.power_prev = 0;
     dcdc.pwm_delta = 1;
     dcdc.enabled = true;
+    dcdc.mppt_algorithm = MPPT_PO_FIXED;
 }
 
 static void start_boost()
@@ -73,6 +75,30 @@ static void start_boost()
     TEST_ASSERT_EQUAL(DCDC_STATE_MPPT, dcdc.state);
 }
 
+static void init_structs_nanogrid()
+{
+    half_bridge_stop();
+
+    hv_terminal.init_nanogrid();
+    hv_terminal.voltage = 0;        // nanogrid not yet started up
+    hv_terminal.current = 0;
+    hv_terminal.power = 0;
+
+    battery_conf_init(&bat_conf, BAT_TYPE_GEL, 6, 100);
+    battery_init_dc_bus(&dcdc_lv_port, &bat_conf, 1);
+    dcdc_lv_port.voltage = 13.0;
+    dcdc_lv_port.current = 0;
+    dcdc_lv_port.power = 0;
+
+    dcdc.mode = MODE_NANOGRID;
+    dcdc.temp_mosfets = 25;
+    dcdc.off_timestamp = 0;
+    dcdc.power_prev = 0;
+    dcdc.pwm_delta = 1;
+    dcdc.enabled = true;
+    dcdc.mppt_algorithm = MPPT_PO_FIXED;
+}
+
 void start_valid_mppt_buck()
 {
     init_structs_buck();
@@ -145,6 +171,31 @@ void no_buck_start_if_solar_voltage_low()
     TEST_ASSERT_EQUAL(0, dcdc.check_start_conditions());
 }
 
+void buck_start_if_bat_voltage_below_reconnect()
+{
+    // discharged battery without load: no-load condition of the DC/DC after the start
+    init_structs_buck();
+    dcdc_lv_port.voltage = 12.0;
+    dcdc_lv_port.power = 0;
+    TEST_ASSERT(dcdc_lv_port.voltage < dcdc_lv_port.src_voltage_start);
+
+    half_bridge_init(70, 200, 12 / dcdc.hs_voltage_max, 0.97);
+    dcdc.control();
+    dcdc.control();
+    dcdc.control();    // call multiple times because of startup delay
+    TEST_ASSERT(half_bridge_enabled() == true);
+
+    float pwm_before = half_bridge_get_duty_cycle();
+    dcdc.control();
+    TEST_ASSERT(half_bridge_enabled() == true);
+    TEST_ASSERT(half_bridge_get_duty_cycle() > pwm_before);
+    TEST_ASSERT(dcdc.state != DCDC_STATE_OFF);
+
+    half_bridge_stop();
+    dcdc.state = DCDC_STATE_OFF;
+    dcdc_lv_port.voltage = 14;
+}
+
 // boost
 
 void no_boost_start_if_bat_voltage_low()
@@ -182,6 +233,32 @@ void no_boost_start_if_solar_voltage_low()
     TEST_ASSERT_EQUAL(0, dcdc.check_start_conditions());
 }
 
+// nanogrid
+
+void nanogrid_boost_start_at_zero_voltage()
+{
+    PowerPort hv_terminal_saved = hv_terminal;
+    init_structs_nanogrid();
+    TEST_ASSERT_EQUAL(-1, dcdc.check_start_conditions());
+
+    half_bridge_init(70, 200, 12 / dcdc.hs_voltage_max, 0.97);
+    dcdc.control();
+    dcdc.control();
+    dcdc.control();    // call multiple times because of startup delay
+    TEST_ASSERT(half_bridge_enabled() == true);
+
+    // no load at the nanogrid: voltage is raised
+    float pwm_before = half_bridge_get_duty_cycle();
+    dcdc.control();
+    TEST_ASSERT(half_bridge_enabled() == true);
+    TEST_ASSERT(half_bridge_get_duty_cycle() < pwm_before);
+    TEST_ASSERT(dcdc.state != DCDC_STATE_OFF);
+
+    half_bridge_stop();
+    dcdc.state = DCDC_STATE_OFF;
+    hv_terminal = hv_terminal_saved;
+}
+
 // buck operation
 
 void buck_increasing_power()
@@ -204,6 +281,50 @@ void buck_derating_output_voltage_too_high()
     TEST_ASSERT_EQUAL(DCDC_STATE_CV, dcdc.state);
 }
 
+void buck_invalid_control_gains_limited()
+{
+    start_buck();
+    float kp = dcdc.cv_kp;
+    float ki = dcdc.cv_ki;
+
+    // negative gains (e.g. written via ThingSet) must not result in positive feedback
+    dcdc.cv_kp = -5;
+    dcdc.cv_ki = -10;
+    float pwm_before = half_bridge_get_duty_cycle();
+    dcdc_lv_port.voltage = dcdc_lv_port.sink_voltage_max + 0.1;
+    dcdc.control();
+    TEST_ASSERT(half_bridge_get_duty_cycle() < pwm_before);
+    TEST_ASSERT(dcdc.cv_kp >= 0);
+    TEST_ASSERT(dcdc.cv_ki > 0);
+
+    dcdc.cv_kp = kp;
+    dcdc.cv_ki = ki;
+}
+
+void buck_cv_increase_limited_to_one_count()
+{
+    start_buck();
+
+    // size of one timer count at full switching frequency as duty cycle
+    float pwm_before = half_bridge_get_duty_cycle();
+    half_bridge_duty_cycle_step(1);
+    float count = (half_bridge_get_duty_cycle() - pwm_before) * half_bridge_get_frequency_divider();
+    half_bridge_duty_cycle_step(-1);
+
+    // output voltage slightly below target, e.g. because the input power is limited: the
+    // voltage control may increase the duty cycle by max. one count, then the MPPT takes over
+    dcdc_lv_port.voltage = dcdc_lv_port.sink_voltage_max - 0.05;
+    int cycles = 0;
+    do {
+        dcdc.control();
+        if (dcdc.state == DCDC_STATE_CV) {
+            TEST_ASSERT(half_bridge_get_duty_cycle() - pwm_before <= count * 1.001);
+        }
+    } while (dcdc.state == DCDC_STATE_CV && ++cycles < 10);
+    TEST_ASSERT(cycles > 1);
+    TEST_ASSERT_EQUAL(DCDC_STATE_MPPT, dcdc.state);
+}
+
 void buck_derating_output_current_too_high()
 {
     start_buck();
@@ -248,6 +369,28 @@ void buck_derating_temperature_limits_exceeded()
     TEST_ASSERT(pwm_after < pwm_before);
 }
 
+void buck_derating_no_limit_cycle_at_current_limit()
+{
+    start_buck();
+    float duty_limit = half_bridge_get_duty_cycle();
+
+    // MPPT pushes the duty cycle into the inductor current limit: afterwards it has to continue
+    // away from the limit instead of toggling between derating and MPPT step
+    int derating_cycles = 0;
+    for (int i = 0; i < 20; i++) {
+        dcdc_lv_port.current = (half_bridge_get_duty_cycle() > duty_limit) ?
+            dcdc.ls_current_max + 1 : dcdc.ls_current_max - 1;
+        dcdc.control();
+        if (dcdc.state == DCDC_STATE_DERATING) {
+            derating_cycles++;
+        }
+    }
+    dcdc_lv_port.current = 0;
+
+    TEST_ASSERT(derating_cycles > 0);
+    TEST_ASSERT(derating_cycles <= 2);
+}
+
 void buck_stop_input_power_too_low()
 {
     start_buck();
@@ -282,6 +425,116 @@ void buck_correct_mppt_operation()
     TEST_ASSERT(pwm3 < pwm2);
 }
 
+void buck_adaptive_mppt_large_steps_far_from_mpp()
+{
+    start_buck();
+    dcdc.mppt_algorithm = MPPT_PO_ADAPTIVE;
+    dcdc_lv_port.voltage = 13;      // far from CV target, so that steps are not limited
+
+    float pwm0 = half_bridge_get_duty_cycle();
+    dcdc.control();         // no power change: minimum step
+    float pwm1 = half_bridge_get_duty_cycle();
+    dcdc_lv_port.power = 25;
+    dcdc.control();         // steep slope: max. step
+    float pwm2 = half_bridge_get_duty_cycle();
+    dcdc_lv_port.power = 26;
+    dcdc.control();
+    float pwm3 = half_bridge_get_duty_cycle();
+
+    TEST_ASSERT(pwm1 > pwm0);
+    TEST_ASSERT_FLOAT_WITHIN(0.0001, dcdc.mppt_step_max * (pwm1 - pwm0), pwm2 - pwm1);
+    TEST_ASSERT(pwm3 > pwm2);
+    TEST_ASSERT(pwm3 - pwm2 < pwm2 - pwm1);
+}
+
+void buck_adaptive_mppt_fine_steps_near_mpp()
+{
+    start_buck();
+    dcdc.mppt_algorithm = MPPT_PO_ADAPTIVE;
+
+    dcdc_lv_port.power = 50;
+    dcdc.control();
+    float pwm1 = half_bridge_get_duty_cycle();
+    dcdc_lv_port.power = 50.1;
+    dcdc.control();         // flat power curve: min. step
+    float pwm2 = half_bridge_get_duty_cycle();
+    dcdc_lv_port.power = 50.0;
+    dcdc.control();         // power decreased: direction turns around with min. step
+    float pwm3 = half_bridge_get_duty_cycle();
+
+    TEST_ASSERT(pwm2 > pwm1);
+    TEST_ASSERT_FLOAT_WITHIN(0.0001, pwm2 - pwm1, pwm2 - pwm3);
+}
+
+void buck_adaptive_mppt_step_limits_not_inverted()
+{
+    start_buck();
+    dcdc.mppt_algorithm = MPPT_PO_ADAPTIVE;
+
+    // invalid configuration, e.g. written via ThingSet
+    dcdc.mppt_step_min = 5;
+    dcdc.mppt_step_max = 2;
+    dcdc.control();
+    TEST_ASSERT_EQUAL(5, dcdc.mppt_step_min);
+    TEST_ASSERT(dcdc.mppt_step_max >= dcdc.mppt_step_min);
+
+    dcdc.mppt_step_min = 0;
+    dcdc.control();
+    TEST_ASSERT(dcdc.mppt_step_min >= 1);
+
+    dcdc.mppt_step_min = 1;
+    dcdc.mppt_step_max = 10;
+}
+
+void buck_fast_current_limit_reduces_duty_cycle()
+{
+    start_buck();
+    float pwm_before = half_bridge_get_duty_cycle();
+    dcdc.fast_current_limit(dcdc.ls_current_max * 1000 - 100);
+    TEST_ASSERT_EQUAL_FLOAT(pwm_before, half_bridge_get_duty_cycle());
+    dcdc.fast_current_limit(dcdc.ls_current_max * 1000 + 100);
+    TEST_ASSERT(half_bridge_get_duty_cycle() < pwm_before);
+    dcdc.control();         // limitation is reported to the medium tier
+    TEST_ASSERT_EQUAL(DCDC_STATE_DERATING, dcdc.state);
+}
+
+void buck_fast_current_limit_emergency_stop()
+{
+    start_buck();
+    dcdc.fast_current_limit(dcdc.ls_current_max * 1000 * 1.3);
+    TEST_ASSERT(half_bridge_enabled() == false);
+    dcdc.control();         // state is only updated by the medium tier
+    TEST_ASSERT_EQUAL(DCDC_STATE_OFF, dcdc.state);
+}
+
+void buck_diode_emulation_at_low_current()
+{
+    start_buck();
+    TEST_ASSERT(half_bridge_sync_rectification() == false);     // started without current
+
+    dcdc_lv_port.current = dcdc.sync_current_min * 2;
+    dcdc.control();
+    TEST_ASSERT(half_bridge_sync_rectification() == true);
+
+    // hysteresis
+    dcdc_lv_port.current = dcdc.sync_current_min * 1.1;
+    dcdc.control();
+    TEST_ASSERT(half_bridge_sync_rectification() == true);
+
+    dcdc_lv_port.current = dcdc.sync_current_min * 0.5;
+    dcdc.control();
+    TEST_ASSERT(half_bridge_sync_rectification() == false);
+}
+
+void buck_diode_emulation_disabled()
+{
+    dcdc.sync_current_min = 0;
+    start_buck();
+    dcdc.control();
+    TEST_ASSERT(half_bridge_sync_rectification() == true);
+    dcdc.sync_current_min = 1.0;
+}
+
 // boost operation
 
 void boost_increasing_power()
@@ -379,6 +632,24 @@ void boost_correct_mppt_operation()
     TEST_ASSERT(pwm3 > pwm2);
 }
 
+void boost_fast_current_limit_increases_duty_cycle()
+{
+    start_boost();
+    float pwm_before = half_bridge_get_duty_cycle();
+    dcdc.fast_current_limit(-dcdc.ls_current_max * 1000 - 100);
+    TEST_ASSERT(half_bridge_get_duty_cycle() > pwm_before);
+    dcdc.control();         // limitation is reported to the medium tier
+    TEST_ASSERT_EQUAL(DCDC_STATE_DERATING, dcdc.state);
+}
+
+void boost_always_synchronous()
+{
+    start_boost();
+    TEST_ASSERT(half_bridge_sync_rectification() == true);
+    dcdc.control();
+    TEST_ASSERT(half_bridge_sync_rectification() == true);
+}
+
 void dcdc_tests()
 {
     UNITY_BEGIN();
@@ -400,6 +671,7 @@ void dcdc_tests()
     RUN_TEST(no_buck_start_if_bat_chg_not_allowed);
     RUN_TEST(no_buck_start_if_solar_voltage_high);
     RUN_TEST(no_buck_start_if_solar_voltage_low);
+    RUN_TEST(buck_start_if_bat_voltage_below_reconnect);
 
     // 3. Check startup for MPPT boost converter scenario
 
@@ -411,20 +683,30 @@ void dcdc_tests()
 
     // 4. Check startup for nanogrid scenario
 
-    // TODO
+    RUN_TEST(nanogrid_boost_start_at_zero_voltage);
 
     // 5. Check DC/DC control after being started
 
     // buck mode
     RUN_TEST(buck_increasing_power);
     RUN_TEST(buck_derating_output_voltage_too_high);
+    RUN_TEST(buck_cv_increase_limited_to_one_count);
+    RUN_TEST(buck_invalid_control_gains_limited);
     RUN_TEST(buck_derating_output_current_too_high);
     RUN_TEST(buck_derating_input_voltage_too_low);
     RUN_TEST(buck_derating_input_current_too_high);
     RUN_TEST(buck_derating_temperature_limits_exceeded);
+    RUN_TEST(buck_derating_no_limit_cycle_at_current_limit);
     RUN_TEST(buck_stop_input_power_too_low);
     RUN_TEST(buck_stop_high_voltage_emergency);
     RUN_TEST(buck_correct_mppt_operation);
+    RUN_TEST(buck_adaptive_mppt_large_steps_far_from_mpp);
+    RUN_TEST(buck_adaptive_mppt_fine_steps_near_mpp);
+    RUN_TEST(buck_adaptive_mppt_step_limits_not_inverted);
+    RUN_TEST(buck_fast_current_limit_reduces_duty_cycle);
+    RUN_TEST(buck_fast_current_limit_emergency_stop);
+    RUN_TEST(buck_diode_emulation_at_low_current);
+    RUN_TEST(buck_diode_emulation_disabled);
 
     // boost mode
     RUN_TEST(boost_increasing_power);
@@ -436,6 +718,8 @@ void dcdc_tests()
     RUN_TEST(boost_stop_input_power_too_low);
     RUN_TEST(boost_stop_high_voltage_emergency);
     RUN_TEST(boost_correct_mppt_operation);
+    RUN_TEST(boost_fast_current_limit_increases_duty_cycle);
+    RUN_TEST(boost_always_synchronous);
 
     UNITY_END();
 }
\ No newline at end of file
@@ -0,0 +1,73 @@
+
+#include "tests.h"
+#include "efficiency_map.h"
+#include "benchmark.h"
+
+void eff_map_empty_bins_invalid()
+{
+    eff_map_reset();
+    for (int i = 0; i < EFF_MAP_SAMPLES_MIN - 1; i++) {
+        eff_map_update(0.5, 0.5, 0.95);
+    }
+    TEST_ASSERT_EQUAL(-1, eff_map_get(0.5, 0.5));
+
+    eff_map_update(0.5, 0.5, 0.95);
+    TEST_ASSERT_EQUAL(9500, eff_map_get(0.5, 0.5));
+    TEST_ASSERT_EQUAL(-1, eff_map_get(0.2, 0.5));
+}
+
+void eff_map_mean_of_samples_per_bin()
+{
+    eff_map_reset();
+    for (int i = 0; i < 100; i++) {
+        eff_map_update(0.4, 0.3, (i % 2) ? 0.96 : 0.94);
+        eff_map_update(0.4, 0.9, 0.90);
+    }
+    TEST_ASSERT_EQUAL(9500, eff_map_get(0.4, 0.3));
+    TEST_ASSERT_EQUAL(9000, eff_map_get(0.4, 0.9));
+
+    // operating points outside the range are assigned to the outer bins
+    for (int i = 0; i < 100; i++) {
+        eff_map_update(1.2, -0.1, 0.80);
+    }
+    TEST_ASSERT_EQUAL(8000, eff_map_get(0.99, 0.0));
+}
+
+void eff_map_forgets_old_samples()
+{
+    eff_map_reset();
+    for (int i = 0; i < EFF_MAP_COUNT_MAX; i++) {
+        eff_map_update(0.5, 0.5, 0.96);
+    }
+
+    // degradation: losses doubled
+    for (int i = 0; i < EFF_MAP_COUNT_MAX; i++) {
+        eff_map_update(0.5, 0.5, 0.92);
+    }
+    TEST_ASSERT_INT_WITHIN(100, 9200, eff_map_get(0.5, 0.5));
+    TEST_ASSERT(eff_map.count[4][4] <= EFF_MAP_COUNT_MAX);
+}
+
+void benchmark_eff_map_update()
+{
+    eff_map_reset();
+    double ns = benchmark_ns([](int i) {
+        eff_map_update((i % 100) * 0.01, (i % 37) * 0.027, 0.95);
+    }, 1000000);
+    benchmark_print("eff_map_update (host)", ns, "ns");
+    eff_map_reset();
+}
+
+/** DC/DC efficiency map
+ */
+void efficiency_map_tests()
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(eff_map_empty_bins_invalid);
+    RUN_TEST(eff_map_mean_of_samples_per_bin);
+    RUN_TEST(eff_map_forgets_old_samples);
+    RUN_BENCHMARK(benchmark_eff_map_update);
+
+    UNITY_END();
+}
@@ -55,6 +55,74 @@ void half_brigde_not_exceeds_min()
     TEST_ASSERT_FLOAT_WITHIN(duty_epsilon,MIN_PWM_DUTY,half_bridge_get_duty_cycle());
 }
 
+void half_bridge_fine_step_below_timer_resolution()
+{
+    const float timer_step = 1.0 / (24000000 / (PWM_F_KHZ * 1000) / 2);
+    half_bridge_set_duty_cycle(MID_PWM_DUTY);
+    float duty_before = half_bridge_get_duty_cycle();
+    half_bridge_duty_cycle_step_fine(1);
+    TEST_ASSERT_FLOAT_WITHIN(timer_step / 100, timer_step / PWM_DITHER_STEPS,
+        half_bridge_get_duty_cycle() - duty_before);
+    half_bridge_duty_cycle_step(1);
+    TEST_ASSERT_FLOAT_WITHIN(timer_step / 100, timer_step * (1.0 + 1.0 / PWM_DITHER_STEPS),
+        half_bridge_get_duty_cycle() - duty_before);
+}
+
+void half_bridge_dither_pattern_average_equals_duty()
+{
+    uint16_t pattern[PWM_DITHER_STEPS];
+    for (int fraction = 0; fraction < PWM_DITHER_STEPS; fraction++) {
+        half_bridge_dither_pattern(100 * PWM_DITHER_STEPS + fraction, pattern);
+        int sum = 0;
+        for (int i = 0; i < PWM_DITHER_STEPS; i++) {
+            TEST_ASSERT(pattern[i] == 100 || pattern[i] == 101);
+            sum += pattern[i];
+        }
+        TEST_ASSERT_EQUAL(100 * PWM_DITHER_STEPS + fraction, sum);
+    }
+}
+
+void half_bridge_dither_pattern_evenly_spread()
+{
+    // sigma-delta pattern: the additional counts must not be bunched together
+    uint16_t pattern[PWM_DITHER_STEPS];
+    half_bridge_dither_pattern(100 * PWM_DITHER_STEPS + PWM_DITHER_STEPS / 4, pattern);
+    for (int i = 0; i < PWM_DITHER_STEPS; i++) {
+        if (pattern[i] == 101) {
+            TEST_ASSERT_EQUAL(100, pattern[(i + 1) % PWM_DITHER_STEPS]);
+            TEST_ASSERT_EQUAL(100, pattern[(i + 2) % PWM_DITHER_STEPS]);
+            TEST_ASSERT_EQUAL(100, pattern[(i + 3) % PWM_DITHER_STEPS]);
+        }
+    }
+}
+
+void half_bridge_frequency_divider_keeps_duty_cycle()
+{
+    half_bridge_set_duty_cycle(MID_PWM_DUTY);
+    float duty = half_bridge_get_duty_cycle();
+    half_bridge_set_frequency_divider(3);
+    TEST_ASSERT_EQUAL(3, half_bridge_get_frequency_divider());
+    TEST_ASSERT_FLOAT_WITHIN(0.001, duty, half_bridge_get_duty_cycle());
+
+    // limits are kept as well
+    half_bridge_set_duty_cycle(1.0);
+    TEST_ASSERT_FLOAT_WITHIN(duty_epsilon, MAX_PWM_DUTY, half_bridge_get_duty_cycle());
+
+    half_bridge_set_frequency_divider(1);
+    TEST_ASSERT_FLOAT_WITHIN(duty_epsilon, MAX_PWM_DUTY, half_bridge_get_duty_cycle());
+}
+
+void half_bridge_frequency_divider_limited_by_timer()
+{
+    half_bridge_set_duty_cycle(MID_PWM_DUTY);
+    float duty = half_bridge_get_duty_cycle();
+    half_bridge_set_frequency_divider(0xFFFF);      // 16-bit timer period would overflow
+    TEST_ASSERT(half_bridge_get_frequency_divider() > 1);
+    TEST_ASSERT(half_bridge_get_frequency_divider() < 0xFFFF);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, duty, half_bridge_get_duty_cycle());
+
+    half_bridge_set_frequency_divider(1);
+}
 
 void half_brigde_tests()
 {
@@ -67,6 +135,11 @@ void half_brigde_tests()
     RUN_TEST(half_brigde_not_exceeds_min);
     RUN_TEST(half_brigde_not_steps_over_max);
     RUN_TEST(half_brigde_not_steps_under_min);
+    RUN_TEST(half_bridge_fine_step_below_timer_resolution);
+    RUN_TEST(half_bridge_dither_pattern_average_equals_duty);
+    RUN_TEST(half_bridge_dither_pattern_evenly_spread);
+    RUN_TEST(half_bridge_frequency_divider_keeps_duty_cycle);
+    RUN_TEST(half_bridge_frequency_divider_limited_by_timer);
 
     UNITY_END();
 }
\ No newline at end of file
@@ -0,0 +1,672 @@
+
+#include "tests.h"
+#include "pv_model.h"
+#include "benchmark.h"
+
+#include "main.h"
+#include "half_bridge.h"
+#include "efficiency_map.h"
+
+#include <math.h>
+
+// 60 cell panel with approx. 150 W peak
+static const PvPanel panel = { 5.0, 37.0, 2.0 };
+
+// 72 cell panel with two substrings (bypass diodes), used for partial shading
+static const PvPanel panel_72 = { 5.0, 44.0, 2.4 };
+
+static const float bat_voltage = 13.0;
+
+extern time_t timestamp;
+
+/** Irradiance profile with passing clouds (one value per control step)
+ */
+static float irradiance_clouds(int step)
+{
+    if (step < 200) {
+        return 1.0;                             // 20 s steady state
+    }
+    else if (step < 250) {
+        return 1.0 - 0.7 * (step - 200) / 50;   // fast drop to 30% within 5 s
+    }
+    else if (step < 350) {
+        return 0.3;
+    }
+    else if (step < 400) {
+        return 0.3 + 0.7 * (step - 350) / 50;   // fast rise back to 100% within 5 s
+    }
+    return 1.0;
+}
+
+/** Slow irradiance ramp (e.g. morning)
+ */
+static float irradiance_ramp(int step)
+{
+    return 0.2 + 0.8 * step / 600;
+}
+
+/** Low irradiance at dusk, decreasing from approx. 4.5 W to 0.5 W panel power within 4 minutes
+ */
+static float irradiance_dusk(int step)
+{
+    return 0.03 - 0.027 * step / 2400;
+}
+
+static void init_buck(DcdcMpptAlgorithm algorithm)
+{
+    half_bridge_stop();
+    half_bridge_init(70, 200, 12 / dcdc.hs_voltage_max, 0.97);
+
+    hv_terminal.init_solar();
+    battery_conf_init(&bat_conf, BAT_TYPE_GEL, 6, 100);
+    battery_init_dc_bus(&dcdc_lv_port, &bat_conf, 1);
+
+    dcdc.mode = MODE_MPPT_BUCK;
+    dcdc.temp_mosfets = 25;
+    dcdc.off_timestamp = 0;
+    dcdc.power_prev = 0;
+    dcdc.pwm_delta = 1;
+    dcdc.enabled = true;
+    dcdc.mppt_algorithm = algorithm;
+    dcdc.mppt_scan_interval = 0;
+    dcdc.mppt_scan_power_drop = 0;
+    dcdc.mppt_scan_step = 4;
+    dcdc.light_load_power = 0;
+    dcdc.deadtime_tuning = DEADTIME_TUNING_OFF;
+    dcdc.soft_start_time = 0.5;
+    for (int i = 0; i < DCDC_START_CACHE_BINS; i++) {
+        dcdc.start_ratio[i] = 0;
+    }
+    dcdc.start_duty_gain = 1.0;
+}
+
+/** Voltage of the PV panel at the current operating point of the converter
+ */
+static float operating_voltage()
+{
+    return hv_terminal.voltage;
+}
+
+/** Runs the closed loop and calculates the tracking efficiency
+ *
+ * @returns harvested energy relative to the theoretical maximum
+ */
+static float tracking_efficiency(DcdcMpptAlgorithm algorithm, float (*irradiance)(int),
+    int num_steps)
+{
+    float energy = 0;
+    float energy_max = 0;
+
+    init_buck(algorithm);
+    for (int i = 0; i < num_steps; i++) {
+        energy += pv_buck_control_step(&panel, irradiance(i), bat_voltage);
+        energy_max += pv_max_power(&panel, irradiance(i));
+    }
+    return energy / energy_max;
+}
+
+void pv_model_max_power_point()
+{
+    // typical Vmpp approx. 80% of Voc
+    float voc = pv_open_circuit_voltage(&panel, 1.0);
+    float p_max = pv_max_power(&panel, 1.0);
+    TEST_ASSERT_FLOAT_WITHIN(0.01, panel.voc, voc);
+    TEST_ASSERT(p_max > 0.75 * panel.voc * panel.isc);
+    TEST_ASSERT(p_max < 0.85 * panel.voc * panel.isc);
+    TEST_ASSERT_EQUAL_FLOAT(0, pv_current(&panel, 1.0, voc + 1));
+}
+
+void mppt_tracking_reaches_mpp()
+{
+    const DcdcMpptAlgorithm algorithms[] = { MPPT_PO_FIXED, MPPT_PO_ADAPTIVE, MPPT_INC_COND };
+
+    for (unsigned int a = 0; a < sizeof(algorithms) / sizeof(algorithms[0]); a++) {
+        init_buck(algorithms[a]);
+        float power = 0;
+        for (int i = 0; i < 300; i++) {
+            power = pv_buck_control_step(&panel, 1.0, bat_voltage);
+        }
+        TEST_ASSERT_EQUAL(DCDC_STATE_MPPT, dcdc.state);
+        TEST_ASSERT(power > 0.98 * pv_max_power(&panel, 1.0));
+    }
+}
+
+void mppt_compare_strategies_clouds()
+{
+    float eff_fixed = tracking_efficiency(MPPT_PO_FIXED, irradiance_clouds, 600);
+    float eff_adaptive = tracking_efficiency(MPPT_PO_ADAPTIVE, irradiance_clouds, 600);
+    float eff_inc_cond = tracking_efficiency(MPPT_INC_COND, irradiance_clouds, 600);
+
+    benchmark_print("MPPT efficiency clouds (P&O fixed)", eff_fixed * 100, "%");
+    benchmark_print("MPPT efficiency clouds (P&O adaptive)", eff_adaptive * 100, "%");
+    benchmark_print("MPPT efficiency clouds (inc. conductance)", eff_inc_cond * 100, "%");
+
+    TEST_ASSERT(eff_fixed > 0.9);
+    TEST_ASSERT(eff_adaptive > 0.9);
+    TEST_ASSERT(eff_inc_cond > 0.9);
+}
+
+void mppt_compare_strategies_ramp()
+{
+    float eff_fixed = tracking_efficiency(MPPT_PO_FIXED, irradiance_ramp, 600);
+    float eff_adaptive = tracking_efficiency(MPPT_PO_ADAPTIVE, irradiance_ramp, 600);
+    float eff_inc_cond = tracking_efficiency(MPPT_INC_COND, irradiance_ramp, 600);
+
+    benchmark_print("MPPT efficiency ramp (P&O fixed)", eff_fixed * 100, "%");
+    benchmark_print("MPPT efficiency ramp (P&O adaptive)", eff_adaptive * 100, "%");
+    benchmark_print("MPPT efficiency ramp (inc. conductance)", eff_inc_cond * 100, "%");
+
+    TEST_ASSERT(eff_fixed > 0.9);
+    TEST_ASSERT(eff_adaptive > 0.9);
+    TEST_ASSERT(eff_inc_cond > 0.9);
+}
+
+void pv_model_partial_shading_two_maxima()
+{
+    // power at approx. 3/4 of Voc (unshaded substring bypassed) is lower than the max.
+    // power at the lower voltage (shaded substring bypassed)
+    float p_local = 0;
+    float v_local = 0;
+    float p_global = pv_max_power(&panel_72, 1.0, 0.3);
+    for (float v = 25; v < 40; v += 0.01) {
+        float p = v * pv_current_shaded(&panel_72, 1.0, 0.3, v);
+        if (p > p_local) {
+            p_local = p;
+            v_local = v;
+        }
+    }
+    TEST_ASSERT(v_local > 30);
+    TEST_ASSERT(p_global > 1.2 * p_local);
+
+    // no shading: same as normal panel
+    TEST_ASSERT_FLOAT_WITHIN(0.01, pv_current(&panel_72, 1.0, 35),
+        pv_current_shaded(&panel_72, 1.0, 1.0, 35));
+}
+
+/** Runs the closed loop under partial shading
+ *
+ * The panel is unshaded at the beginning, so that the local MPPT settles at the high voltage
+ * maximum, which becomes a local maximum after the shading occurs.
+ *
+ * @returns tracking efficiency after the shading occurred
+ */
+static float shading_efficiency(int scan_interval, int num_steps)
+{
+    float energy = 0;
+    float energy_max = 0;
+
+    init_buck(MPPT_PO_FIXED);
+    for (int i = 0; i < 300; i++) {
+        pv_buck_control_step(&panel_72, 1.0, bat_voltage);
+    }
+
+    // time is only advanced by system_control(), which is not called here
+    dcdc.mppt_scan_interval = scan_interval;
+    timestamp += scan_interval;
+    for (int i = 0; i < num_steps; i++) {
+        energy += pv_buck_control_step(&panel_72, 1.0, bat_voltage, 0.3);
+        energy_max += pv_max_power(&panel_72, 1.0, 0.3);
+    }
+    return energy / energy_max;
+}
+
+void mppt_without_scan_stuck_at_local_maximum()
+{
+    float eff = shading_efficiency(0, 300);
+    TEST_ASSERT(operating_voltage() > 30);
+    TEST_ASSERT(eff < 0.85);
+}
+
+void mppt_scan_finds_global_maximum()
+{
+    // scan interval of 1 s, i.e. scan starts immediately after shading occurs
+    shading_efficiency(1, 1);
+    dcdc.mppt_scan_interval = 3600;
+
+    // scan is bounded by the max. number of points
+    int steps = 0;
+    while (dcdc.scan_num_points == 0 && steps < DCDC_SCAN_POINTS_MAX + 10) {
+        pv_buck_control_step(&panel_72, 1.0, bat_voltage, 0.3);
+        steps++;
+    }
+    TEST_ASSERT(dcdc.scan_num_points > 1);
+    TEST_ASSERT(dcdc.scan_num_points <= DCDC_SCAN_POINTS_MAX);
+    TEST_ASSERT(steps <= DCDC_SCAN_POINTS_MAX + 1);
+
+    // local MPPT takes over at global maximum
+    float power = 0;
+    for (int i = 0; i < 100; i++) {
+        power = pv_buck_control_step(&panel_72, 1.0, bat_voltage, 0.3);
+    }
+    TEST_ASSERT(operating_voltage() < 25);
+    TEST_ASSERT(power > 0.95 * pv_max_power(&panel_72, 1.0, 0.3));
+}
+
+void mppt_scan_triggered_by_power_drop()
+{
+    init_buck(MPPT_PO_FIXED);
+    for (int i = 0; i < 300; i++) {
+        pv_buck_control_step(&panel_72, 1.0, bat_voltage);
+    }
+    dcdc.mppt_scan_power_drop = 0.3;
+    dcdc.scan_num_points = 0;
+    timestamp += 60;        // min. interval between two scans
+
+    pv_buck_control_step(&panel_72, 1.0, bat_voltage, 0.3);   // sudden shading
+    for (int i = 0; i < DCDC_SCAN_POINTS_MAX + 1; i++) {
+        pv_buck_control_step(&panel_72, 1.0, bat_voltage, 0.3);
+    }
+    TEST_ASSERT(dcdc.scan_num_points > 1);
+}
+
+void mppt_scan_invalid_step_limited()
+{
+    shading_efficiency(1, 1);
+    dcdc.mppt_scan_interval = 3600;
+    dcdc.mppt_scan_step = -4;
+    dcdc.scan_num_points = 0;
+
+    int steps = 0;
+    while (dcdc.scan_num_points == 0 && steps < DCDC_SCAN_POINTS_MAX + 10) {
+        pv_buck_control_step(&panel_72, 1.0, bat_voltage, 0.3);
+        steps++;
+    }
+    TEST_ASSERT_EQUAL(1, dcdc.mppt_scan_step);
+    TEST_ASSERT(dcdc.scan_num_points > 1);
+}
+
+void mppt_compare_scan_shading()
+{
+    float eff_local = shading_efficiency(0, 600);
+    float eff_scan = shading_efficiency(1, 600);
+
+    benchmark_print("MPPT efficiency partial shading (local only)", eff_local * 100, "%");
+    benchmark_print("MPPT efficiency partial shading (global scan)", eff_scan * 100, "%");
+
+    TEST_ASSERT(eff_scan > eff_local);
+    TEST_ASSERT(eff_scan > 0.9);
+}
+
+/** Duty cycle change caused by a step of one timer count
+ */
+static float duty_cycle_count()
+{
+    float duty = half_bridge_get_duty_cycle();
+    half_bridge_duty_cycle_step(1);
+    float count = half_bridge_get_duty_cycle() - duty;
+    half_bridge_duty_cycle_step(-1);
+    return count;
+}
+
+/** Closed-loop regulation with battery internal resistance
+ *
+ * @param voltage Run CV (true) or CC (false) regulation
+ * @param settling_steps Number of control steps until the duty cycle stays within +-1 count
+ *                       of its final value
+ * @param ripple Peak-to-peak duty cycle ripple during the last 100 steps (timer counts)
+ * @param error_mean Mean regulation error during the last 100 steps (V or A)
+ */
+static void regulation_run(bool voltage, int *settling_steps, int *ripple, float *error_mean)
+{
+    const int num_steps = 300;
+    float duty[num_steps];
+    float target;
+
+    init_buck(MPPT_PO_FIXED);
+    dcdc_lv_port.pos_droop_res = 0;
+    if (voltage) {
+        target = dcdc_lv_port.sink_voltage_max = 13.8;
+    }
+    else {
+        target = dcdc_lv_port.pos_current_limit = 6;
+    }
+
+    float duty_min = 1;
+    float duty_max = 0;
+    *error_mean = 0;
+    for (int i = 0; i < num_steps; i++) {
+        pv_buck_control_step(&panel, 1.0, bat_voltage, 1.0, 0.1);
+        duty[i] = half_bridge_get_duty_cycle();
+        if (i >= num_steps - 100) {
+            float error = (voltage ? dcdc_lv_port.voltage : dcdc_lv_port.current) - target;
+            *error_mean += error / 100;
+            duty_min = (duty[i] < duty_min) ? duty[i] : duty_min;
+            duty_max = (duty[i] > duty_max) ? duty[i] : duty_max;
+        }
+    }
+
+    float count = duty_cycle_count();
+    *ripple = (duty_max - duty_min) / count + 0.5;
+    *settling_steps = num_steps;
+    while (*settling_steps > 0 &&
+        fabs(duty[*settling_steps - 1] - duty[num_steps - 1]) < 1.5 * count) {
+        (*settling_steps)--;
+    }
+}
+
+void regulation_cv_settles_without_ripple()
+{
+    int settling_steps;
+    int ripple;
+    float error_mean;
+    regulation_run(true, &settling_steps, &ripple, &error_mean);
+
+    benchmark_print("CV regulation settling time", settling_steps * 1000 / CONTROL_FREQUENCY, "ms");
+    benchmark_print("CV regulation duty cycle ripple", ripple, "counts");
+    benchmark_print("CV regulation mean error", error_mean * 1000, "mV");
+
+    TEST_ASSERT_EQUAL(DCDC_STATE_CV, dcdc.state);
+    TEST_ASSERT(settling_steps < 100);
+    TEST_ASSERT(ripple <= 1);
+    TEST_ASSERT(fabs(error_mean) < 0.05);
+}
+
+void regulation_cc_settles_without_ripple()
+{
+    int settling_steps;
+    int ripple;
+    float error_mean;
+    regulation_run(false, &settling_steps, &ripple, &error_mean);
+
+    benchmark_print("CC regulation settling time", settling_steps * 1000 / CONTROL_FREQUENCY, "ms");
+    benchmark_print("CC regulation duty cycle ripple", ripple, "counts");
+    benchmark_print("CC regulation mean error", error_mean * 1000, "mA");
+
+    TEST_ASSERT_EQUAL(DCDC_STATE_CC, dcdc.state);
+    TEST_ASSERT(settling_steps < 100);
+    TEST_ASSERT(ripple <= 1);
+    TEST_ASSERT(fabs(error_mean) < 1.0);     // one timer count changes the current by approx. 1 A
+}
+
+void regulation_bumpless_transfer_from_mppt()
+{
+    init_buck(MPPT_PO_FIXED);
+    dcdc_lv_port.pos_droop_res = 0;
+    dcdc_lv_port.sink_voltage_max = 13.8;
+
+    // rising irradiance: transfer from MPPT to CV without overshoot
+    float voltage_max = 0;
+    for (int i = 0; i < 600; i++) {
+        pv_buck_control_step(&panel, irradiance_ramp(i), bat_voltage, 1.0, 0.1);
+        if (dcdc_lv_port.voltage > voltage_max) {
+            voltage_max = dcdc_lv_port.voltage;
+        }
+    }
+    TEST_ASSERT_EQUAL(DCDC_STATE_CV, dcdc.state);
+    TEST_ASSERT(voltage_max < 13.8 + 0.1);
+
+    // back to MPPT if irradiance drops again
+    for (int i = 0; i < 100; i++) {
+        pv_buck_control_step(&panel, 0.3, bat_voltage, 1.0, 0.1);
+    }
+    TEST_ASSERT_EQUAL(DCDC_STATE_MPPT, dcdc.state);
+}
+
+/** Energy delivered to the battery at dusk with switching losses of 1 W at full frequency
+ */
+static float dusk_energy(float light_load_power)
+{
+    float energy = 0;
+
+    init_buck(MPPT_PO_FIXED);
+    dcdc.light_load_power = light_load_power;
+    for (int i = 0; i < 2400; i++) {
+        energy += pv_buck_control_step(&panel, irradiance_dusk(i), bat_voltage, 1.0, 0, 1.0);
+        if (i % CONTROL_FREQUENCY == 0) {
+            timestamp++;    // needed for low power switch-off
+        }
+    }
+    return energy / CONTROL_FREQUENCY / 3600;
+}
+
+void light_load_reduces_switching_frequency()
+{
+    init_buck(MPPT_PO_FIXED);
+    dcdc.light_load_power = 10;
+    for (int i = 0; i < 100; i++) {
+        pv_buck_control_step(&panel, 0.03, bat_voltage, 1.0, 0, 1.0);
+    }
+    TEST_ASSERT_EQUAL(dcdc.light_load_divider_max, half_bridge_get_frequency_divider());
+    TEST_ASSERT_EQUAL(dcdc.light_load_divider_max, dcdc.freq_divider);
+
+    // smooth transition back to full frequency at high irradiance
+    float power_prev = 0;
+    for (int i = 0; i < 100; i++) {
+        float power = pv_buck_control_step(&panel, 0.03 + i * 0.01, bat_voltage, 1.0, 0, 1.0);
+        TEST_ASSERT(power > power_prev - 1.0);
+        power_prev = power;
+    }
+    TEST_ASSERT_EQUAL(1, half_bridge_get_frequency_divider());
+    TEST_ASSERT_EQUAL(DCDC_STATE_MPPT, dcdc.state);
+}
+
+void light_load_harvests_more_energy_at_dusk()
+{
+    float energy_normal = dusk_energy(0);
+    float energy_light_load = dusk_energy(10);
+
+    benchmark_print("Energy at dusk (fixed frequency)", energy_normal * 1000, "mWh");
+    benchmark_print("Energy at dusk (light-load mode)", energy_light_load * 1000, "mWh");
+
+    TEST_ASSERT(energy_light_load > energy_normal * 1.1);
+}
+
+/** Simulated dead time dependent losses with current dependent optimum
+ *
+ * Too short dead time causes cross conduction, too long dead time increases body diode
+ * conduction, approximated by a parabola.
+ */
+static float deadtime_loss()
+{
+    float optimum = 400 - 10 * dcdc_lv_port.current;
+    float deviation = (half_bridge_get_deadtime() - optimum) / 100;
+    return 0.5 + 1.0 * deviation * deviation;
+}
+
+void deadtime_tuning_converges_to_optimum()
+{
+    const int bin = 2;      // approx. 11 A at 150 W
+    float loss_start = 0;
+    float loss_end = 0;
+
+    init_buck(MPPT_PO_FIXED);
+    dcdc.deadtime_tuning = DEADTIME_TUNING_COMMISSIONING;
+    dcdc.deadtime_converged = 0;
+    for (int i = 0; i < DCDC_DEADTIME_BINS; i++) {
+        dcdc.deadtime_table[i] = PWM_DEADTIME_MAX;
+    }
+
+    for (int i = 0; i < 6000; i++) {
+        float loss = deadtime_loss();
+        pv_buck_control_step(&panel, 1.0, bat_voltage, 1.0, 0, loss);
+        if (i >= 100 && i < 200) {
+            loss_start += loss / 100;
+        }
+        else if (i >= 5900) {
+            loss_end += loss / 100;
+        }
+    }
+
+    float optimum = 400 - 10 * dcdc_lv_port.current;
+    benchmark_print("Dead time losses before tuning", loss_start, "W");
+    benchmark_print("Dead time losses after tuning", loss_end, "W");
+    benchmark_print("Dead time tuning error", dcdc.deadtime_table[bin] - optimum, "ns");
+
+    TEST_ASSERT_EQUAL(bin, (int)(dcdc_lv_port.current * DCDC_DEADTIME_BINS / dcdc.ls_current_max));
+    TEST_ASSERT_FLOAT_WITHIN(DCDC_DEADTIME_BINS * 20, optimum, dcdc.deadtime_table[bin]);
+    TEST_ASSERT(dcdc.deadtime_converged & (1U << bin));
+    TEST_ASSERT(loss_end < loss_start * 0.7);
+
+    // table entries of other bins not changed
+    TEST_ASSERT_EQUAL(PWM_DEADTIME_MAX, dcdc.deadtime_table[0]);
+    dcdc.deadtime_tuning = DEADTIME_TUNING_OFF;
+}
+
+void deadtime_table_limited_to_safe_bounds()
+{
+    init_buck(MPPT_PO_FIXED);
+
+    // invalid values, e.g. written via ThingSet or restored from EEPROM
+    for (int i = 0; i < DCDC_DEADTIME_BINS; i++) {
+        dcdc.deadtime_table[i] = (i % 2) ? 0xFFFF : 0;
+    }
+
+    // limited before the table is applied in the control loop
+    for (int i = 0; i < 50; i++) {
+        pv_buck_control_step(&panel, 1.0, bat_voltage);
+    }
+    TEST_ASSERT(half_bridge_enabled());
+    for (int i = 0; i < DCDC_DEADTIME_BINS; i++) {
+        TEST_ASSERT_EQUAL((i % 2) ? PWM_DEADTIME_MAX : PWM_DEADTIME_MIN, dcdc.deadtime_table[i]);
+        dcdc.deadtime_table[i] = PWM_DEADTIME;
+    }
+}
+
+/** Starts the converter until the MPP was learned and stops it again
+ *
+ * A lower switching frequency is used to get a similar timer resolution as the hardware, so
+ * that the MPPT climbing after start-up is not faster than in reality.
+ */
+static void learn_and_stop_buck(float soft_start_time)
+{
+    init_buck(MPPT_PO_FIXED);
+    half_bridge_init(25, 200, 12 / dcdc.hs_voltage_max, 0.97);
+    dcdc.soft_start_time = soft_start_time;
+    for (int i = 0; i < 1000; i++) {
+        pv_buck_control_step(&panel, 1.0, bat_voltage);
+    }
+
+    dcdc.emergency_stop();
+    dcdc.off_timestamp = 0;     // restart without waiting for the restart interval
+}
+
+/** Control cycles after a restart of the converter until 95% of the max. power are reached
+ */
+static int restart_steps(float soft_start_time)
+{
+    learn_and_stop_buck(soft_start_time);
+
+    float p_max = pv_max_power(&panel, 1.0);
+    for (int i = 0; i < 1000; i++) {
+        if (pv_buck_control_step(&panel, 1.0, bat_voltage) > 0.95 * p_max) {
+            return i;
+        }
+    }
+    return 1000;
+}
+
+void start_cache_learns_mpp()
+{
+    learn_and_stop_buck(0.5);
+
+    float voc = pv_open_circuit_voltage(&panel, 1.0);
+    float ratio = dcdc.start_ratio[(int)(voc * DCDC_START_CACHE_BINS / dcdc.hs_voltage_max)];
+    TEST_ASSERT_FLOAT_WITHIN(0.02, operating_voltage() / voc, ratio);
+    TEST_ASSERT_FLOAT_WITHIN(0.02, 1.0, dcdc.start_duty_gain);
+}
+
+void start_cache_reduces_time_to_full_power()
+{
+    int steps_climb = restart_steps(0);
+    int steps_soft_start = restart_steps(0.5);
+
+    benchmark_print("Time to full power after restart (MPPT climb)",
+        (float)steps_climb / CONTROL_FREQUENCY, "s");
+    benchmark_print("Time to full power after restart (learned MPP)",
+        (float)steps_soft_start / CONTROL_FREQUENCY, "s");
+
+    TEST_ASSERT(steps_soft_start < CONTROL_FREQUENCY);
+    TEST_ASSERT(steps_soft_start < steps_climb);
+}
+
+void start_ramp_aborted_at_current_limit()
+{
+    learn_and_stop_buck(0.5);
+
+    float current_mean = 0;
+    dcdc_lv_port.pos_current_limit = 3.0;
+    for (int i = 0; i < 200; i++) {
+        pv_buck_control_step(&panel, 1.0, bat_voltage);
+        if (i > CONTROL_FREQUENCY / 2) {
+            // no overshoot caused by the ramp (first cycles affected by start-up transient)
+            TEST_ASSERT(dcdc_lv_port.current < 3.0 * 1.25);
+        }
+        if (i >= 100) {
+            current_mean += dcdc_lv_port.current / 100;
+        }
+    }
+    TEST_ASSERT_EQUAL(DCDC_STATE_CC, dcdc.state);
+    TEST_ASSERT_FLOAT_WITHIN(0.3, 3.0, current_mean);
+    battery_init_dc_bus(&dcdc_lv_port, &bat_conf, 1);
+}
+
+void start_ramp_duration_limited()
+{
+    learn_and_stop_buck(1e12);
+
+    float p_max = pv_max_power(&panel, 1.0);
+    int steps = 0;
+    while (pv_buck_control_step(&panel, 1.0, bat_voltage) < 0.95 * p_max &&
+        steps < (DCDC_SOFT_START_TIME_MAX + 1) * CONTROL_FREQUENCY) {
+        steps++;
+    }
+    TEST_ASSERT_EQUAL_FLOAT(DCDC_SOFT_START_TIME_MAX, dcdc.soft_start_time);
+    TEST_ASSERT(steps < (DCDC_SOFT_START_TIME_MAX + 1) * CONTROL_FREQUENCY);
+}
+
+void efficiency_map_records_converter_losses()
+{
+    const float switching_loss = 2.0;
+
+    init_buck(MPPT_PO_FIXED);
+    eff_map_reset();
+    for (int i = 0; i < 300; i++) {
+        pv_buck_control_step(&panel, 1.0, bat_voltage, 1.0, 0, switching_loss);
+    }
+
+    float p_in = -hv_terminal.power;
+    float voltage_ratio = dcdc_lv_port.voltage / hv_terminal.voltage;
+    float current_ratio = dcdc_lv_port.current / dcdc.ls_current_max;
+    TEST_ASSERT_INT_WITHIN(20, (p_in - switching_loss) / p_in * 10000,
+        eff_map_get(voltage_ratio, current_ratio));
+    TEST_ASSERT_FLOAT_WITHIN(0.2, (p_in - switching_loss) / p_in * 100, dcdc.efficiency);
+
+    // no samples at operating points never reached
+    TEST_ASSERT_EQUAL(-1, eff_map_get(0.9, 0.1));
+    eff_map_reset();
+}
+
+/** Closed-loop tests of the MPPT strategies and output regulation with a simulated PV panel
+ */
+void mppt_tests()
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(pv_model_max_power_point);
+    RUN_TEST(mppt_tracking_reaches_mpp);
+    RUN_TEST(mppt_compare_strategies_clouds);
+    RUN_TEST(mppt_compare_strategies_ramp);
+    RUN_TEST(pv_model_partial_shading_two_maxima);
+    RUN_TEST(mppt_without_scan_stuck_at_local_maximum);
+    RUN_TEST(mppt_scan_finds_global_maximum);
+    RUN_TEST(mppt_scan_triggered_by_power_drop);
+    RUN_TEST(mppt_scan_invalid_step_limited);
+    RUN_TEST(mppt_compare_scan_shading);
+    RUN_TEST(regulation_cv_settles_without_ripple);
+    RUN_TEST(regulation_cc_settles_without_ripple);
+    RUN_TEST(regulation_bumpless_transfer_from_mppt);
+    RUN_TEST(light_load_reduces_switching_frequency);
+    RUN_TEST(light_load_harvests_more_energy_at_dusk);
+    RUN_TEST(deadtime_tuning_converges_to_optimum);
+    RUN_TEST(deadtime_table_limited_to_safe_bounds);
+    RUN_TEST(start_cache_learns_mpp);
+    RUN_TEST(start_cache_reduces_time_to_full_power);
+    RUN_TEST(start_ramp_aborted_at_current_limit);
+    RUN_TEST(start_ramp_duration_limited);
+    RUN_TEST(efficiency_map_records_converter_losses);
+
+    // restore default algorithm for further tests
+    init_buck(MPPT_PO_FIXED);
+
+    UNITY_END();
+}
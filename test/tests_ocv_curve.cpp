@@ -0,0 +1,141 @@
+
+#include "tests.h"
+#include "ocv_curve.h"
+#include "benchmark.h"
+
+#include "bat_charger.h"
+
+static const OcvCurve *all_curves[] = {
+    &ocv_curve_flooded, &ocv_curve_vrla, &ocv_curve_lfp, &ocv_curve_nmc, &ocv_curve_nmc_hv
+};
+
+void ocv_curves_strictly_increasing()
+{
+    for (unsigned int c = 0; c < sizeof(all_curves) / sizeof(all_curves[0]); c++) {
+        const OcvCurve *curve = all_curves[c];
+        TEST_ASSERT(curve->num_points >= 2);
+        TEST_ASSERT_EQUAL(0, curve->points[0].soc);
+        TEST_ASSERT_EQUAL(1000, curve->points[curve->num_points - 1].soc);
+        for (int i = 1; i < curve->num_points; i++) {
+            TEST_ASSERT(curve->points[i].soc > curve->points[i - 1].soc);
+            TEST_ASSERT(curve->points[i].voltage > curve->points[i - 1].voltage);
+        }
+    }
+}
+
+void ocv_curve_interpolation()
+{
+    int32_t slope;
+
+    // exact values at the points
+    for (int i = 0; i < ocv_curve_lfp.num_points; i++) {
+        TEST_ASSERT_EQUAL(ocv_curve_lfp.points[i].voltage * 1000,
+            ocv_curve_voltage(&ocv_curve_lfp, ocv_curve_lfp.points[i].soc * 1000, 25, NULL));
+    }
+
+    // between 60 % (3300 mV) and 65 % (3310 mV)
+    TEST_ASSERT_EQUAL(3305000, ocv_curve_voltage(&ocv_curve_lfp, 625000, 25, &slope));
+    TEST_ASSERT_INT_WITHIN(1, 0.2 * 65536, slope);      // 0.2 µV/ppm
+
+    // clamped outside of 0 to 100 %
+    TEST_ASSERT_EQUAL(2900000, ocv_curve_voltage(&ocv_curve_lfp, -1000, 25, NULL));
+    TEST_ASSERT_EQUAL(3400000, ocv_curve_voltage(&ocv_curve_lfp, 1001000, 25, NULL));
+}
+
+void ocv_curve_inverse_roundtrip()
+{
+    for (unsigned int c = 0; c < sizeof(all_curves) / sizeof(all_curves[0]); c++) {
+        for (int32_t soc = 0; soc <= 1000000; soc += 12345) {
+            int32_t voltage = ocv_curve_voltage(all_curves[c], soc, 25, NULL);
+            // max. error of one µV corresponds to several ppm in the flat parts of the curves
+            TEST_ASSERT_INT_WITHIN(20, soc, ocv_curve_soc(all_curves[c], voltage, 25));
+        }
+    }
+
+    TEST_ASSERT_EQUAL(0, ocv_curve_soc(&ocv_curve_nmc, 2500000, 25));
+    TEST_ASSERT_EQUAL(1000000, ocv_curve_soc(&ocv_curve_nmc, 4200000, 25));
+}
+
+void ocv_curve_temperature_correction()
+{
+    // lead-acid OCV increases by 0.2 mV/K per cell
+    TEST_ASSERT_EQUAL(2005000 + 200 * 15,
+        ocv_curve_voltage(&ocv_curve_flooded, 500000, 40, NULL));
+    TEST_ASSERT_EQUAL(2005000 - 200 * 25,
+        ocv_curve_voltage(&ocv_curve_flooded, 500000, 0, NULL));
+
+    // same SOC for the temperature-corrected OCV
+    TEST_ASSERT_INT_WITHIN(1, 500000, ocv_curve_soc(&ocv_curve_flooded, 2005000 - 5000, 0));
+    TEST_ASSERT_INT_WITHIN(1, 500000, ocv_curve_soc(&ocv_curve_nmc, 3710000 + 1500, 10));
+}
+
+void ocv_curve_custom_valid_and_invalid()
+{
+    OcvCurve curve;
+    OcvPoint points[OCV_CUSTOM_POINTS];
+    uint16_t voltages[OCV_CUSTOM_POINTS] = {
+        3000, 3200, 3250, 3280, 3300, 3310, 3320, 3330, 3340, 3360, 3450
+    };
+
+    TEST_ASSERT_TRUE(ocv_curve_custom(&curve, points, voltages, 0));
+    TEST_ASSERT_EQUAL(OCV_CUSTOM_POINTS, curve.num_points);
+    TEST_ASSERT_EQUAL(3310000, ocv_curve_voltage(&curve, 500000, 25, NULL));
+    TEST_ASSERT_EQUAL(3315000, ocv_curve_voltage(&curve, 550000, 25, NULL));
+
+    voltages[5] = voltages[4];
+    TEST_ASSERT_FALSE(ocv_curve_custom(&curve, points, voltages, 0));
+}
+
+void ocv_curve_custom_selected_by_battery_conf()
+{
+    BatConf conf;
+    battery_conf_init(&conf, BAT_TYPE_AGM, 6, 100);
+    TEST_ASSERT(battery_ocv_curve(&conf) == &ocv_curve_vrla);
+    TEST_ASSERT_TRUE(battery_conf_check(&conf));
+
+    for (int i = 0; i < OCV_CUSTOM_POINTS; i++) {
+        conf.ocv_custom[i] = 1920 + i * 20;
+    }
+    const OcvCurve *curve = battery_ocv_curve(&conf);
+    TEST_ASSERT(curve != &ocv_curve_vrla);
+    TEST_ASSERT_EQUAL(2020000, ocv_curve_voltage(curve, 500000, 25, NULL));
+
+    // temperature coefficient of the chemistry is kept
+    TEST_ASSERT_EQUAL(2020000 + 200 * 10, ocv_curve_voltage(curve, 500000, 35, NULL));
+    TEST_ASSERT_TRUE(battery_conf_check(&conf));
+
+    // invalid custom curve is rejected and the default curve is used
+    conf.ocv_custom[3] = 0;
+    TEST_ASSERT_FALSE(battery_conf_check(&conf));
+    TEST_ASSERT(battery_ocv_curve(&conf) == &ocv_curve_vrla);
+}
+
+void ocv_curve_benchmark()
+{
+    volatile int32_t sum = 0;
+
+    double time_ns = benchmark_ns([&](int i) {
+        sum += ocv_curve_voltage(&ocv_curve_lfp, i % 1000000, 25, NULL);
+    }, 1000000);
+    benchmark_print("OCV lookup (LFP, 15 points, host)", time_ns, "ns");
+
+    time_ns = benchmark_ns([&](int i) {
+        sum += ocv_curve_soc(&ocv_curve_lfp, 2900000 + i % 500000, 25);
+    }, 1000000);
+    benchmark_print("OCV inverse lookup (LFP, 15 points, host)", time_ns, "ns");
+}
+
+void ocv_curve_tests()
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(ocv_curves_strictly_increasing);
+    RUN_TEST(ocv_curve_interpolation);
+    RUN_TEST(ocv_curve_inverse_roundtrip);
+    RUN_TEST(ocv_curve_temperature_correction);
+    RUN_TEST(ocv_curve_custom_valid_and_invalid);
+    RUN_TEST(ocv_curve_custom_selected_by_battery_conf);
+    RUN_TEST(ocv_curve_benchmark);
+
+    UNITY_END();
+}
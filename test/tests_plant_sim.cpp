@@ -0,0 +1,120 @@
+
+#include "tests.h"
+#include "plant_sim.h"
+#include "benchmark.h"
+
+#include "main.h"
+
+// 60 cell panel with approx. 150 W peak and 100 Ah gel battery
+static PlantConf default_plant(float soc, float (*irradiance)(double))
+{
+    PlantConf conf = {};
+    conf.panel = { 5.0, 37.0, 2.0 };
+    conf.battery = { 100, 11.8, 12.8, 1.8, 0.02, soc };
+    conf.converter_efficiency = 0.97;
+    conf.irradiance = irradiance;
+    conf.ambient_temp = plant_ambient_temp_summer;
+    conf.load_current = plant_load_evening;
+    return conf;
+}
+
+void plant_sim_clear_day()
+{
+    PlantConf conf = default_plant(0.3, plant_irradiance_clear_sky);
+    PlantResult result = {};
+
+    plant_sim_init(&conf);
+    plant_sim_run(&conf, 0, 24, &result);
+
+    benchmark_print("Plant sim clear day: PV energy", result.energy_pv, "Wh");
+    benchmark_print("Plant sim clear day: MPPT tracking efficiency",
+        result.energy_mppt / result.energy_mppt_max * 100, "%");
+    benchmark_print("Plant sim clear day: harvested / theoretical",
+        result.energy_pv / result.energy_pv_max * 100, "%");
+    benchmark_print("Plant sim (simulated hours per second)",
+        result.simulated_s / 3600 / result.elapsed_s, "h/s");
+
+    TEST_ASSERT_EQUAL_FLOAT(24 * 3600, result.simulated_s);
+    TEST_ASSERT(result.energy_mppt / result.energy_mppt_max > 0.97);
+    TEST_ASSERT(result.energy_pv / result.energy_pv_max > 0.9);
+
+    // energy balance: PV and load do not overlap, so the battery is charged with the converter
+    // output and the evening load of 5 hours is supplied from the battery
+    TEST_ASSERT_FLOAT_WITHIN(1.0, result.energy_pv * conf.converter_efficiency,
+        result.energy_bat_in);
+    TEST_ASSERT_FLOAT_WITHIN(10.0, 5 * 2.0 * 12.4, result.energy_load);
+    TEST_ASSERT(result.soc_end > 0.3);
+}
+
+void plant_sim_cloudy_day()
+{
+    PlantConf conf = default_plant(0.3, plant_irradiance_cloudy);
+    PlantResult result = {};
+
+    plant_sim_init(&conf);
+    plant_sim_run(&conf, 6, 12, &result);
+
+    benchmark_print("Plant sim cloudy day: MPPT tracking efficiency",
+        result.energy_mppt / result.energy_mppt_max * 100, "%");
+
+    TEST_ASSERT(result.energy_mppt / result.energy_mppt_max > 0.95);
+}
+
+void plant_sim_full_battery_limits_harvest()
+{
+    PlantConf conf = default_plant(0.95, plant_irradiance_clear_sky);
+    PlantResult result = {};
+
+    plant_sim_init(&conf);
+    plant_sim_run(&conf, 6, 12, &result);
+
+    benchmark_print("Plant sim full battery: harvested / theoretical",
+        result.energy_pv / result.energy_pv_max * 100, "%");
+
+    // charger switched to CV (topping) or trickle charging and the DC/DC followed
+    TEST_ASSERT(charger.state == CHG_STATE_TOPPING || charger.state == CHG_STATE_TRICKLE);
+    TEST_ASSERT(result.energy_pv < result.energy_pv_max * 0.7);
+    TEST_ASSERT(bat_terminal.voltage < bat_conf.topping_voltage + 0.1);
+}
+
+void plant_sim_estimates_battery_resistance()
+{
+    PlantConf conf = default_plant(0.3, plant_irradiance_cloudy);
+    PlantResult result = {};
+
+    plant_sim_init(&conf);
+    float droop_configured = bat_terminal.neg_droop_res;
+
+    // actual resistance twice as high as configured (e.g. aged battery)
+    conf.battery.resistance = bat_conf.internal_resistance * 2;
+    plant_sim_run(&conf, 6, 18, &result);
+
+    benchmark_print("Plant sim resistance estimation error",
+        (charger.internal_resistance / conf.battery.resistance - 1) * 100, "%");
+    benchmark_print("Plant sim resistance estimation accepted steps",
+        charger.res_est.num_steps, "");
+
+    TEST_ASSERT(resistance_est_valid(&charger.res_est));
+    TEST_ASSERT_FLOAT_WITHIN(conf.battery.resistance * 0.2, conf.battery.resistance,
+        charger.internal_resistance);
+    TEST_ASSERT_EQUAL_FLOAT(0, charger.wire_resistance);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, -charger.internal_resistance, bat_terminal.neg_droop_res);
+    TEST_ASSERT(bat_terminal.neg_droop_res < droop_configured);
+}
+
+/** Closed-loop simulation of the complete system over a day
+ *
+ * Must run after the other tests (except ADC replay), as the simulation changes the state of
+ * all control objects.
+ */
+void plant_sim_tests()
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(plant_sim_clear_day);
+    RUN_TEST(plant_sim_cloudy_day);
+    RUN_TEST(plant_sim_full_battery_limits_harvest);
+    RUN_TEST(plant_sim_estimates_battery_resistance);
+
+    UNITY_END();
+}
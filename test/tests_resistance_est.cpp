@@ -0,0 +1,162 @@
+
+#include "tests.h"
+#include "resistance_est.h"
+#include "benchmark.h"
+
+#include "main.h"
+
+#include <stdlib.h>
+
+/** Applies alternating current steps to a battery with constant OCV and given resistance
+ */
+static void apply_steps(ResistanceEst *est, float resistance, float step, int num_steps)
+{
+    for (int i = 0; i < num_steps; i++) {
+        float current = (i % 2) ? step : 0;
+        resistance_est_update(est, 12.5 + resistance * current, current);
+    }
+}
+
+void resistance_est_ignores_constant_current()
+{
+    ResistanceEst est;
+    resistance_est_init(&est, 0.05);
+
+    // first call has no previous measurement
+    TEST_ASSERT_FALSE(resistance_est_update(&est, 13.0, 5.0));
+
+    // voltage change caused by the OCV, not by a current step
+    for (int i = 0; i < 100; i++) {
+        TEST_ASSERT_FALSE(resistance_est_update(&est, 13.0 + i * 0.001, 5.0));
+    }
+    TEST_ASSERT_EQUAL(0, est.num_steps);
+    TEST_ASSERT_EQUAL_FLOAT(0.05, est.resistance);
+    TEST_ASSERT_FALSE(resistance_est_valid(&est));
+}
+
+void resistance_est_converges_to_actual_value()
+{
+    ResistanceEst est;
+    resistance_est_init(&est, 0.05);
+
+    apply_steps(&est, 0.04, 2.0, 100);
+    TEST_ASSERT_TRUE(resistance_est_valid(&est));
+    TEST_ASSERT_FLOAT_WITHIN(0.0005, 0.04, est.resistance);
+}
+
+void resistance_est_rejects_outliers()
+{
+    ResistanceEst est;
+    resistance_est_init(&est, 0.04);
+    apply_steps(&est, 0.04, 2.0, 50);
+    unsigned int num_steps = est.num_steps;
+
+    // negative and implausible ratios (e.g. load switched in the same cycle)
+    resistance_est_pause(&est);
+    resistance_est_update(&est, 12.5, 0);
+    TEST_ASSERT_FALSE(resistance_est_update(&est, 12.4, 2.0));
+    resistance_est_pause(&est);
+    resistance_est_update(&est, 12.5, 0);
+    TEST_ASSERT_FALSE(resistance_est_update(&est, 12.5 + 0.2 * 2.0, 2.0));
+
+    TEST_ASSERT_EQUAL(num_steps, est.num_steps);
+    TEST_ASSERT_EQUAL(2, est.num_rejected);
+    TEST_ASSERT_FLOAT_WITHIN(0.0005, 0.04, est.resistance);
+}
+
+void resistance_est_follows_resistance_change()
+{
+    ResistanceEst est;
+    resistance_est_init(&est, 0.02);
+    apply_steps(&est, 0.02, 2.0, 50);
+
+    // rejected at first, but the threshold opens until the new value is accepted
+    apply_steps(&est, 0.04, 2.0, 300);
+    TEST_ASSERT(est.num_rejected > 0);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 0.04, est.resistance);
+}
+
+void resistance_est_with_measurement_noise()
+{
+    ResistanceEst est;
+    resistance_est_init(&est, 0.05);
+    srand(1);
+
+    // random current between 9 A and 11 A with 3 mV voltage noise
+    for (int i = 0; i < 2000; i++) {
+        float current = 10 + 2.0 * rand() / RAND_MAX - 1;
+        float noise = 0.003 * (2.0 * rand() / RAND_MAX - 1);
+        resistance_est_update(&est, 12.5 + 0.03 * current + noise, current);
+    }
+    TEST_ASSERT_FLOAT_WITHIN(0.003, 0.03, est.resistance);
+}
+
+void resistance_est_charger_sets_droop()
+{
+    Charger chg(&bat_terminal);
+    BatConf conf;
+    battery_conf_init(&conf, BAT_TYPE_GEL, 6, 100);
+    conf.internal_resistance = 0.03;
+    conf.wire_resistance = 0.01;
+    battery_init_dc_bus(&bat_terminal, &conf, 1);
+    chg.state = CHG_STATE_BULK;
+    TEST_ASSERT_FLOAT_WITHIN(0.0001, -0.02, bat_terminal.neg_droop_res);
+
+    // total resistance 50 mOhm: wire resistance kept, internal resistance increased
+    for (int i = 0; i < 20; i++) {
+        bat_terminal.current = (i % 2) ? 5.0 : 0;
+        bat_terminal.voltage = 12.5 + 0.05 * bat_terminal.current;
+        chg.update_resistance(&conf);
+    }
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 0.04, chg.internal_resistance);
+    TEST_ASSERT_FLOAT_WITHIN(0.0001, 0.01, chg.wire_resistance);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, -0.03, bat_terminal.neg_droop_res);
+    TEST_ASSERT_FLOAT_WITHIN(0.0001, -0.01, bat_terminal.pos_droop_res);
+
+    // total resistance 5 mOhm: configured wire resistance is too high
+    chg.res_est.configured = false;
+    for (int i = 0; i < 100; i++) {
+        bat_terminal.current = (i % 2) ? 5.0 : 0;
+        bat_terminal.voltage = 12.5 + 0.005 * bat_terminal.current;
+        chg.update_resistance(&conf);
+    }
+    TEST_ASSERT_FLOAT_WITHIN(0.0005, 0.005, chg.wire_resistance);
+    TEST_ASSERT_FLOAT_WITHIN(0.0005, 0, chg.internal_resistance);
+
+    // no estimation while the voltage is regulated
+    chg.state = CHG_STATE_TOPPING;
+    unsigned int num_steps = chg.res_est.num_steps;
+    for (int i = 0; i < 20; i++) {
+        bat_terminal.current = (i % 2) ? 5.0 : 0;
+        bat_terminal.voltage = 14.4;
+        chg.update_resistance(&conf);
+    }
+    TEST_ASSERT_EQUAL(num_steps, chg.res_est.num_steps);
+}
+
+void resistance_est_benchmark()
+{
+    ResistanceEst est;
+    resistance_est_init(&est, 0.05);
+
+    double time_ns = benchmark_ns([&](int i) {
+        float current = (i % 3) ? 5.0 : 0;
+        resistance_est_update(&est, 12.5 + 0.03 * current, current);
+    }, 1000000);
+    benchmark_print("Resistance estimation update (host)", time_ns, "ns");
+}
+
+void resistance_est_tests()
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(resistance_est_ignores_constant_current);
+    RUN_TEST(resistance_est_converges_to_actual_value);
+    RUN_TEST(resistance_est_rejects_outliers);
+    RUN_TEST(resistance_est_follows_resistance_change);
+    RUN_TEST(resistance_est_with_measurement_noise);
+    RUN_TEST(resistance_est_charger_sets_droop);
+    RUN_TEST(resistance_est_benchmark);
+
+    UNITY_END();
+}
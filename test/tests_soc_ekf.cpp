@@ -0,0 +1,273 @@
+
+#include "tests.h"
+#include "soc_ekf.h"
+#include "benchmark.h"
+
+#include "main.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+/** Simulated battery based on the same type of model as the filter, but with different
+ * parameters and measurement noise
+ */
+typedef struct {
+    SocEkf model;           // only used for the OCV curve
+    double soc;             // 0 to 1
+    double v_rc;            // V
+    double r0;              // Ohm
+    double r1;              // Ohm
+    double tau;             // s
+    double capacity;        // Ah
+    double noise;           // peak voltage noise (V)
+} TestBattery;
+
+static void test_battery_init(TestBattery *bat, BatConf *conf, double soc)
+{
+    soc_ekf_init(&bat->model, battery_ocv_curve(conf), conf->num_cells, 1,
+        conf->nominal_capacity, 0, 0, 0);
+    bat->soc = soc;
+    bat->v_rc = 0;
+    bat->r0 = conf->internal_resistance * 1.2;
+    bat->r1 = conf->polarization_resistance * 0.8;
+    bat->tau = conf->polarization_time_constant * 1.5;
+    bat->capacity = conf->nominal_capacity * 0.95;
+    bat->noise = 0.01;
+}
+
+/** Advances the battery by 1 s and returns the measured terminal voltage (mV)
+ */
+static int32_t test_battery_step(TestBattery *bat, double current)
+{
+    bat->soc += current / 3600 / bat->capacity;
+    if (bat->soc > 1) {
+        bat->soc = 1;       // charging stopped by the charger
+    }
+    bat->v_rc += (bat->r1 * current - bat->v_rc) / bat->tau;
+
+    double ocv = soc_ekf_ocv(&bat->model, bat->soc * SOC_EKF_FULL, NULL) / 1e6;
+    double noise = bat->noise * (2.0 * rand() / RAND_MAX - 1);
+    return (ocv + bat->v_rc + bat->r0 * current + noise) * 1000;
+}
+
+static void init_ekf(SocEkf *ekf, BatConf *conf)
+{
+    soc_ekf_init(ekf, battery_ocv_curve(conf), conf->num_cells, 1, conf->nominal_capacity,
+        conf->internal_resistance, conf->polarization_resistance,
+        conf->polarization_time_constant);
+}
+
+/** Current profile of a day (A): night load, charging around noon
+ */
+static double day_current(int t)
+{
+    double hour = fmod(t / 3600.0, 24);
+    if (hour > 7 && hour < 17) {
+        return 15 * sin(M_PI * (hour - 7) / 10) - 3;
+    }
+    return (hour > 18 && hour < 23) ? -8 : -1;
+}
+
+/** Previous SOC estimation (OCV at low currents, filtered) used as a reference
+ */
+static int legacy_soc(BatConf *conf, int *soc_filtered, float voltage, float current)
+{
+    const OcvCurve *curve = battery_ocv_curve(conf);
+    float ocv_empty = curve->points[0].voltage * conf->num_cells / 1000.0;
+    float ocv_full = curve->points[curve->num_points - 1].voltage * conf->num_cells / 1000.0;
+    if (fabs(current) < 0.2) {
+        int soc_new = (int)((voltage - ocv_empty) / (ocv_full - ocv_empty) * 10000.0);
+        if (soc_new > 500 && *soc_filtered == 0) {
+            *soc_filtered = soc_new;
+        }
+        else {
+            *soc_filtered += (soc_new - *soc_filtered) / 100;
+        }
+        if (*soc_filtered > 10000) {
+            *soc_filtered = 10000;
+        }
+        else if (*soc_filtered < 0) {
+            *soc_filtered = 0;
+        }
+    }
+    return *soc_filtered / 100;
+}
+
+void soc_ekf_ocv_interpolation()
+{
+    BatConf conf;
+    SocEkf ekf;
+    int32_t slope;
+    battery_conf_init(&conf, BAT_TYPE_GEL, 6, 100);
+    init_ekf(&ekf, &conf);
+
+    // VRLA curve with 6 cells from 11.4 V to 12.9 V at 25°C
+    TEST_ASSERT_EQUAL(11400000, soc_ekf_ocv(&ekf, 0, &slope));
+    TEST_ASSERT_EQUAL(11790000, soc_ekf_ocv(&ekf, 250000, &slope));
+    TEST_ASSERT_INT_WITHIN(10, 1.56 * 65536, slope);     // 1.56 µV/ppm below 50 %
+    TEST_ASSERT_EQUAL(12180000, soc_ekf_ocv(&ekf, 500000, &slope));
+    TEST_ASSERT_EQUAL(12900000, soc_ekf_ocv(&ekf, SOC_EKF_FULL, &slope));
+    TEST_ASSERT_EQUAL(12900000, soc_ekf_ocv(&ekf, SOC_EKF_FULL + 1000, &slope));
+    TEST_ASSERT_INT_WITHIN(10, 1.44 * 65536, slope);     // 1.44 µV/ppm above 50 %
+}
+
+void soc_ekf_initialized_from_ocv()
+{
+    BatConf conf;
+    SocEkf ekf;
+    battery_conf_init(&conf, BAT_TYPE_GEL, 6, 100);
+    init_ekf(&ekf, &conf);
+
+    soc_ekf_update(&ekf, 12000, 0, OCV_TEMP_REF);
+    TEST_ASSERT_INT_WITHIN(1, 384615, ekf.soc);
+    TEST_ASSERT_EQUAL(200000, soc_ekf_uncertainty(&ekf));
+
+    // voltage drop at internal resistance is compensated
+    init_ekf(&ekf, &conf);
+    soc_ekf_update(&ekf, 12000 - conf.internal_resistance * 10000, -10000, OCV_TEMP_REF);
+    TEST_ASSERT_INT_WITHIN(10, 384615, ekf.soc);
+
+    // higher OCV of lead-acid batteries at high temperatures is compensated
+    init_ekf(&ekf, &conf);
+    soc_ekf_update(&ekf, 12000 + 6 * 0.2 * 20, 0, OCV_TEMP_REF + 20);
+    TEST_ASSERT_INT_WITHIN(1, 384615, ekf.soc);
+}
+
+void soc_ekf_coulomb_counting_without_ocv_curve()
+{
+    BatConf conf;
+    SocEkf ekf;
+    battery_conf_init(&conf, BAT_TYPE_NONE, 6, 100);
+    init_ekf(&ekf, &conf);
+
+    soc_ekf_update(&ekf, 12000, 0, OCV_TEMP_REF);
+    TEST_ASSERT_EQUAL(SOC_EKF_FULL, ekf.soc);
+
+    // 10 A for 1 hour from 100 Ah battery
+    for (int t = 0; t < 3600; t++) {
+        soc_ekf_update(&ekf, 12000, -10000, OCV_TEMP_REF);
+    }
+    TEST_ASSERT_INT_WITHIN(10, 900000, ekf.soc);
+}
+
+void soc_ekf_converges_from_wrong_initial_soc()
+{
+    BatConf conf;
+    SocEkf ekf;
+    TestBattery bat;
+    srand(1);
+    battery_conf_init(&conf, BAT_TYPE_GEL, 6, 100);
+    test_battery_init(&bat, &conf, 0.5);
+    init_ekf(&ekf, &conf);
+
+    soc_ekf_update(&ekf, 12000, 0, OCV_TEMP_REF);
+    soc_ekf_set_full(&ekf);             // wrong SOC with low uncertainty
+    ekf.p[0][0] = (int64_t)100000 * 100000;
+
+    for (int t = 0; t < 3 * 3600; t++) {
+        soc_ekf_update(&ekf, test_battery_step(&bat, -5), -5000, OCV_TEMP_REF);
+    }
+    TEST_ASSERT_INT_WITHIN(30000, bat.soc * SOC_EKF_FULL, ekf.soc);
+    TEST_ASSERT(soc_ekf_uncertainty(&ekf) < 30000);
+}
+
+void soc_ekf_lfp_flat_curve_follows_coulomb_counter()
+{
+    BatConf conf;
+    SocEkf ekf;
+    TestBattery bat;
+    srand(2);
+    battery_conf_init(&conf, BAT_TYPE_LFP, 4, 100);
+    test_battery_init(&bat, &conf, 1.0);
+    bat.capacity = conf.nominal_capacity;
+    init_ekf(&ekf, &conf);
+    soc_ekf_set_full(&ekf);
+
+    // 5 hours discharge with 10 A: 50 % remaining, but OCV changes only by 35 mV, which is less
+    // than the voltage error caused by the mismatch of the resistances
+    for (int t = 0; t < 5 * 3600; t++) {
+        soc_ekf_update(&ekf, test_battery_step(&bat, -10), -10000, OCV_TEMP_REF);
+    }
+    TEST_ASSERT_INT_WITHIN(30000, 500000, ekf.soc);
+    TEST_ASSERT(soc_ekf_uncertainty(&ekf) < 10000);
+}
+
+void soc_ekf_charger_updates_soc()
+{
+    Charger chg(&bat_terminal);
+    battery_conf_init(&bat_conf, BAT_TYPE_GEL, 6, 100);
+    battery_init_dc_bus(&bat_terminal, &bat_conf, 1);
+
+    bat_terminal.voltage = 12.18;
+    bat_terminal.current = 0;
+    chg.update_soc(&bat_conf);
+    TEST_ASSERT_EQUAL(50, chg.soc);
+    TEST_ASSERT_FLOAT_WITHIN(0.1, 20, chg.soc_uncertainty);
+
+    chg.update_soc(&bat_conf);
+    TEST_ASSERT(chg.soc_uncertainty < 20);
+}
+
+void soc_ekf_benchmark()
+{
+    BatConf conf;
+    SocEkf ekf;
+    TestBattery bat;
+    int soc_filtered = 0;
+    double err_ekf = 0;
+    double err_legacy = 0;
+    const int duration = 3 * 24 * 3600;
+
+    srand(3);
+    battery_conf_init(&conf, BAT_TYPE_LFP, 4, 100);
+    test_battery_init(&bat, &conf, 0.6);
+    init_ekf(&ekf, &conf);
+
+    std::vector<int32_t> voltages(duration);
+    std::vector<int32_t> currents(duration);
+    for (int t = 0; t < duration; t++) {
+        currents[t] = day_current(t) * 1000;
+        voltages[t] = test_battery_step(&bat, day_current(t));
+
+        soc_ekf_update(&ekf, voltages[t], currents[t], OCV_TEMP_REF);
+        int legacy = legacy_soc(&conf, &soc_filtered, voltages[t] / 1000.0,
+            currents[t] / 1000.0);
+
+        double err = ekf.soc / 1e4 - bat.soc * 100;
+        err_ekf += err * err;
+        err = legacy - bat.soc * 100;
+        err_legacy += err * err;
+    }
+    err_ekf = sqrt(err_ekf / duration);
+    err_legacy = sqrt(err_legacy / duration);
+
+    // run time of the fixed-point filter for the recorded trace
+    init_ekf(&ekf, &conf);
+    double time_ns = benchmark_ns([&](int i) {
+        soc_ekf_update(&ekf, voltages[i], currents[i], OCV_TEMP_REF);
+    }, duration);
+
+    benchmark_print("SOC EKF RMS error (LFP, 3 days)", err_ekf, "%");
+    benchmark_print("SOC legacy OCV filter RMS error (LFP, 3 days)", err_legacy, "%");
+    benchmark_print("SOC EKF update (host)", time_ns, "ns");
+
+    TEST_ASSERT(err_ekf < 5);
+    TEST_ASSERT(err_ekf < err_legacy);
+}
+
+void soc_ekf_tests()
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(soc_ekf_ocv_interpolation);
+    RUN_TEST(soc_ekf_initialized_from_ocv);
+    RUN_TEST(soc_ekf_coulomb_counting_without_ocv_curve);
+    RUN_TEST(soc_ekf_converges_from_wrong_initial_soc);
+    RUN_TEST(soc_ekf_lfp_flat_curve_follows_coulomb_counter);
+    RUN_TEST(soc_ekf_charger_updates_soc);
+    RUN_TEST(soc_ekf_benchmark);
+
+    UNITY_END();
+}